@@ -10,6 +10,10 @@
 #      in a text file, one per line (e.g. “machine_output.txt”).
 #   2. Run: python simple_simp_decoder.py machine_output.txt
 #   3. It will print each decoded assembly instruction to stdout.
+#
+# disasm_main.c (SimpDisassembler) prints the same listing much faster,
+# reads --binary images too, and checks an image against its source
+# with --verify.
 
 import sys
 
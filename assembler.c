@@ -1,479 +1,1719 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
-#define MAX_LABELS 1024                                                 // max number of labels in a file (used to make a finite label table)
-#define MAX_LABEL_LEN 50                                                    // max number of characters in a label (given)
-#define MAX_LINE_LEN 500                                                // max number of characters in a line (given)
-#define MEM_SIZE 4096                                                   // total 32-bit words in memin.txt
-#define NUM_OPCODES 22
-#define NUM_REGS 16
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include "assembler.h"
+#include "platform.h"
+
+// -----------------------------------------------------------------------
+//  libsimpasm - the SIMP assembler as a library. Nothing here touches
+//  global state or exits; everything for one program lives in an
+//  AsmContext and is handed back in an AsmResult (see assembleProgram).
+//  main.c is the command-line front end.
+// -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
 //    --- Opcode and Register tables ---
 // -----------------------------------------------------------------------
 
-// Opcode table (in order - 0 to 21)
-static const char* opcode_table[] = {
+// Opcode table (in order - 0 to 21) - lookups go through lookupOpcode() below
+const char* const opcode_table[NUM_OPCODES] = {
     "add", "sub", "mul", "and", "or", "xor", "sll", "sra", "srl", "beq",
     "bne", "blt", "bgt", "ble", "bge", "jal", "lw", "sw", "reti", "in",
     "out", "halt"
 };
 
 // List of registers
-static const char* reg_table[16] = {
+const char* const reg_table[NUM_REGS] = {
     "$zero", "$imm", "$v0", "$a0", "$a1", "$a2", "$a3", "$t0",
     "$t1",   "$t2",  "$s0", "$s1", "$s2", "$gp", "$sp", "$ra"
 };
 
-// -----------------------------------------------------------------------
-//    --- Label Struct definition ---
-// -----------------------------------------------------------------------
+// ----------------------------------------------------------------
+//      --- Opcode and Register Table Functions ---
+// ----------------------------------------------------------------
+//  The mnemonic and register sets are fixed, so lookups dispatch on the
+//  first characters and confirm with one compare instead of scanning
+//  opcode_table / reg_table entry by entry.
 
-typedef struct {
-    char name[MAX_LABEL_LEN];                                               // label name
-    int address;                                                        // address to convert to in second pass
-} Label;
+// Compare the rest of a token (after the characters already switched on)
+#define TAIL_IS(s, len, lit) ((len) == sizeof(lit) - 1 && memcmp((s), (lit), sizeof(lit) - 1) == 0)
+
+// Look up a mnemonic of length len (not necessarily '\0'-terminated)
+int lookupOpcode(const char* s, size_t len) {
+    if (len < 2 || len > 4) {
+        return -1;
+    }
+    switch (s[0]) {
+    case 'a':
+        if (TAIL_IS(s, len, "add")) return 0;
+        if (TAIL_IS(s, len, "and")) return 3;
+        break;
+    case 'b':                                                           // all branches are "b" + condition
+        if (len != 3) break;
+        switch (s[1]) {
+        case 'e': return (s[2] == 'q') ? 9 : -1;
+        case 'n': return (s[2] == 'e') ? 10 : -1;
+        case 'l': return (s[2] == 't') ? 11 : (s[2] == 'e') ? 13 : -1;
+        case 'g': return (s[2] == 't') ? 12 : (s[2] == 'e') ? 14 : -1;
+        }
+        break;
+    case 'h':
+        if (TAIL_IS(s, len, "halt")) return 21;
+        break;
+    case 'i':
+        if (TAIL_IS(s, len, "in")) return 19;
+        break;
+    case 'j':
+        if (TAIL_IS(s, len, "jal")) return 15;
+        break;
+    case 'l':
+        if (TAIL_IS(s, len, "lw")) return 16;
+        break;
+    case 'm':
+        if (TAIL_IS(s, len, "mul")) return 2;
+        break;
+    case 'o':
+        if (TAIL_IS(s, len, "or")) return 4;
+        if (TAIL_IS(s, len, "out")) return 20;
+        break;
+    case 'r':
+        if (TAIL_IS(s, len, "reti")) return 18;
+        break;
+    case 's':
+        if (len == 2) return (s[1] == 'w') ? 17 : -1;
+        if (len != 3) break;
+        if (s[1] == 'u' && s[2] == 'b') return 1;
+        if (s[1] == 'l' && s[2] == 'l') return 6;
+        if (s[1] == 'r' && s[2] == 'a') return 7;
+        if (s[1] == 'r' && s[2] == 'l') return 8;
+        break;
+    case 'x':
+        if (TAIL_IS(s, len, "xor")) return 5;
+        break;
+    }
+    return -1;
+}
+
+// Look up a register name of length len (not necessarily '\0'-terminated)
+int lookupReg(const char* s, size_t len) {
+    if (len < 3 || s[0] != '$') {
+        return -1;
+    }
+    if (len == 3) {                                                     // "$" + letter + digit/letter
+        char c = s[2];
+        switch (s[1]) {
+        case 'v': return (c == '0') ? 2 : -1;
+        case 'a': return (c >= '0' && c <= '3') ? 3 + (c - '0') : -1;
+        case 't': return (c >= '0' && c <= '2') ? 7 + (c - '0') : -1;
+        case 's':
+            if (c >= '0' && c <= '2') return 10 + (c - '0');
+            return (c == 'p') ? 14 : -1;
+        case 'g': return (c == 'p') ? 13 : -1;
+        case 'r': return (c == 'a') ? 15 : -1;
+        }
+        return -1;
+    }
+    if (TAIL_IS(s, len, "$zero")) return 0;
+    if (TAIL_IS(s, len, "$imm")) return 1;
+    return -1;
+}
 
-static Label label_table[MAX_LABELS];                                   // table containing all labels, of type Label
+// Convert opcode string to its opcode number (0-21), return -1 if not found
+int convertInstruction(const char* opcode) {
+    return lookupOpcode(opcode, strlen(opcode));
+}
 
-int main(int argc, char** argv) {
+// Convert register name to it's number (0-15), return -1 if not found (get rid of warning)
+int convertReg(const char* reg) {
+    return lookupReg(reg, strlen(reg));
+}
 
-    // -----------------------------------------------------------------------
-    //    --- Open Assembly file and get contents ---
-    // -----------------------------------------------------------------------
+// ----------------------------------------------------------------
+//      --- Label table (per AsmContext) ---
+// ----------------------------------------------------------------
+//  Labels are kept in insertion order in ctx->labels; ctx->label_slots is
+//  an open-addressing hash index into it (slot value = entry index + 1,
+//  0 = empty). Both grow by doubling, so there is no limit on label count.
+//  Names are not copied - they point into the caller's source buffer.
+
+// FNV-1a hash of a label name
+uint32_t hashLabel(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    const char* in_filename = argv[1];
-    const char* out_filename = argv[2];
+// Make room for one more element in a realloc'd array - return 0 on success
+static int reserveOne(AsmContext* ctx, void** array, int* cap, int count, size_t elem_size, int first_cap) {
+    if (count < *cap) {
+        return 0;
+    }
+    int new_cap = *cap ? *cap * 2 : first_cap;
+    void* grown = realloc(*array, (size_t)new_cap * elem_size);
+    if (!grown) {
+        ctx->out_of_memory = 1;
+        return 1;
+    }
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
 
-    FILE* asm_file = fopen(in_filename, "r");
-    if (!asm_file) {
-        fprintf(stderr, "Couldn't open the assembly file for first pass!");
+// Rebuild the hash index with twice as many slots - return 0 on success
+static int growLabelSlots(AsmContext* ctx) {
+    int new_count = ctx->slot_count ? ctx->slot_count * 2 : 256;
+    int* new_slots = calloc((size_t)new_count, sizeof(int));
+    if (!new_slots) {
+        ctx->out_of_memory = 1;
         return 1;
     }
+    for (int i = 0; i < ctx->label_count; i++) {
+        uint32_t s = hashLabel(ctx->labels[i].name, ctx->labels[i].len) & (uint32_t)(new_count - 1);
+        while (new_slots[s]) {
+            s = (s + 1) & (uint32_t)(new_count - 1);                    // linear probing
+        }
+        new_slots[s] = i + 1;
+    }
+    free(ctx->label_slots);
+    ctx->label_slots = new_slots;
+    ctx->slot_count = new_count;
+    return 0;
+}
 
-    // -----------------------------------------------------------------------
-    //    --- First Pass - go over each line, clean it up, store labels ---
-    // -----------------------------------------------------------------------
+// Add the label name[0..len) to the label table
+void defineLabel(AsmContext* ctx, const char* name, size_t len, int addr, int line_num) {
+    if (reserveOne(ctx, (void**)&ctx->labels, &ctx->label_cap, ctx->label_count, sizeof(Label), 128)) {
+        return;
+    }
+    if ((ctx->label_count + 1) * 2 > ctx->slot_count && growLabelSlots(ctx)) {   // keep the index at most half full
+        return;
+    }
 
-    char asm_line[MAX_LINE_LEN];                                        // initialize new line of assembly code
-    int word_address = 0;                                               // address for next instruction in memory
-    int line_num = 0;
+    uint32_t mask = (uint32_t)(ctx->slot_count - 1);
+    uint32_t s = hashLabel(name, len) & mask;
+    while (ctx->label_slots[s]) {
+        const Label* other = &ctx->labels[ctx->label_slots[s] - 1];
+        if (other->len == len && memcmp(other->name, name, len) == 0) {
+            addDiagnostic(ctx, 0, line_num, "label `%.*s` defined twice, keeping the first definition", (int)len, name);
+            return;                                                     // first definition wins, as with the old linear scan
+        }
+        s = (s + 1) & mask;
+    }
 
-    while (fgets(asm_line, MAX_LINE_LEN, asm_file)) {                    // loop over lines of assemble code and get each line
+    Label* lab = &ctx->labels[ctx->label_count];
+    lab->name = name;                                                   // view into the source buffer
+    lab->len = len;
+    lab->address = addr;                                                // save address in label table address field
+    lab->line_num = line_num;
+    ctx->label_slots[s] = ctx->label_count + 1;
+    ctx->label_count++;                                                 // increment to wait for next label
+}
 
-        // --- Remove comment and whitespace ---------------------
-        line_num++;
-        remComment(asm_line);
-        trim(asm_line);
-        if (asm_line[0] == '\0') {
-            continue;                                                   // get rid of lines that are completely blank or just have comments
-        }
-
-        // --- Check if label ------------------------------------
-        size_t asm_line_len = strlen(asm_line);                         // get length of asm_line to check for ":"
-        if (asm_line[asm_line_len - 1] == ':') {                        // it's a label!
-            asm_line[asm_line_len - 1] = '\0';                          // remove colon
-            trim(asm_line);
-            addLabel(asm_line, word_address);                           // add label to label table with current word address
-            fprintf(stderr, "Label: %s\n", asm_line);
-            continue;                                                   // exit while-loop (bypasses other checks)
-        }
-
-        // --- Not label -> must be an instruction ---------------
-        char tmp_word_check[MAX_LINE_LEN];                                         // copy asm_line to tmp (we need asm_line later and musn't override)
-        strncpy(tmp_word_check, asm_line, MAX_LINE_LEN);
-        tmp_word_check[MAX_LINE_LEN - 1] = '\0';
-        char* firstToken = strtok_s(tmp_word_check, " \t,", &tmp_word_check);
-        if (firstToken && strcmp(firstToken, ".word") == 0) {
-            continue;
+// Find the label name[0..len) - return its entry or NULL if not found
+const Label* findLabel(const AsmContext* ctx, const char* name, size_t len) {
+    if (ctx->label_count == 0) {
+        return NULL;
+    }
+    uint32_t mask = (uint32_t)(ctx->slot_count - 1);
+    uint32_t s = hashLabel(name, len) & mask;
+    while (ctx->label_slots[s]) {
+        const Label* lab = &ctx->labels[ctx->label_slots[s] - 1];
+        if (lab->len == len && memcmp(lab->name, name, len) == 0) {
+            return lab;
         }
+        s = (s + 1) & mask;
+    }
+    return NULL;
+}
 
-        char tmp[MAX_LINE_LEN];                                         // copy asm_line to tmp (we need asm_line later and musn't override)
-        strncpy(tmp, asm_line, MAX_LINE_LEN);
-        tmp[MAX_LINE_LEN - 1] = '\0';
+// Get the address of label name[0..len) - return address or −1 if not found
+int lookupLabel(const AsmContext* ctx, const char* name, size_t len) {
+    const Label* lab = findLabel(ctx, name, len);
+    return lab ? lab->address : -1;
+}
 
-        char* tokens[5];                                                // initialize tokens array
-        int token_num = tokenizeInst(tmp, tokens);                      // perform tokenization
+// Add label to the label table (lab_name must stay alive while the table is used)
+void addLabel(AsmContext* ctx, const char* lab_name, int addr) {
+    defineLabel(ctx, lab_name, strlen(lab_name), addr, 0);
+}
+
+// Get label_name's address - return address or −1 if not found (get rid of warning)
+int getLabelAddr(const AsmContext* ctx, const char* lab_name) {
+    return lookupLabel(ctx, lab_name, strlen(lab_name));
+}
 
-        // --- big_imm check ------------------------------------       // DO WE NEED TO DO ALL THE NUMBER CHECKS?
-        const char* imm_str = tokens[4];                                // get pointer to imm token in tokens array
-        int is_label_imm = 0;
-        int imm_val = 0;
+// ----------------------------------------------------------------
+//      --- Read source and split lines into tokens ---
+// ----------------------------------------------------------------
 
-        if (imm_str[0] == '0' && imm_str[1] == 'x') {                    // hex check - starts with "0x"
-            imm_val = (int)strtol(imm_str, NULL, 16);                  // take string value and convert to hexadecimal number
+// Read a whole file into one malloc'd buffer, byte for byte - return NULL on failure
+char* readFileBytes(const char* filename, size_t* len_out) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+    size_t cap = 1 << 16;
+    size_t len = 0;
+    char* buf = malloc(cap);
+    while (buf) {
+        len += fread(buf + len, 1, cap - len, file);
+        if (len < cap) {
+            break;                                                      // short read - end of file (or error)
         }
-        else if (isDecimal(imm_str)) {                                   // decimal check - can be negative
-            imm_val = (int)strtol(imm_str, NULL, 10);                  // take string value and convert to decimal number (int)
+        cap *= 2;
+        char* grown = realloc(buf, cap);
+        if (!grown) {
+            free(buf);
         }
-        else {                                                          // must be a label
-            is_label_imm = 1;                                           // we won't put the label value in the code yet (only in pass 2)
-        }                                                               // here we save space for putting the label address later
+        buf = grown;
+    }
+    int failed = !buf || ferror(file);
+    fclose(file);
+    if (failed) {
+        free(buf);
+        return NULL;
+    }
+    *len_out = len;
+    return buf;
+}
+
+// Read a source file - same as readFileBytes, without a leading UTF-8 BOM
+char* readSourceFile(const char* filename, size_t* len_out) {
+    size_t len = 0;
+    char* buf = readFileBytes(filename, &len);
+    if (!buf) {
+        return NULL;
+    }
+    if (len >= 3 && memcmp(buf, "\xEF\xBB\xBF", 3) == 0) {              // drop a UTF-8 BOM left by the editor
+        memmove(buf, buf + 3, len - 3);
+        len -= 3;
+    }
+    *len_out = len;
+    return buf;
+}
 
-        if (is_label_imm || !fitsInSigned8(imm_val)) {                   // if imm_val is too long to be an 8b integer, or is a label
-            word_address += 2;                                          // save two rows
+// Token separators inside an instruction (everything else is part of a token)
+static int isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Lex the line starting at *cursor in one pass and move *cursor past its newline.
+// Comments ('#' to end of line) and surrounding whitespace are skipped; a line
+// whose last non-blank character is ':' is a label, ".word" and ".global" lines
+// are directives, anything else is an instruction with up to 5 tokens.
+void lexLine(const char** cursor, const char* end, AsmLine* line) {
+    const char* p = *cursor;
+    const char* first = NULL;                                           // first character of the first token
+    const char* last = NULL;                                            // one past the last token
+    line->ntok = 0;
+
+    while (p < end && *p != '\n' && *p != '#') {
+        if (isSeparator(*p)) {
+            p++;
+            continue;
+        }
+        const char* start = p;                                          // start of a token
+        while (p < end && *p != '\n' && *p != '#' && !isSeparator(*p)) {
+            p++;
         }
-        else {                                                          // big_imm = 0 and imm_val fits in 8b
-            word_address += 1;
+        if (line->ntok < 5) {
+            line->tokens[line->ntok].ptr = start;
+            line->tokens[line->ntok].len = (size_t)(p - start);
         }
+        line->ntok++;
+        if (!first) {
+            first = start;
+        }
+        last = p;
     }
 
-    fclose(asm_file);                                                   // we edited this object during pass 1, so we'll close and reopen
-                                                                        // the file to get an unedited opject (to rewind the pointer)
+    if (p < end && *p == '#') {                                         // skip the comment
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        p = nl ? nl : end;
+    }
+    *cursor = (p < end) ? p + 1 : end;                                  // step over '\n'
 
-// --------------------------------------------------------------------------
-//    --- Second Pass - Enter label addresses, convert to machine code ---
-// --------------------------------------------------------------------------
+    if (line->ntok > 5) {
+        line->ntok = 5;                                                 // extra fields are ignored
+    }
+    if (!first) {
+        line->kind = LINE_BLANK;
+    }
+    else if (last[-1] == ':') {                                         // label - name is everything before the colon
+        const char* name_end = last - 1;
+        while (name_end > first && isspace((unsigned char)name_end[-1])) {
+            name_end--;
+        }
+        line->kind = LINE_LABEL;
+        line->label.ptr = first;
+        line->label.len = (size_t)(name_end - first);
+    }
+    else if (line->tokens[0].len == 5 && memcmp(line->tokens[0].ptr, ".word", 5) == 0) {
+        line->kind = LINE_WORD;
+    }
+    else if (line->tokens[0].len == 7 && memcmp(line->tokens[0].ptr, ".global", 7) == 0) {
+        line->kind = LINE_GLOBAL;
+    }
+    else {
+        line->kind = LINE_INST;
+    }
+}
 
-    uint32_t memory_image[MEM_SIZE];                                    // initialize memory of size 4096 rows
+// ----------------------------------------------------------------
+//      --- Number conversion functions ---
+// ----------------------------------------------------------------
 
-    for (int i = 0; i < MEM_SIZE; i++) {                                 // initialize to 0
-        memory_image[i] = 0;
+// Parse a hex ("0x..") or decimal token into *value - return 0 if it is neither (a label)
+int parseNumber(Token tok, int* value) {
+    const char* s = tok.ptr;
+    size_t len = tok.len;
+    uint32_t acc = 0;                                                   // wraps like the old (int)strtol() cast
+
+    if (len >= 2 && s[0] == '0' && s[1] == 'x') {                       // hex check - starts with "0x"
+        for (size_t i = 2; i < len && isxdigit((unsigned char)s[i]); i++) {
+            char c = s[i];
+            uint32_t digit = (c <= '9') ? (uint32_t)(c - '0') : (uint32_t)((c | 0x20) - 'a' + 10);
+            acc = acc * 16 + digit;
+        }
+        *value = (int)acc;
+        return 1;
     }
 
-    asm_file = fopen(in_filename, "r");                                 // reopen the file - we want to see the ":" etc to know
-    if (!asm_file) {                                                     // where labels are, etc
-        fprintf(stderr, "Couldn't open the assembly file for pass 2!");
-        return 1;
+    size_t i = 0;                                                       // decimal check - can be negative
+    int negative = 0;
+    if (len > 0 && (s[0] == '+' || s[0] == '-')) {
+        negative = (s[0] == '-');
+        i = 1;
     }
+    for (; i < len; i++) {
+        if (!isdigit((unsigned char)s[i])) {
+            return 0;                                                   // not a number - must be a label
+        }
+        acc = acc * 10 + (uint32_t)(s[i] - '0');
+    }
+    *value = (int)(negative ? 0u - acc : acc);
+    return 1;
+}
 
-    int current_word = 0;                                               // current word in memory
-    line_num = 0;
+// Check if a value can fit into 8b (signed)
+int fitsInSigned8(int value) {
+    return (value >= -128 && value <= 127);
+}
 
-    while (fgets(asm_line, MAX_LINE_LEN, asm_file)) {                    // go over each row a second time
+// ----------------------------------------------------------------
+//      --- Sparse memory image ---
+// ----------------------------------------------------------------
 
-        // --- Remove comments and trim whitespace again ----------
-        line_num++;
-        remComment(asm_line);
-        trim(asm_line);
+int initImage(MemoryImage* image, int size) {
+    memset(image, 0, sizeof(*image));
+    if (size < 1 || size > MAX_MEM_SIZE) {
+        return 1;
+    }
+    image->size = size;
+    image->page_count = (size + IMAGE_PAGE_WORDS - 1) / IMAGE_PAGE_WORDS;
+    image->pages = calloc((size_t)image->page_count, sizeof(uint32_t*));   // every page starts out as zeros
+    return image->pages == NULL;
+}
 
-        if (asm_line[0] == '\0') {                                       // ignore blank lines
-            continue;
-        }
+void freeImage(MemoryImage* image) {
+    for (int p = 0; image->pages && p < image->page_count; p++) {
+        free(image->pages[p]);
+    }
+    free(image->pages);
+    memset(image, 0, sizeof(*image));
+}
 
-        // --- Check if label ------------------------------------
-        size_t asm_line_len_2 = strlen(asm_line);
-        if (asm_line[asm_line_len_2 - 1] == ':') {                         // don't need to do anything, we already saved all labels
-            continue;
+uint32_t* allocImagePage(MemoryImage* image, int addr) {
+    uint32_t** page = &image->pages[addr / IMAGE_PAGE_WORDS];
+    if (!*page) {
+        *page = calloc(IMAGE_PAGE_WORDS, sizeof(uint32_t));             // a partial last page is allocated whole
+        if (!*page) {
+            return NULL;
         }
+    }
+    return *page + addr % IMAGE_PAGE_WORDS;
+}
 
-        // --- Retokenize instruction ----------------------------
-        char tmp2[MAX_LINE_LEN];                                        // need to make another copy
-        strncpy(tmp2, asm_line, MAX_LINE_LEN);
-        tmp2[MAX_LINE_LEN - 1] = '\0';
-
-        char* tokens[5];
-        int token_num_2 = tokenizeInst(tmp2, tokens);
+int reserveImageWords(MemoryImage* image, int first, int count) {
+    for (int addr = first; addr < first + count; addr += IMAGE_PAGE_WORDS - addr % IMAGE_PAGE_WORDS) {
+        if (!allocImagePage(image, addr)) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-        if (strcmp(tokens[0], ".word") == 0) {
-            if (processWordDirective(tokens, token_num_2, line_num, memory_image)) {
-                // processWordDirective already printed an error
-                fclose(asm_file);
+int copyImageWords(MemoryImage* dst, int dst_addr, const MemoryImage* src, int src_addr, int count) {
+    while (count > 0) {                                                 // one memcpy per stretch inside both pages
+        int n = IMAGE_PAGE_WORDS - dst_addr % IMAGE_PAGE_WORDS;
+        int src_left = IMAGE_PAGE_WORDS - src_addr % IMAGE_PAGE_WORDS;
+        n = (n < src_left) ? n : src_left;
+        n = (n < count) ? n : count;
+        const uint32_t* from = src->pages[src_addr / IMAGE_PAGE_WORDS];
+        if (from || dst->pages[dst_addr / IMAGE_PAGE_WORDS]) {          // zeros onto an unwritten page stay implicit
+            uint32_t* to = imageSlot(dst, dst_addr);
+            if (!to) {
                 return 1;
             }
-            continue;
+            if (from) {
+                memcpy(to, from + src_addr % IMAGE_PAGE_WORDS, (size_t)n * sizeof(uint32_t));
+            }
+            else {
+                memset(to, 0, (size_t)n * sizeof(uint32_t));
+            }
         }
+        dst_addr += n;
+        src_addr += n;
+        count -= n;
+    }
+    return 0;
+}
 
-        // --- Convert opcode to 8b value -------------------------
-        int opcode = convertInstruction(tokens[0]);
-
-        // --- Convert registers to 4b value ----------------------
-        int rd = convertReg(tokens[1]);
-        int rs = convertReg(tokens[2]);
-        int rt = convertReg(tokens[3]);
-
-        // --- Check if big_imm == 1 or 0 -------------------------
-        const char* imm_str2 = tokens[4];
-        int is_label = 0;                                               // check if a value is a label or not for handling
-        int imm_val2 = 0;                                               // will hold the imm value (hex, dec or label address)
+void readImageWords(const MemoryImage* image, int first, int count, uint32_t* out) {
+    for (int i = 0; i < count; i++) {
+        out[i] = imageWord(image, first + i);
+    }
+}
 
-        if (imm_str2[0] == '0' && imm_str2[1] == 'x') {                  // now we convert the values to actually use them
-            imm_val2 = (int)strtol(imm_str2, NULL, 16);
+int imageUsedWords(const MemoryImage* image) {
+    for (int p = image->page_count - 1; p >= 0; p--) {
+        const uint32_t* page = image->pages[p];
+        int w = IMAGE_PAGE_WORDS;
+        while (page && w > 0 && page[w - 1] == 0) {
+            w--;
         }
-        else if (isDecimal(imm_str2)) {
-            imm_val2 = (int)strtol(imm_str2, NULL, 10);
+        if (page && w > 0) {
+            return p * IMAGE_PAGE_WORDS + w;
         }
-        else {
-            is_label = 1;                                               // must be a label - turn this to 1 for future handling
-            imm_val2 = getLabelAddr(imm_str2);                          // get the label address according to the label's name
+    }
+    return 0;
+}
+
+int imageNonzeroWords(const MemoryImage* image) {
+    int count = 0;
+    for (int p = 0; p < image->page_count; p++) {
+        for (int w = 0; image->pages[p] && w < IMAGE_PAGE_WORDS; w++) {
+            count += (image->pages[p][w] != 0);
         }
+    }
+    return count;
+}
+
+// ----------------------------------------------------------------
+//      --- Functions to print 32b machine code to file ---
+// ----------------------------------------------------------------
 
-        int use_bigimm;                                                 // whether to use one or two rows for the instruction
+// Binary digits of every 4-bit value, so a word is formatted with 8 copies
+static const char nibble_bits[16][4] = {
+    {'0','0','0','0'}, {'0','0','0','1'}, {'0','0','1','0'}, {'0','0','1','1'},
+    {'0','1','0','0'}, {'0','1','0','1'}, {'0','1','1','0'}, {'0','1','1','1'},
+    {'1','0','0','0'}, {'1','0','0','1'}, {'1','0','1','0'}, {'1','0','1','1'},
+    {'1','1','0','0'}, {'1','1','0','1'}, {'1','1','1','0'}, {'1','1','1','1'}
+};
 
-        if (is_label || !fitsInSigned8(imm_val2)) {
-            use_bigimm = 1;                                             // labels are always with big_imm == 1, and if the integer is too big
-        }
-        else {
-            use_bigimm = 0;                                             // not a label, integer fits in 8b
-        }
+// Write word as 32 '0'/'1' characters plus '\n' into out[0..IMAGE_LINE_LEN)
+void formatBinaryWord(char* out, uint32_t word) {
+    for (int n = 0; n < 8; n++) {                                       // most significant nibble first
+        memcpy(out + 4 * n, nibble_bits[(word >> (28 - 4 * n)) & 0xF], 4);
+    }
+    out[32] = '\n';                                                     // at the end of the word, put a new line
+}
 
-        // --- Construct first instruction ------------------------
-        uint32_t first_instruction = 0;
+void printBinaryWord(FILE* file_name, uint32_t word) {
+    char line[IMAGE_LINE_LEN];
+    formatBinaryWord(line, word);
+    fwrite(line, 1, IMAGE_LINE_LEN, file_name);
+}
 
-        uint32_t opcode_field = opcode << 24;                           // shift all fields to the right positions in the instruction
-        first_instruction |= opcode_field;                              // do OR to add them to the instruction
+// Number of words up to and including the last non-zero one
+int usedImageWords(const uint32_t* image, int size) {
+    while (size > 0 && image[size - 1] == 0) {
+        size--;
+    }
+    return size;
+}
 
-        uint32_t rd_field = rd << 20;
-        first_instruction |= rd_field;
+#define IMAGE_ADDR_LEN 10                                               // "@" + 8 hex digits + '\n' in IMAGE_SPARSE
 
-        uint32_t rs_field = rs << 16;
-        first_instruction |= rs_field;
+// Write "@<8 hex digits>\n" (IMAGE_ADDR_LEN chars) into out
+static void formatAddressLine(char* out, uint32_t addr) {
+    static const char hex[] = "0123456789ABCDEF";
+    out[0] = '@';
+    for (int n = 0; n < 8; n++) {
+        out[1 + n] = hex[(addr >> (28 - 4 * n)) & 0xF];
+    }
+    out[9] = '\n';
+}
 
-        uint32_t rt_field = rt << 12;
-        first_instruction |= rt_field;
+// Write words [0, count) held in IMAGE_PAGE_WORDS-word pages (NULL = zeros) to filename in one call
+static int writeImagePages(const char* filename, const uint32_t* const* pages, int count, ImageFormat format) {
+    size_t bytes = 0;
+    if (format == IMAGE_SPARSE) {                                       // size first: a line per non-zero word, an address per run
+        int next = -1;
+        for (int addr = 0; addr < count; addr++) {
+            const uint32_t* page = pages[addr / IMAGE_PAGE_WORDS];
+            if (!page) {
+                addr += IMAGE_PAGE_WORDS - 1 - addr % IMAGE_PAGE_WORDS;
+                continue;
+            }
+            if (page[addr % IMAGE_PAGE_WORDS]) {
+                bytes += IMAGE_LINE_LEN + (addr != next ? IMAGE_ADDR_LEN : 0);
+                next = addr + 1;
+            }
+        }
+    }
+    else {
+        bytes = (format == IMAGE_BINARY) ? (size_t)count * 4 : (size_t)count * IMAGE_LINE_LEN;
+    }
+    char* buf = malloc(bytes ? bytes : 1);
+    if (!buf) {
+        return 1;
+    }
 
-        if (use_bigimm) {
-            first_instruction |= (1 << 8);                              // add big_imm == 1 at the 8th bit
+    char* out = buf;
+    int next = -1;
+    for (int base = 0; base < count; base += IMAGE_PAGE_WORDS) {       // a page at a time: unwritten pages read as zeros
+        const uint32_t* page = pages[base / IMAGE_PAGE_WORDS];
+        int n = (count - base < IMAGE_PAGE_WORDS) ? count - base : IMAGE_PAGE_WORDS;
+        if (format == IMAGE_BINARY) {
+            for (int i = 0; i < n; i++) {                               // little-endian regardless of the host
+                uint32_t w = page ? page[i] : 0;
+                out[0] = (char)w;
+                out[1] = (char)(w >> 8);
+                out[2] = (char)(w >> 16);
+                out[3] = (char)(w >> 24);
+                out += 4;
+            }
+        }
+        else if (format == IMAGE_TEXT) {
+            for (int i = 0; i < n; i++) {
+                formatBinaryWord(out, page ? page[i] : 0);
+                out += IMAGE_LINE_LEN;
+            }
         }
         else {
-            uint8_t short_imm = (uint8_t)(imm_val2 & 0xFF);            // cast imm_val2 to 8b, taking only the LSBs
-            first_instruction |= ((uint32_t)short_imm);                // add short_imm to LSBs
+            for (int i = 0; page && i < n; i++) {
+                if (page[i]) {
+                    if (base + i != next) {
+                        formatAddressLine(out, (uint32_t)(base + i));
+                        out += IMAGE_ADDR_LEN;
+                    }
+                    formatBinaryWord(out, page[i]);
+                    out += IMAGE_LINE_LEN;
+                    next = base + i + 1;
+                }
+            }
         }
+    }
+
+    FILE* file = fopen(filename, "wb");                                 // byte-exact: '\n' line ends on every platform
+    if (!file) {
+        free(buf);
+        return 1;
+    }
+    size_t written = fwrite(buf, 1, bytes, file);
+    int failed = (written != bytes);
+    failed |= (fclose(file) != 0);
+    free(buf);
+    return failed;
+}
 
-        // --- Add first instruction to memory --------------------
-        memory_image[current_word] = first_instruction;
-        current_word++;                                                 // increment to go to next word
+// Write image[0..count) to filename in one call - return 0 on success
+int writeMemoryImage(const char* filename, const uint32_t* image, int count, ImageFormat format) {
+    int page_count = (count + IMAGE_PAGE_WORDS - 1) / IMAGE_PAGE_WORDS;
+    const uint32_t** pages = malloc((size_t)(page_count ? page_count : 1) * sizeof(uint32_t*));
+    if (!pages) {
+        return 1;
+    }
+    for (int p = 0; p < page_count; p++) {                              // a page table over the flat array
+        pages[p] = image + (size_t)p * IMAGE_PAGE_WORDS;
+    }
+    int failed = writeImagePages(filename, pages, count, format);
+    free(pages);
+    return failed;
+}
 
-        // --- Construct second instruction (if needed) -----------
-        if (use_bigimm) {
-            memory_image[current_word] = (uint32_t)imm_val2;           // just put in the 32b value (int type)
-            current_word++;
+int writeImage(const char* filename, const MemoryImage* image, int count, ImageFormat format) {
+    if (count > image->size) {
+        count = image->size;
+    }
+    return writeImagePages(filename, (const uint32_t* const*)image->pages, count, format);
+}
+
+// Overwrite the words listed in addrs (ascending) inside an existing image
+// file of the same format; runs of neighbouring words take one write each.
+// Sparse files have no fixed stride, so they can't be patched in place
+int rewriteImageWords(const char* filename, const uint32_t* image, const int* addrs, int count, ImageFormat format) {
+    if (format == IMAGE_SPARSE) {
+        return 1;
+    }
+    size_t stride = (format == IMAGE_BINARY) ? 4 : IMAGE_LINE_LEN;
+    FILE* file = fopen(filename, "r+b");
+    if (!file) {
+        return 1;
+    }
+    char run[64 * IMAGE_LINE_LEN];
+    int failed = 0;
+    int i = 0;
+    while (i < count && !failed) {
+        int first = addrs[i];
+        int n = 0;
+        while (i < count && addrs[i] == first + n && n < 64) {         // at most 64 words per write
+            char* out = run + (size_t)n * stride;
+            uint32_t w = image[addrs[i]];
+            if (format == IMAGE_BINARY) {
+                out[0] = (char)w;
+                out[1] = (char)(w >> 8);
+                out[2] = (char)(w >> 16);
+                out[3] = (char)(w >> 24);
+            }
+            else {
+                formatBinaryWord(out, w);
+            }
+            n++;
+            i++;
         }
+        failed |= fseek(file, (long)((size_t)first * stride), SEEK_SET) != 0;
+        failed |= !failed && fwrite(run, stride, (size_t)n, file) != (size_t)n;
+    }
+    failed |= (fclose(file) != 0);
+    return failed;
+}
+
+// ----------------------------------------------------------------
+//      --- Source map ---
+// ----------------------------------------------------------------
+//  A text file the simulator's profiler reads to map addresses back to
+//  the source. Names come last so they may hold any character but '\n':
+//
+//      SIMPMAP 1
+//      source <file>
+//      label <address> <line> <name>           (one per label)
+//      inst <address> <words> <line>           (one per instruction, by address)
+
+int writeSourceMap(const char* filename, const char* source_name, const AsmResult* result) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        return 1;
+    }
+    fprintf(file, "SIMPMAP 1\nsource %s\n", source_name);
+    for (int i = 0; i < result->label_count; i++) {
+        const Label* lab = &result->labels[i];
+        fprintf(file, "label %d %d %.*s\n", lab->address, lab->line_num, (int)lab->len, lab->name);
     }
+    for (int i = 0; i < result->source_map_count; i++) {
+        const SourceMapEntry* e = &result->source_map[i];
+        int end = (i + 1 < result->source_map_count) ? result->source_map[i + 1].address : result->words_used;
+        fprintf(file, "inst %d %d %d\n", e->address, end - e->address, e->line_num);   // instructions are back to back
+    }
+    int failed = ferror(file);
+    failed |= (fclose(file) != 0);
+    return failed;
+}
 
-    fclose(asm_file);                                                   // close file after finishing second pass
+// Read a text or binary image into image[0..size), zero-filling the rest.
+// Text is detected when the file holds only '0', '1', line ends and, for
+// IMAGE_SPARSE, "@<hex address>" lines that move to another address.
+int readMemoryImage(const char* filename, uint32_t* image, int size, int* count_out) {
+    size_t len = 0;
+    char* buf = readFileBytes(filename, &len);
+    if (!buf) {
+        return 1;
+    }
+    memset(image, 0, (size_t)size * sizeof(uint32_t));
 
-    // -----------------------------------------------------------------------
-    //    --- Create machine code file and transfer the data ---
-    // -----------------------------------------------------------------------
+    int is_text = 1;
+    for (size_t i = 0; i < len && is_text; i++) {
+        if (buf[i] == '@') {
+            while (i + 1 < len && isxdigit((unsigned char)buf[i + 1])) {
+                i++;
+            }
+            continue;
+        }
+        is_text = (buf[i] == '0' || buf[i] == '1' || buf[i] == '\n' || buf[i] == '\r');
+    }
 
-    FILE* machine_code_file = fopen(out_filename, "w");
-    if (!machine_code_file) {
-        fprintf(stderr, "Couldn't open machine code file for output!");
+    int count = 0;
+    int failed = 0;
+    if (is_text) {
+        uint32_t word = 0;
+        int digits = 0;
+        int addr = 0;                                                   // where the next line goes
+        for (size_t i = 0; i <= len; i++) {
+            if (i < len && buf[i] == '@') {
+                uint32_t target = 0;
+                int hex_digits = 0;
+                while (i + 1 < len && isxdigit((unsigned char)buf[i + 1]) && target < (uint32_t)size) {
+                    char c = buf[++i];
+                    target = target * 16 + (uint32_t)(isdigit((unsigned char)c) ? c - '0' : toupper((unsigned char)c) - 'A' + 10);
+                    hex_digits++;
+                }
+                if (digits != 0 || hex_digits == 0 || target >= (uint32_t)size) {
+                    failed = 1;                                         // inside a word, empty, or out of range
+                    break;
+                }
+                addr = (int)target;
+                continue;
+            }
+            if (i < len && (buf[i] == '0' || buf[i] == '1')) {
+                word = (word << 1) | (uint32_t)(buf[i] - '0');
+                digits++;
+                continue;
+            }
+            if (digits == 0) {                                          // blank line or '\r' of a "\r\n"
+                continue;
+            }
+            if (digits != 32 || addr >= size) {
+                failed = 1;
+                break;
+            }
+            image[addr++] = word;
+            count = (addr > count) ? addr : count;
+            word = 0;
+            digits = 0;
+        }
+    }
+    else {
+        const unsigned char* in = (const unsigned char*)buf;
+        if (len % 4 != 0 || len / 4 > (size_t)size) {
+            failed = 1;
+        }
+        for (size_t i = 0; !failed && i < len / 4; i++) {               // little-endian, as writeMemoryImage writes it
+            image[count++] = (uint32_t)in[4 * i] | (uint32_t)in[4 * i + 1] << 8 |
+                             (uint32_t)in[4 * i + 2] << 16 | (uint32_t)in[4 * i + 3] << 24;
+        }
+    }
+    free(buf);
+    if (count_out) {
+        *count_out = count;
+    }
+    return failed;
+}
+
+int processWordDirective(
+    AsmContext* ctx,       // label table and diagnostics
+    Token    tokens[],     // ".word", address and data tokens
+    int      ntok,         // number of tokens found
+    int      lineNo,       // current line number (for error messages)
+    int*     addr_out,     // resolved target address
+    uint32_t* data_out     // resolved 32-bit data value
+) {
+    if (ntok < 3) {
+        addDiagnostic(ctx, 1, lineNo, "`.word` needs an address and a value");
         return 1;
     }
 
-    for (int i = 0; i < MEM_SIZE; i++) {                                 // print each 32b instruction to the machine code file
-        printBinaryWord(machine_code_file, memory_image[i]);
+    // Parse address (tokens[1]) as either hex, decimal, or label→number
+    int addrVal = 0;
+    if (!parseNumber(tokens[1], &addrVal)) {
+        // Must be a label
+        addrVal = lookupLabel(ctx, tokens[1].ptr, tokens[1].len);
+        ctx->stats.label_lookups++;
+        if (addrVal < 0) {
+            addDiagnostic(ctx, 1, lineNo, "unknown label or address `%.*s`", (int)tokens[1].len, tokens[1].ptr);
+            return 1;
+        }
+    }
+
+    // 3) Check address range
+    if (addrVal < 0 || addrVal >= ctx->image.size) {
+        addDiagnostic(ctx, 1, lineNo, "`.word` address %d out of range [0..%d]", addrVal, ctx->image.size - 1);
+        return 1;
+    }
+
+    // 4) Parse data (tokens[2]) as hex, decimal, or label→number
+    int dataVal = 0;
+    if (!parseNumber(tokens[2], &dataVal)) {
+        // Must be a label for data
+        dataVal = lookupLabel(ctx, tokens[2].ptr, tokens[2].len);
+        ctx->stats.label_lookups++;
+        if (dataVal < 0) {
+            addDiagnostic(ctx, 1, lineNo, "unknown label or data `%.*s`", (int)tokens[2].len, tokens[2].ptr);
+            return 1;
+        }
     }
 
-    fclose(machine_code_file);
+    // 5) Finally, hand back the address and the 32-bit dataVal (the caller writes the image)
+    *addr_out = addrVal;
+    *data_out = (uint32_t)dataVal;
 
-    printf("Assembled program: used %d words out of %d.\n", current_word, MEM_SIZE);
+    // 6) Success
     return 0;
 }
 
 // ----------------------------------------------------------------
-//      --- Opcode and Register Table Functions ---
+//      --- Diagnostics ---
 // ----------------------------------------------------------------
 
-// Convert opcode string to its opcode number (0-21), return -1 if not found
-int convertInstruction(const char* opcode) {
-    for (int i = 0; i < NUM_OPCODES; i++) {                              // compare input opcode with i'th entry in opcode_table
-        if (strcmp(opcode, opcode_table[i]) == 0) {
-            return i;
-        }
+// Record an error (is_error = 1) or warning for source line line_num (0 = no line)
+void addDiagnostic(AsmContext* ctx, int is_error, int line_num, const char* fmt, ...) {
+    if (is_error) {
+        ctx->error_count++;
     }
-    return -1;
+    if (reserveOne(ctx, (void**)&ctx->diags, &ctx->diag_cap, ctx->diag_count, sizeof(AsmDiagnostic), 8)) {
+        return;
+    }
+    AsmDiagnostic* d = &ctx->diags[ctx->diag_count++];
+    d->line = line_num;
+    d->is_error = is_error;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(d->message, sizeof(d->message), fmt, args);
+    va_end(args);
 }
 
-// Convert register name to it's number (0-15), return -1 if not found (get rid of warning)
-int convertReg(const char* reg) {
-    for (int i = 0; i < NUM_REGS; i++) {
-        if (strcmp(reg, reg_table[i]) == 0) {                            // compare input register with i'th entry in reg_table
-            return i;
-            if (i == 3) printf("%s", reg);
+// Print every diagnostic as "Error (line N): ..." / "Warning (line N): ..."
+void printDiagnostics(FILE* out, const char* filename, const AsmResult* result) {
+    for (int i = 0; i < result->diagnostic_count; i++) {
+        const AsmDiagnostic* d = &result->diagnostics[i];
+        const char* kind = d->is_error ? "Error" : "Warning";
+        if (d->line > 0) {
+            fprintf(out, "%s: %s (line %d): %s\n", filename, kind, d->line, d->message);
+        }
+        else {
+            fprintf(out, "%s: %s: %s\n", filename, kind, d->message);
         }
     }
-    return -1;
 }
 
 // ----------------------------------------------------------------
-//      --- First Pass function to create Label table ---
+//      --- Assembler context ---
+// ----------------------------------------------------------------
+
+// Set up ctx to assemble src[0..len) - the source must outlive the context
+int initAsmContext(AsmContext* ctx, const char* src, size_t len, const AsmOptions* opts) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->src = src;
+    ctx->src_len = len;
+    if (opts) {
+        ctx->opts = *opts;
+    }
+    if (ctx->opts.mem_size <= 0) {
+        ctx->opts.mem_size = MEM_SIZE;
+    }
+    return initImage(&ctx->image, ctx->opts.mem_size);                  // pages are allocated as words are written
+}
+
+void freeAsmContext(AsmContext* ctx) {
+    free(ctx->labels);
+    free(ctx->label_slots);
+    free(ctx->fixups);
+    free(ctx->word_fixups);
+    free(ctx->exports);
+    free(ctx->map);
+    free(ctx->diags);
+    freeImage(&ctx->image);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+// Stop after opts.max_errors errors (0 = report them all) or when memory ran out
+static int shouldStop(const AsmContext* ctx) {
+    return ctx->out_of_memory || (ctx->opts.max_errors > 0 && ctx->error_count >= ctx->opts.max_errors);
+}
+
+// ----------------------------------------------------------------
+//      --- Single Pass - encode each line, record forward label uses ---
 // ----------------------------------------------------------------
+//  An instruction's size only depends on its own immediate (a label
+//  always takes the big_imm form), so every word can be placed as soon
+//  as its line is read. Label immediates and `.word` directives go on a
+//  fixup list and are patched into the image once all labels are known.
+
+// Parse one instruction line into inst - return 0 on success
+int parseInstruction(AsmContext* ctx, const AsmLine* line, int line_num, AsmInst* inst) {
+    if (line->ntok < 5) {
+        addDiagnostic(ctx, 1, line_num, "expected `opcode rd, rs, rt, imm`");
+        return 1;
+    }
+
+    // --- Convert opcode to 8b value -------------------------
+    int opcode = lookupOpcode(line->tokens[0].ptr, line->tokens[0].len);
+    if (opcode < 0) {
+        addDiagnostic(ctx, 1, line_num, "unknown opcode `%.*s`", (int)line->tokens[0].len, line->tokens[0].ptr);
+        return 1;
+    }
 
-static int label_count = 0;
+    // --- Convert registers to 4b value ----------------------
+    int regs[3];
+    for (int r = 0; r < 3; r++) {
+        const Token* tok = &line->tokens[1 + r];
+        regs[r] = lookupReg(tok->ptr, tok->len);
+        if (regs[r] < 0) {
+            addDiagnostic(ctx, 1, line_num, "unknown register `%.*s`", (int)tok->len, tok->ptr);
+            return 1;
+        }
+    }
 
-// Add label to label_table
-void addLabel(const char* lab_name, int addr) {
-    if (label_count >= MAX_LABELS) {
-        fprintf(stderr, "Label table has too many labels!\n");
-        exit(1);
+    inst->opcode = opcode;
+    inst->rd = regs[0];
+    inst->rs = regs[1];
+    inst->rt = regs[2];
+    inst->imm = 0;                                                      // will hold the imm value (hex or dec; labels are patched later)
+    inst->line_num = line_num;
+    inst->label.ptr = NULL;
+    inst->label.len = 0;
+    if (!parseNumber(line->tokens[4], &inst->imm)) {                    // not a hex/decimal literal - must be a label
+        inst->label = line->tokens[4];
     }
-    strncpy(label_table[label_count].name, lab_name, MAX_LABEL_LEN - 1);    // add lab_name to label_table name field in current label_count position
-    label_table[label_count].name[MAX_LABEL_LEN - 1] = '\0';                // close the string w/ '\0'
-    label_table[label_count].address = addr;                                // save address in label_table address field
-    label_count++;                                                          // increment to wait for next label
+    return 0;
 }
 
-// Get label_name's address - return address or −1 if not found (get rid of warning)
-int getLabelAddr(const char* lab_name) {
-    for (int i = 0; i < label_count; i++) {
-        if (strcmp(label_table[i].name, lab_name) == 0) {
-            return label_table[i].address;
+// Words an instruction takes - labels always use big_imm == 1
+static int instructionWords(const AsmInst* inst) {
+    return (inst->label.ptr || !fitsInSigned8(inst->imm)) ? 2 : 1;
+}
+
+// Build inst's machine words (a label immediate is left as 0) - return how many
+int encodeInstructionWords(const AsmInst* inst, uint32_t words[2]) {
+    int use_bigimm = (instructionWords(inst) == 2);                     // whether to use one or two rows for the instruction
+
+    // --- Construct first instruction ------------------------
+    uint32_t first_instruction = 0;
+
+    uint32_t opcode_field = (uint32_t)inst->opcode << 24;               // shift all fields to the right positions in the instruction
+    first_instruction |= opcode_field;                                  // do OR to add them to the instruction
+
+    uint32_t rd_field = (uint32_t)inst->rd << 20;
+    first_instruction |= rd_field;
+
+    uint32_t rs_field = (uint32_t)inst->rs << 16;
+    first_instruction |= rs_field;
+
+    uint32_t rt_field = (uint32_t)inst->rt << 12;
+    first_instruction |= rt_field;
+
+    if (use_bigimm) {
+        first_instruction |= (1 << 8);                                  // add big_imm == 1 at the 8th bit
+    }
+    else {
+        uint8_t short_imm = (uint8_t)(inst->imm & 0xFF);               // cast imm_val to 8b, taking only the LSBs
+        first_instruction |= ((uint32_t)short_imm);                    // add short_imm to LSBs
+    }
+    words[0] = first_instruction;
+
+    // --- Construct second instruction (if needed) -----------
+    if (use_bigimm) {
+        words[1] = (uint32_t)inst->imm;                                 // just put in the 32b value (int type)
+    }
+    return use_bigimm ? 2 : 1;
+}
+
+// Encode inst at ctx->current_word
+static void emitInstruction(AsmContext* ctx, const AsmInst* inst) {
+    int use_bigimm = (instructionWords(inst) == 2);                     // whether to use one or two rows for the instruction
+
+    if (ctx->current_word + use_bigimm >= ctx->image.size) {
+        addDiagnostic(ctx, 1, inst->line_num, "program does not fit in %d words", ctx->image.size);
+        ctx->out_of_memory = 1;                                         // nothing after this line can be placed either
+        return;
+    }
+    uint32_t* slots[2];                                                 // pages are allocated as the code reaches them
+    slots[0] = imageSlot(&ctx->image, ctx->current_word);
+    slots[1] = use_bigimm ? imageSlot(&ctx->image, ctx->current_word + 1) : slots[0];
+    if (!slots[0] || !slots[1]) {
+        ctx->out_of_memory = 1;
+        return;
+    }
+
+    ctx->stats.instructions++;
+    if (ctx->opts.source_map &&
+        !reserveOne(ctx, (void**)&ctx->map, &ctx->map_cap, ctx->map_count, sizeof(SourceMapEntry), 256)) {
+        ctx->map[ctx->map_count].address = ctx->current_word;
+        ctx->map[ctx->map_count].line_num = inst->line_num;
+        ctx->map_count++;
+    }
+    if (use_bigimm) {
+        if (inst->label.ptr) {
+            ctx->stats.big_imm_label++;
+        }
+        else {
+            ctx->stats.big_imm_constant++;
         }
     }
-    return -1;
+
+    // --- Add the words to memory ----------------------------
+    uint32_t words[2];
+    encodeInstructionWords(inst, words);
+    *slots[0] = words[0];
+    ctx->current_word++;                                                // increment to go to next word
+
+    if (use_bigimm) {
+        if (inst->label.ptr) {                                          // remember the slot, the label address is filled in later
+            if (reserveOne(ctx, (void**)&ctx->fixups, &ctx->fixup_cap, ctx->fixup_count, sizeof(Fixup), 64)) {
+                return;
+            }
+            Fixup* f = &ctx->fixups[ctx->fixup_count++];
+            f->word_index = ctx->current_word;
+            f->line_num = inst->line_num;
+            f->label = inst->label;
+            f->short_form = 0;
+        }
+        *slots[1] = words[1];
+        ctx->current_word++;
+    }
 }
 
 // ----------------------------------------------------------------
-//      --- Remove comments and trim white spaces ---
+//      --- Peephole optimizer (opts.optimize) ---
 // ----------------------------------------------------------------
+//  With opts.optimize the last parsed instruction waits in ctx->pending
+//  instead of being encoded at once, and each new instruction is
+//  matched against it. Labels and `.word` lines flush the pending
+//  instruction first, so nothing is folded across a label and every
+//  label still gets the address of the word that follows it.
+
+const char* const peephole_rule_names[PEEP_RULE_COUNT] = {
+    "mul -> sll", "$zero writes", "constant folds", "branches to next"
+};
+
+// "add rd, $zero, $imm, k" with a numeric k - rd = k
+static int isConstantLoad(const AsmInst* inst) {
+    return inst->opcode == OP_ADD && inst->rd > REG_IMM && !inst->label.ptr &&
+           ((inst->rs == REG_ZERO && inst->rt == REG_IMM) || (inst->rs == REG_IMM && inst->rt == REG_ZERO));
+}
+
+// "add/sub rd, rd, $imm, k" with a numeric k - rd += k or rd -= k
+static int isImmediateStep(const AsmInst* inst) {
+    if ((inst->opcode != OP_ADD && inst->opcode != OP_SUB) || inst->label.ptr || inst->rd <= REG_IMM) {
+        return 0;
+    }
+    if (inst->rs == inst->rd && inst->rt == REG_IMM) {
+        return 1;
+    }
+    return inst->opcode == OP_ADD && inst->rs == REG_IMM && inst->rt == inst->rd;
+}
 
-void remComment(char* line) {
-    char* first_hash = strchr(line, '#');                               // get pointer to first occurance of '#' in line
-    if (first_hash) {                                                   // if this exists
-        *first_hash = '\0';                                             // end the string here
+static void countRule(AsmContext* ctx, PeepholeRule rule, int words_before, int words_after) {
+    ctx->peephole_hits[rule]++;
+    ctx->peephole_words_saved += words_before - words_after;
+}
+
+// Encode the pending instruction, if any
+static void flushPending(AsmContext* ctx) {
+    if (ctx->has_pending) {
+        ctx->has_pending = 0;
+        emitInstruction(ctx, &ctx->pending);
     }
 }
 
-void trim(char* s) {
-    // Trim leading whitespace
-    char* start = s;
-    while (*start && isspace((unsigned char)*start)) {                  // check if isspace() and move pointer if true
-        start++;
+// Queue inst behind the pending one, rewriting or dropping it on the way
+static void optimizeInstruction(AsmContext* ctx, AsmInst inst) {
+    int words = instructionWords(&inst);
+
+    // --- ALU ops and lw into $zero do nothing ---------------
+    if (inst.rd == REG_ZERO && (inst.opcode <= OP_SRL || inst.opcode == OP_LW)) {
+        countRule(ctx, PEEP_ZERO_WRITE, words, 0);
+        return;
+    }
+
+    // --- mul by 2^k -> sll by k -----------------------------
+    if (inst.opcode == OP_MUL && !inst.label.ptr && inst.imm > 0 && (inst.imm & (inst.imm - 1)) == 0 &&
+        (inst.rs == REG_IMM) != (inst.rt == REG_IMM)) {
+        int k = 0;
+        while ((1 << k) != inst.imm) {
+            k++;
+        }
+        inst.opcode = OP_SLL;
+        inst.rs = (inst.rs == REG_IMM) ? inst.rt : inst.rs;             // the shifted register goes first
+        inst.rt = REG_IMM;
+        inst.imm = k;
+        countRule(ctx, PEEP_MUL_TO_SLL, words, instructionWords(&inst));
+        words = instructionWords(&inst);
+    }
+
+    // --- Fold into a pending constant load of the same register
+    AsmInst* prev = &ctx->pending;
+    if (ctx->has_pending && isConstantLoad(prev) && prev->rd == inst.rd) {
+        int prev_words = instructionWords(prev);
+        if (isImmediateStep(&inst)) {                                   // rd = k; rd += j  ->  rd = k + j
+            uint32_t sum = (inst.opcode == OP_ADD) ? (uint32_t)prev->imm + (uint32_t)inst.imm
+                                                   : (uint32_t)prev->imm - (uint32_t)inst.imm;
+            prev->imm = (int)sum;
+            countRule(ctx, PEEP_CONST_FOLD, prev_words + words, instructionWords(prev));
+            return;
+        }
+        if (isConstantLoad(&inst)) {                                    // rd = k; rd = j  ->  rd = j
+            *prev = inst;
+            countRule(ctx, PEEP_CONST_FOLD, prev_words + words, words);
+            return;
+        }
     }
-    if (start != s) {
-        memmove(s, start, strlen(start) + 1);
+
+    flushPending(ctx);
+    ctx->pending = inst;
+    ctx->has_pending = 1;
+}
+
+// A label is about to be defined - drop a pending branch that only jumps to it
+static void optimizeBeforeLabel(AsmContext* ctx, Token label) {
+    const AsmInst* prev = &ctx->pending;
+    if (ctx->has_pending && prev->opcode >= OP_BEQ && prev->opcode <= OP_BGE && prev->rd == REG_IMM &&
+        prev->label.len == label.len && memcmp(prev->label.ptr, label.ptr, label.len) == 0) {
+        countRule(ctx, PEEP_BRANCH_NEXT, instructionWords(prev), 0);
+        ctx->has_pending = 0;
     }
+    flushPending(ctx);
+}
 
-    // Trim trailing whitespace
-    char* end = s + strlen(s) - 1;                                      // get last non-'\0' character
-    while (end >= s && isspace((unsigned char)*end)) {
-        *end = '\0';                                                    // cut end of string off by replacing w/ '\0'
-        end--;
+// Lex and encode every line of ctx->src
+void assembleSource(AsmContext* ctx) {
+    const char* cursor = ctx->src;
+    const char* src_end = ctx->src + ctx->src_len;
+    int line_num = 0;
+
+    while (cursor < src_end && !shouldStop(ctx)) {                       // loop over lines of assemble code and get each line
+
+        // --- Split the line into tokens (comments/blanks skipped) -
+        AsmLine line;
+        line_num++;
+        lexLine(&cursor, src_end, &line);
+
+        switch (line.kind) {
+        case LINE_BLANK:                                                // get rid of lines that are completely blank or just have comments
+            break;
+
+        case LINE_LABEL:                                                // add label to label table with current word address
+            if (ctx->opts.optimize) {
+                optimizeBeforeLabel(ctx, line.label);
+            }
+            defineLabel(ctx, line.label.ptr, line.label.len, ctx->current_word, line_num);
+            break;
+
+        case LINE_WORD: {                                               // `.word` may name a label defined later - apply it at the end
+            if (line.ntok < 3) {
+                addDiagnostic(ctx, 1, line_num, "`.word` needs an address and a value");
+                break;
+            }
+            flushPending(ctx);                                          // first_free_word must see every word before it
+            if (reserveOne(ctx, (void**)&ctx->word_fixups, &ctx->word_fixup_cap, ctx->word_fixup_count, sizeof(WordFixup), 16)) {
+                break;
+            }
+            WordFixup* wf = &ctx->word_fixups[ctx->word_fixup_count++];
+            wf->line_num = line_num;
+            wf->first_free_word = ctx->current_word;
+            memcpy(wf->tokens, line.tokens, sizeof(wf->tokens));
+            break;
+        }
+
+        case LINE_GLOBAL: {                                             // only objects have a scope to export from (see object.c)
+            if (line.ntok != 2) {
+                addDiagnostic(ctx, 1, line_num, "`.global` needs exactly one label name");
+                break;
+            }
+            if (reserveOne(ctx, (void**)&ctx->exports, &ctx->export_cap, ctx->export_count, sizeof(Label), 16)) {
+                break;
+            }
+            Label* exp = &ctx->exports[ctx->export_count++];
+            exp->name = line.tokens[1].ptr;
+            exp->len = line.tokens[1].len;
+            exp->address = -1;
+            exp->line_num = line_num;
+            break;
+        }
+
+        case LINE_INST: {
+            AsmInst inst;
+            if (parseInstruction(ctx, &line, line_num, &inst)) {
+                break;
+            }
+            if (ctx->opts.optimize) {
+                optimizeInstruction(ctx, inst);
+            }
+            else {
+                emitInstruction(ctx, &inst);
+            }
+            break;
+        }
+        }
     }
+    if (!ctx->out_of_memory) {
+        flushPending(ctx);
+    }
+    ctx->line_count = line_num;
 }
 
 // ----------------------------------------------------------------
-//      --- Get Instruction Fields ---
+//      --- Backpatch - enter label addresses, apply `.word` directives ---
 // ----------------------------------------------------------------
 
-// Split on whitespace or comma
-// int tokenizeInst(char *line, char *tokens[]) {
-//     int count = 0;
-//     char *token = strtok(line, " ,");                                   // divide input string up by spaces and commas
-//     while (token != NULL && count < 5) {
-//         tokens[count++] = token;
-//         token = strtok(line, " ,");
-//     }
-//     return count;                                                       // used to check if we got all the fields
-// }
+// Patch ctx's label fixups with addresses from symbols into image[base + word_index]
+// (the code's pages already exist, so modules may patch one image in parallel)
+static void patchLabelFixups(AsmContext* ctx, const AsmContext* symbols, MemoryImage* image, int base) {
+    ctx->stats.label_lookups += ctx->fixup_count;                       // one lookup per fixup
+    for (int i = 0; i < ctx->fixup_count; i++) {
+        const Fixup* f = &ctx->fixups[i];
+        int addr = lookupLabel(symbols, f->label.ptr, f->label.len);    // −1 if the label was never defined
+        if (addr < 0) {
+            addDiagnostic(ctx, 0, f->line_num, "unknown label `%.*s`", (int)f->label.len, f->label.ptr);
+        }
+        uint32_t* slot = imageSlot(image, base + f->word_index);
+        if (!slot) {
+            ctx->out_of_memory = 1;
+        }
+        else if (f->short_form) {                                       // relaxed: address goes in the 8b immediate
+            *slot = (*slot & ~0x1FFu) | ((uint32_t)addr & 0xFF);
+        }
+        else {
+            *slot = (uint32_t)addr;
+        }
+    }
+}
 
-int tokenizeInst(char* line, char* tokens[]) {
-    int count = 0;
-    char* saveptr = NULL;
-    char* p = strtok_s(line, " \t,", &saveptr);
-    while (p && count < 5) {
-        tokens[count++] = p;
-        p = strtok_s(NULL, " \t,", &saveptr);
+// ----------------------------------------------------------------
+//      --- Label immediate relaxation ---
+// ----------------------------------------------------------------
+//  Every label immediate with a known label starts out in the one-word
+//  form. A pass lays the program out and puts back the big_imm word of
+//  each short immediate whose label address no longer fits in the signed
+//  8b field. Growing only moves labels up, so a long immediate never has
+//  to shrink again and the passes stop at a fixed point. The image,
+//  labels, fixups and `.word` bookkeeping are then compacted.
+//  Only label references move - numeric immediates that point into
+//  code are left alone, so --relax expects code to be addressed by label.
+
+// removed[w] = big_imm words dropped below address w for the current forms
+static void countRemovedWords(const AsmContext* ctx, int* removed, int words) {
+    int w = 0, dropped = 0;
+    for (int i = 0; i < ctx->fixup_count; i++) {                        // fixups are in address order
+        if (!ctx->fixups[i].short_form) {
+            continue;
+        }
+        for (; w <= ctx->fixups[i].word_index; w++) {                   // the big_imm word itself counts from the next address
+            removed[w] = dropped;
+        }
+        dropped++;
+    }
+    for (; w <= words; w++) {
+        removed[w] = dropped;
+    }
+}
+
+void relaxLabelImmediates(AsmContext* ctx) {
+    int words = ctx->current_word;
+    int* removed = malloc((size_t)(words + 1) * sizeof(int));
+    int* target = malloc((size_t)(ctx->fixup_count + 1) * sizeof(int));
+    if (!removed || !target) {
+        free(removed);
+        free(target);
+        ctx->out_of_memory = 1;
+        return;
+    }
+
+    ctx->stats.label_lookups += ctx->fixup_count;
+    for (int i = 0; i < ctx->fixup_count; i++) {                        // addresses in the all-long layout
+        target[i] = lookupLabel(ctx, ctx->fixups[i].label.ptr, ctx->fixups[i].label.len);
+        ctx->fixups[i].short_form = (target[i] >= 0);                   // unknown labels stay long (and get a warning later)
+    }
+
+    // --- Iterate to a fixed point -------------------------------------
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        countRemovedWords(ctx, removed, words);
+        for (int i = 0; i < ctx->fixup_count; i++) {
+            Fixup* f = &ctx->fixups[i];
+            if (f->short_form && !fitsInSigned8(target[i] - removed[target[i]])) {
+                f->short_form = 0;
+                changed = 1;
+            }
+        }
+    }
+    ctx->relaxed_count = 0;
+    for (int i = 0; i < ctx->fixup_count; i++) {
+        ctx->relaxed_count += ctx->fixups[i].short_form;
+    }
+
+    // --- Compact the image and move everything that holds an address --
+    if (ctx->relaxed_count > 0) {
+        int out = 0;
+        int next_fixup = 0;
+        for (int w = 0; w < words; w++) {
+            while (next_fixup < ctx->fixup_count && ctx->fixups[next_fixup].word_index < w) {
+                next_fixup++;
+            }
+            if (next_fixup < ctx->fixup_count && ctx->fixups[next_fixup].word_index == w &&
+                ctx->fixups[next_fixup].short_form) {
+                continue;                                               // dropped big_imm word
+            }
+            *imageSlot(&ctx->image, out++) = imageWord(&ctx->image, w); // out <= w: the page was written
+        }
+        for (int w = out; w < words; w++) {
+            *imageSlot(&ctx->image, w) = 0;
+        }
+
+        for (int i = 0; i < ctx->fixup_count; i++) {
+            Fixup* f = &ctx->fixups[i];
+            int first = f->word_index - 1;                              // the instruction word
+            f->word_index = f->short_form ? first - removed[first] : f->word_index - removed[f->word_index];
+        }
+        for (int i = 0; i < ctx->label_count; i++) {
+            ctx->labels[i].address -= removed[ctx->labels[i].address];
+        }
+        for (int i = 0; i < ctx->word_fixup_count; i++) {
+            int ffw = ctx->word_fixups[i].first_free_word;
+            ctx->word_fixups[i].first_free_word = ffw - removed[ffw];
+        }
+        for (int i = 0; i < ctx->map_count; i++) {
+            ctx->map[i].address -= removed[ctx->map[i].address];
+        }
+        ctx->current_word = out;
+    }
+
+    free(removed);
+    free(target);
+}
+
+// Apply the `.word` directives in source order
+static void applyWordFixups(AsmContext* ctx) {
+    for (int i = 0; i < ctx->word_fixup_count && !shouldStop(ctx); i++) {
+        WordFixup* wf = &ctx->word_fixups[i];
+        int word_addr;
+        uint32_t word_data;
+        if (processWordDirective(ctx, wf->tokens, 3, wf->line_num, &word_addr, &word_data)) {
+            continue;                                                   // processWordDirective already recorded an error
+        }
+        if (word_addr >= wf->first_free_word && word_addr < ctx->current_word) {
+            continue;                                                   // an instruction further down the file overwrote this word
+        }
+        uint32_t* slot = imageSlot(&ctx->image, word_addr);
+        if (!slot) {
+            ctx->out_of_memory = 1;
+            return;
+        }
+        *slot = word_data;
     }
-    return count;
+}
+
+void resolveFixups(AsmContext* ctx) {
+    if (ctx->opts.relax) {
+        relaxLabelImmediates(ctx);
+    }
+    patchLabelFixups(ctx, ctx, &ctx->image, 0);
+    applyWordFixups(ctx);
 }
 
 // ----------------------------------------------------------------
-//      --- Number conversion functions ---
+//      --- Diagnostic ordering ---
 // ----------------------------------------------------------------
 
-// Check if the string is a decimal number
-int isDecimal(const char* str_num) {
-    if (*str_num == '+' || *str_num == '-') str_num++;                  // skip "+/-" just for the check
-    while (*str_num) {
-        if (!isdigit((unsigned char)*str_num)) return 0;               // check each char to see if its a digit
-        str_num++;
+typedef struct {
+    int line;
+    int index;                                                          // position when recorded (keeps the sort stable)
+} DiagnosticKey;
+
+static int compareDiagnosticKeys(const void* a, const void* b) {
+    const DiagnosticKey* ka = a;
+    const DiagnosticKey* kb = b;
+    if (ka->line != kb->line) {
+        return (ka->line < kb->line) ? -1 : 1;
     }
-    return 1;                                                           // all char's in string are digits
+    return (ka->index < kb->index) ? -1 : (ka->index > kb->index);
 }
 
-// Check if a value can fit into 8b (signed)
-int fitsInSigned8(int value) {
-    return (value >= -128 && value <= 127);
+// Order diagnostics by source line (fixup warnings are recorded after the pass)
+static void sortDiagnostics(AsmContext* ctx) {
+    int n = ctx->diag_count;
+    if (n < 2) {
+        return;
+    }
+    DiagnosticKey* keys = malloc((size_t)n * sizeof(DiagnosticKey));
+    AsmDiagnostic* sorted = malloc((size_t)n * sizeof(AsmDiagnostic));
+    if (keys && sorted) {
+        for (int i = 0; i < n; i++) {
+            keys[i].line = ctx->diags[i].line;
+            keys[i].index = i;
+        }
+        qsort(keys, (size_t)n, sizeof(DiagnosticKey), compareDiagnosticKeys);
+        for (int i = 0; i < n; i++) {
+            sorted[i] = ctx->diags[keys[i].index];
+        }
+        free(ctx->diags);
+        ctx->diags = sorted;
+        ctx->diag_cap = n;
+        sorted = NULL;
+    }
+    free(keys);
+    free(sorted);
 }
 
 // ----------------------------------------------------------------
-//      --- Function to print 32b machine code to file ---
+//      --- Parallel assembly of large sources ---
 // ----------------------------------------------------------------
+//  A line's size (1 or 2 words) never depends on a label's value, so the
+//  source is cut into line-aligned chunks that are lexed and encoded at
+//  the same time, each with chunk-relative addresses and line numbers.
+//  A prefix sum over the chunk sizes gives every chunk its base address;
+//  the labels are then merged in source order (so the first definition
+//  still wins), and each chunk copies its words into the image and
+//  patches its own label fixups in parallel. `.word` directives are
+//  applied last, in source order, exactly as in the serial pass.
+//  The same module steps link object files (see object.c): an object is
+//  a module whose words and labels were saved instead of kept in memory.
+
+#ifndef ASM_MIN_CHUNK_BYTES
+#define ASM_MIN_CHUNK_BYTES (64 * 1024)                                 // smaller sources are not worth the threads
+#endif
+
+int initModule(AsmModule* module, AsmContext* main, const char* src, size_t len) {
+    module->main = main;
+    module->base_word = 0;
+    module->base_line = 0;
+    return initAsmContext(&module->ctx, src, len, &main->opts);         // same size as main, pages on demand
+}
 
+static void lexChunk(void* arg) {
+    AsmModule* chunk = arg;
+    assembleSource(&chunk->ctx);
+}
 
-void printBinaryWord(FILE* file_name, uint32_t word) {
-    for (int bit = 31; bit >= 0; bit--) {
-        uint32_t shifted_word = word >> bit;
-        char bit_val = (shifted_word & 0x1) ? '1' : '0';               // right shifts word until the required bit is the LSB
-        fputc(bit_val, file_name);                                     // then does & with 1b = 1 to zero all other remaining bits
+void placeModule(void* arg) {
+    AsmModule* module = arg;
+    copyImageWords(&module->main->image, module->base_word, &module->ctx.image, 0, module->ctx.current_word);
+    if (!module->main->opts.relax) {                                    // with relaxation the main context patches after compacting
+        patchLabelFixups(&module->ctx, module->main, &module->main->image, module->base_word);
     }
-    fputc('\n', file_name);                                            // at the end of the word, put a new line
 }
 
-int processWordDirective(
-    char* tokens[],      // array of token strings
-    int      ntok,         // number of tokens found
-    int      lineNo,       // current line number (for error messages)
-    uint32_t memory_image[] // the 4096‐word memory image to write into
-) {
+// Run fn on every chunk - chunk 0 on the calling thread, the rest on their own threads
+static void runOnChunks(AsmModule* chunks, int count, ThreadFunc fn) {
+    Thread* threads = malloc((size_t)count * sizeof(Thread));
+    char* started = calloc((size_t)count, 1);
+    for (int c = 1; c < count; c++) {
+        int ok = threads && started && startThread(&threads[c], fn, &chunks[c]) == 0;
+        if (started) {
+            started[c] = (char)ok;
+        }
+        if (!ok) {
+            fn(&chunks[c]);                                             // no thread - do it here
+        }
+    }
+    fn(&chunks[0]);
+    for (int c = 1; c < count && started; c++) {
+        if (started[c]) {
+            joinThread(threads[c]);
+        }
+    }
+    free(threads);
+    free(started);
+}
 
-    // Parse address (tokens[1]) as either hex, decimal, or label→number
-    int32_t addrVal = 0;
-    if (tokens[1][0] == '0' && tokens[1][1] == 'x') {
-        // Hex literal
-        addrVal = (int32_t)strtol(tokens[1], NULL, 16);
+int layoutModules(AsmContext* ctx, AsmModule* modules, int count) {
+
+    // --- Prefix sums: module base addresses and line numbers ---------
+    int words = 0, lines = 0;
+    for (int c = 0; c < count; c++) {
+        modules[c].base_word = words;
+        modules[c].base_line = lines;
+        words += modules[c].ctx.current_word;
+        lines += modules[c].ctx.line_count;
+        ctx->out_of_memory |= modules[c].ctx.out_of_memory;
     }
-    else if (isDecimal(tokens[1])) {
-        // Decimal literal (possibly negative, but negative addresses are invalid)
-        addrVal = (int32_t)strtol(tokens[1], NULL, 10);
+    ctx->current_word = words;
+    ctx->line_count = lines;
+    if (words > ctx->image.size) {
+        addDiagnostic(ctx, 1, 0, "program does not fit in %d words", ctx->image.size);
+        ctx->out_of_memory = 1;
     }
-    else {
-        // Must be a label
-        int lbl = getLabelAddr(tokens[1]);
-        if (lbl < 0) {
-            fprintf(stderr,
-                "Error (line %d): unknown label or address `%s`\n",
-                lineNo, tokens[1]
-            );
-            return 1;
+    else if (reserveImageWords(&ctx->image, 0, words)) {                // placeModule copies in parallel: no allocation there
+        ctx->out_of_memory = 1;
+    }
+
+    // --- Merge labels and `.word` directives in source order ---------
+    for (int c = 0; c < count && !ctx->out_of_memory; c++) {
+        AsmContext* mc = &modules[c].ctx;
+        for (int i = 0; i < mc->label_count; i++) {
+            const Label* lab = &mc->labels[i];
+            defineLabel(ctx, lab->name, lab->len, modules[c].base_word + lab->address, modules[c].base_line + lab->line_num);
+        }
+        for (int i = 0; i < mc->word_fixup_count; i++) {
+            if (reserveOne(ctx, (void**)&ctx->word_fixups, &ctx->word_fixup_cap, ctx->word_fixup_count, sizeof(WordFixup), 16)) {
+                break;
+            }
+            WordFixup wf = mc->word_fixups[i];
+            wf.line_num += modules[c].base_line;
+            wf.first_free_word += modules[c].base_word;
+            ctx->word_fixups[ctx->word_fixup_count++] = wf;
+        }
+        for (int i = 0; i < mc->map_count; i++) {
+            if (reserveOne(ctx, (void**)&ctx->map, &ctx->map_cap, ctx->map_count, sizeof(SourceMapEntry), 256)) {
+                break;
+            }
+            ctx->map[ctx->map_count].address = modules[c].base_word + mc->map[i].address;
+            ctx->map[ctx->map_count].line_num = modules[c].base_line + mc->map[i].line_num;
+            ctx->map_count++;
+        }
+        for (int i = 0; ctx->opts.relax && i < mc->fixup_count; i++) {   // relaxation needs every fixup in one list
+            if (reserveOne(ctx, (void**)&ctx->fixups, &ctx->fixup_cap, ctx->fixup_count, sizeof(Fixup), 64)) {
+                break;
+            }
+            Fixup f = mc->fixups[i];                                    // module fixups keep module lines - their
+            f.word_index += modules[c].base_word;                       // diagnostics are shifted in finishModules
+            f.line_num += modules[c].base_line;
+            ctx->fixups[ctx->fixup_count++] = f;
         }
-        addrVal = lbl;
     }
+    return ctx->out_of_memory;
+}
 
-    // 3) Check address range
-    if (addrVal < 0 || addrVal >= MEM_SIZE) {
-        fprintf(stderr,
-            "Error (line %d): `.word` address %d out of range [0..%d]\n",
-            lineNo, addrVal, MEM_SIZE - 1
-        );
+void finishModules(AsmContext* ctx, AsmModule* modules, int count) {
+    for (int c = 0; c < count; c++) {                                   // diagnostics move to the main context, absolute lines
+        AsmContext* mc = &modules[c].ctx;
+        for (int i = 0; i < mc->diag_count; i++) {
+            AsmDiagnostic d = mc->diags[i];
+            if (d.line > 0) {
+                d.line += modules[c].base_line;
+            }
+            if (!reserveOne(ctx, (void**)&ctx->diags, &ctx->diag_cap, ctx->diag_count, sizeof(AsmDiagnostic), 8)) {
+                ctx->diags[ctx->diag_count++] = d;
+            }
+            ctx->error_count += d.is_error;
+        }
+        ctx->stats.instructions += mc->stats.instructions;              // counters of the module's own passes
+        ctx->stats.big_imm_label += mc->stats.big_imm_label;
+        ctx->stats.big_imm_constant += mc->stats.big_imm_constant;
+        ctx->stats.label_lookups += mc->stats.label_lookups;
+        freeAsmContext(mc);
+    }
+
+    if (!shouldStop(ctx) && ctx->opts.relax) {
+        relaxLabelImmediates(ctx);
+        patchLabelFixups(ctx, ctx, &ctx->image, 0);
+    }
+    if (!shouldStop(ctx)) {
+        applyWordFixups(ctx);
+    }
+}
+
+// Assemble ctx->src with up to num_chunks threads (same result as the serial pass)
+static void assembleParallel(AsmContext* ctx, int num_chunks) {
+    AsmModule* chunks = calloc((size_t)num_chunks, sizeof(AsmModule));
+    if (!chunks) {
+        ctx->out_of_memory = 1;
+        return;
+    }
+
+    // --- Cut the source at line ends ---------------------------------
+    const char* start = ctx->src;
+    const char* src_end = ctx->src + ctx->src_len;
+    int count = 0;
+    for (int c = 0; c < num_chunks && start < src_end; c++) {
+        const char* end = src_end;
+        if (c < num_chunks - 1) {
+            end = ctx->src + ctx->src_len / (size_t)num_chunks * (size_t)(c + 1);
+            if (end < start) {
+                end = start;
+            }
+            const char* nl = memchr(end, '\n', (size_t)(src_end - end));
+            end = nl ? nl + 1 : src_end;
+        }
+        if (initModule(&chunks[count], ctx, start, (size_t)(end - start))) {
+            freeAsmContext(&chunks[count].ctx);
+            ctx->out_of_memory = 1;
+            break;
+        }
+        count++;
+        start = end;
+    }
+
+    double pass_start = wallSeconds();
+    int placed = 0;
+    if (!ctx->out_of_memory) {
+        runOnChunks(chunks, count, lexChunk);                           // phase 1: lex, size and encode every chunk
+        placed = !layoutModules(ctx, chunks, count);
+    }
+    double resolve_start = wallSeconds();
+    ctx->stats.first_pass_seconds = resolve_start - pass_start;
+    if (placed) {
+        runOnChunks(chunks, count, placeModule);                        // phase 2: place words and patch label fixups
+    }
+    finishModules(ctx, chunks, count);
+    ctx->stats.resolve_seconds = wallSeconds() - resolve_start;
+    free(chunks);
+}
+
+// ----------------------------------------------------------------
+//      --- Library entry point ---
+// ----------------------------------------------------------------
+
+// Assemble src[0..len) into result - return 0 on success, 1 if there were errors.
+// All state lives in a per-call context, so calls may run concurrently.
+int assembleProgram(const char* src, size_t len, const AsmOptions* opts, AsmResult* result) {
+    memset(result, 0, sizeof(*result));
+
+    AsmContext ctx;
+    if (initAsmContext(&ctx, src, len, opts)) {
+        freeAsmContext(&ctx);
+        result->error_count = 1;                                        // no room for diagnostics either
         return 1;
     }
 
-    // 4) Parse data (tokens[2]) as hex, decimal, or label→number
-    int32_t dataVal = 0;
-    if (tokens[2][0] == '0' && tokens[2][1] == 'x') {
-        // Hex literal
-        dataVal = (int32_t)strtol(tokens[2], NULL, 16);
+    int num_chunks = ctx.opts.optimize ? 1 : ctx.opts.threads;          // chunk cuts would change what the optimizer can fold
+    if ((size_t)num_chunks > len / ASM_MIN_CHUNK_BYTES) {
+        num_chunks = (int)(len / ASM_MIN_CHUNK_BYTES);
     }
-    else if (isDecimal(tokens[2])) {
-        // Decimal literal
-        dataVal = (int32_t)strtol(tokens[2], NULL, 10);
+    if (num_chunks > 1) {
+        assembleParallel(&ctx, num_chunks);
     }
     else {
-        // Must be a label for data
-        int lbl2 = getLabelAddr(tokens[2]);
-        if (lbl2 < 0) {
-            fprintf(stderr,
-                "Error (line %d): unknown label or data `%s`\n",
-                lineNo, tokens[2]
-            );
-            return 1;
+        double start = wallSeconds();
+        assembleSource(&ctx);
+        double resolve_start = wallSeconds();
+        ctx.stats.first_pass_seconds = resolve_start - start;
+        if (!shouldStop(&ctx)) {
+            resolveFixups(&ctx);
+            ctx.stats.resolve_seconds = wallSeconds() - resolve_start;
         }
-        dataVal = lbl2;
     }
+    return finishAsmResult(&ctx, result);
+}
 
-    // 5) Finally, write the 32-bit dataVal into memory_image[addrVal]
-    memory_image[(int)addrVal] = (uint32_t)dataVal;
+int finishAsmResult(AsmContext* ctx, AsmResult* result) {
+    if (ctx->out_of_memory && ctx->error_count == 0) {
+        addDiagnostic(ctx, 1, 0, "out of memory");
+    }
+    sortDiagnostics(ctx);
+
+    result->image = ctx->image;                                         // hand the buffers over to the result
+    result->words_used = ctx->current_word;
+    result->relaxed_count = ctx->relaxed_count;
+    memcpy(result->peephole_hits, ctx->peephole_hits, sizeof(result->peephole_hits));
+    result->peephole_words_saved = ctx->peephole_words_saved;
+    result->stats = ctx->stats;
+    result->stats.lines = ctx->line_count;
+    result->stats.labels = ctx->label_count;
+    result->stats.word_directives = ctx->word_fixup_count;
+    result->stats.nonzero_words = imageNonzeroWords(&ctx->image);       // `.word` data may sit past the code
+    for (int p = 0; p < ctx->image.page_count; p++) {
+        result->stats.allocated_words += ctx->image.pages[p] ? IMAGE_PAGE_WORDS : 0;
+    }
+    result->source_map = ctx->map;
+    result->source_map_count = ctx->map_count;
+    result->labels = ctx->labels;
+    result->label_count = ctx->label_count;
+    result->diagnostics = ctx->diags;
+    result->diagnostic_count = ctx->diag_count;
+    result->error_count = ctx->error_count;
+    memset(&ctx->image, 0, sizeof(ctx->image));
+    ctx->map = NULL;
+    ctx->labels = NULL;
+    ctx->diags = NULL;
+    freeAsmContext(ctx);
+
+    return result->error_count ? 1 : 0;
+}
 
-    // 6) Success
-    return 0;
+void freeAsmResult(AsmResult* result) {
+    freeImage(&result->image);
+    free(result->source_map);
+    free(result->labels);
+    free(result->diagnostics);
+    memset(result, 0, sizeof(*result));
 }
@@ -7,46 +7,348 @@
 #include <ctype.h>
 #include <stdint.h>
 
-#define MAX_LABELS 1024
-#define LABEL_LEN 64
-#define ASM_LINE_LEN 512
-#define MEM_SIZE 4096                                                   // total 32-bit words in memin.txt
+#define MEM_SIZE 4096                                                   // total 32-bit words in memin.txt (default image size)
+#define MAX_MEM_SIZE (1 << 30)                                          // largest image AsmOptions.mem_size may ask for
 #define NUM_OPCODES 22
 #define NUM_REGS 16
 
+// Mnemonics and register names, indexed by their encoded number
+extern const char* const opcode_table[NUM_OPCODES];
+extern const char* const reg_table[NUM_REGS];
+
+// Opcode numbers, in opcode_table order
+typedef enum {
+    OP_ADD, OP_SUB, OP_MUL, OP_AND, OP_OR, OP_XOR, OP_SLL, OP_SRA, OP_SRL,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGT, OP_BLE, OP_BGE, OP_JAL,
+    OP_LW, OP_SW, OP_RETI, OP_IN, OP_OUT, OP_HALT
+} Opcode;
+
+enum { REG_ZERO = 0, REG_IMM = 1 };                                     // registers with a fixed meaning
+
 // Convert opcode string to its opcode number (0-21), return -1 if not found
 int convertInstruction(const char* opcode);
 
 // Convert register name to it's number (0-15), return -1 if not found 
 int convertReg(const char* reg);
 
-// Add label to label_table
-void addLabel(const char* lab_name, int addr);
+// Same lookups for a token of length len that need not be '\0'-terminated
+int lookupOpcode(const char* s, size_t len);
+int lookupReg(const char* s, size_t len);
+
+// A token is a view into the source buffer - it is never copied or '\0'-terminated
+typedef struct {
+    const char* ptr;
+    size_t len;
+} Token;
+
+typedef enum {
+    LINE_BLANK,                                                         // empty or comment-only line
+    LINE_LABEL,                                                         // "NAME:"
+    LINE_WORD,                                                          // ".word address, data"
+    LINE_GLOBAL,                                                        // ".global NAME" - export NAME from an object
+    LINE_INST                                                           // "opcode rd, rs, rt, imm"
+} LineKind;
+
+// One lexed source line
+typedef struct {
+    LineKind kind;
+    int ntok;                                                           // number of tokens (at most 5)
+    Token tokens[5];
+    Token label;                                                        // label name, for LINE_LABEL
+} AsmLine;
+
+// One parsed instruction - the form the peephole optimizer rewrites before encoding
+typedef struct {
+    int opcode;
+    int rd, rs, rt;
+    int imm;                                                            // numeric immediate (0 while a label is unresolved)
+    Token label;                                                        // label immediate, ptr == NULL for a number
+    int line_num;
+} AsmInst;
+
+typedef enum {
+    PEEP_MUL_TO_SLL,                                                    // mul by 2^k -> sll by k
+    PEEP_ZERO_WRITE,                                                    // ALU op or lw into $zero dropped
+    PEEP_CONST_FOLD,                                                    // add rd, $zero, $imm, k folded with the next step
+    PEEP_BRANCH_NEXT,                                                   // branch to the label right after it dropped
+    PEEP_RULE_COUNT
+} PeepholeRule;
+
+extern const char* const peephole_rule_names[PEEP_RULE_COUNT];
+
+// --- Assembler state -------------------------------------------------
+
+typedef struct {
+    const char* name;                                                   // label name (view into the source, not '\0'-terminated)
+    size_t len;
+    int address;                                                        // address of the next word after the label
+    int line_num;                                                       // where it was defined
+} Label;
+
+typedef struct {
+    int word_index;                                                     // image slot that waits for the label address
+    int line_num;                                                       // source line (for error messages)
+    Token label;                                                        // label name to resolve once all labels are known
+    int short_form;                                                     // relaxed: word_index is the instruction, address goes in imm8
+} Fixup;
+
+typedef struct {
+    int line_num;                                                       // source line (for error messages)
+    int first_free_word;                                                // current_word when the directive was read
+    Token tokens[3];                                                    // ".word", address and data tokens
+} WordFixup;
+
+typedef struct {
+    int line;                                                           // source line, 0 if not tied to a line
+    int is_error;                                                       // 1 = error, 0 = warning
+    char message[160];
+} AsmDiagnostic;
+
+typedef struct {
+    int max_errors;                                                     // stop after this many errors, 0 = report all
+    int threads;                                                        // split large sources over this many threads (0/1 = serial)
+    int relax;                                                          // shorten label immediates whose address fits in 8b
+    int optimize;                                                       // run the peephole optimizer (assembles serially)
+    int source_map;                                                     // record the source line of every instruction
+    int mem_size;                                                       // addressable words, 0 = MEM_SIZE
+} AsmOptions;
+
+// Where an encoded instruction came from (opts.source_map)
+typedef struct {
+    int address;                                                        // first word of the instruction
+    int line_num;
+} SourceMapEntry;
+
+// Counters and pass times gathered by every assembly (reported by --stats)
+typedef struct {
+    double first_pass_seconds;                                          // lex, parse and encode (all chunks / loading objects)
+    double resolve_seconds;                                             // relaxation, label fixups and `.word` directives
+    int lines;                                                          // source lines
+    int labels;                                                         // labels defined
+    int instructions;                                                   // instructions encoded
+    int big_imm_label;                                                  // ... that took the big_imm word for a label
+    int big_imm_constant;                                               // ... for a constant outside signed 8b
+    int word_directives;
+    long long label_lookups;                                            // label table lookups for fixups and `.word`
+    int nonzero_words;                                                  // image words that are not 0
+    long long allocated_words;                                          // words in the image pages actually allocated
+} AsmStats;
+
+// -----------------------------------------------------------------------
+//  Sparse memory image: a page table of IMAGE_PAGE_WORDS-word pages that
+//  are only allocated when a word in them is written, so an image costs
+//  memory for the code and data it holds, not for its address space.
+// -----------------------------------------------------------------------
+
+#define IMAGE_PAGE_WORDS 1024
+
+typedef struct {
+    uint32_t** pages;                                                   // page_count entries, NULL = never written (all zeros)
+    int page_count;
+    int size;                                                           // addressable words
+} MemoryImage;
+
+// Set up an empty image of size words (1..MAX_MEM_SIZE) - return 0 on success
+int initImage(MemoryImage* image, int size);
+void freeImage(MemoryImage* image);
+
+// Allocate the page holding addr - return the word's slot, NULL if out of memory
+uint32_t* allocImagePage(MemoryImage* image, int addr);
+
+static inline uint32_t imageWord(const MemoryImage* image, int addr) {
+    const uint32_t* page = image->pages[addr / IMAGE_PAGE_WORDS];
+    return page ? page[addr % IMAGE_PAGE_WORDS] : 0;
+}
+
+// Writable slot of addr (< size), allocating its page - NULL if out of memory
+static inline uint32_t* imageSlot(MemoryImage* image, int addr) {
+    uint32_t* page = image->pages[addr / IMAGE_PAGE_WORDS];
+    return page ? page + addr % IMAGE_PAGE_WORDS : allocImagePage(image, addr);
+}
+
+// Allocate every page of [first, first + count) up front, so threads can fill the range - return 0 on success
+int reserveImageWords(MemoryImage* image, int first, int count);
+
+// Copy count words from src at src_addr to dst at dst_addr - return 0 on success
+int copyImageWords(MemoryImage* dst, int dst_addr, const MemoryImage* src, int src_addr, int count);
+
+// Copy words [first, first + count) into out
+void readImageWords(const MemoryImage* image, int first, int count, uint32_t* out);
+
+// Number of words up to and including the last non-zero one
+int imageUsedWords(const MemoryImage* image);
+
+int imageNonzeroWords(const MemoryImage* image);
+
+// Everything one assembly run needs - no assembler state is global
+typedef struct {
+    const char* src;                                                    // source buffer (owned by the caller)
+    size_t src_len;
+    AsmOptions opts;
+
+    Label* labels;                                                      // label table in definition order
+    int label_count, label_cap;
+    int* label_slots;                                                   // hash index into labels (entry + 1, 0 = empty)
+    int slot_count;                                                     // always a power of two
+
+    Fixup* fixups;                                                      // label immediates to patch after the pass
+    int fixup_count, fixup_cap;
+    WordFixup* word_fixups;                                             // `.word` directives, applied in source order
+    int word_fixup_count, word_fixup_cap;
+    Label* exports;                                                     // `.global` names (address unused) - only objects export
+    int export_count, export_cap;
+
+    MemoryImage image;                                                  // memory image being filled (opts.mem_size words)
+    int current_word;                                                   // next free word in image
+    int line_count;                                                     // source lines lexed
+    int relaxed_count;                                                  // label immediates shortened by relaxation
+
+    AsmInst pending;                                                    // optimizer: last instruction, not yet encoded
+    int has_pending;
+    int peephole_hits[PEEP_RULE_COUNT];
+    int peephole_words_saved;
+    AsmStats stats;
+
+    SourceMapEntry* map;                                                // instructions in address order (opts.source_map)
+    int map_count, map_cap;
+
+    AsmDiagnostic* diags;
+    int diag_count, diag_cap;
+    int error_count;
+    int out_of_memory;                                                  // allocation failed or image full - stop
+} AsmContext;
+
+// What assembleProgram hands back - release with freeAsmResult
+typedef struct {
+    MemoryImage image;
+    int words_used;                                                     // words taken by instructions
+    int relaxed_count;                                                  // label immediates shortened (opts.relax)
+    int peephole_hits[PEEP_RULE_COUNT];                                 // rewrites per rule (opts.optimize)
+    int peephole_words_saved;
+    AsmStats stats;
+    SourceMapEntry* source_map;                                         // opts.source_map: one entry per instruction
+    int source_map_count;
+    Label* labels;                                                      // label table (names point into the source)
+    int label_count;
+    AsmDiagnostic* diagnostics;
+    int diagnostic_count;
+    int error_count;
+} AsmResult;
+
+// Assemble src[0..len) (opts may be NULL) - return 0 on success, 1 on errors.
+// Reentrant: all state is per call, so calls may run on several threads.
+int assembleProgram(const char* src, size_t len, const AsmOptions* opts, AsmResult* result);
+void freeAsmResult(AsmResult* result);
+
+// Print diagnostics as "<filename>: Error (line N): ..." lines
+void printDiagnostics(FILE* out, const char* filename, const AsmResult* result);
+
+// Building blocks of assembleProgram
+int initAsmContext(AsmContext* ctx, const char* src, size_t len, const AsmOptions* opts);
+void freeAsmContext(AsmContext* ctx);
+void assembleSource(AsmContext* ctx);                                   // lex + encode, collect fixups
+void resolveFixups(AsmContext* ctx);                                    // patch labels, apply `.word`
+void relaxLabelImmediates(AsmContext* ctx);                             // shorten label immediates that fit in 8b
+void addDiagnostic(AsmContext* ctx, int is_error, int line_num, const char* fmt, ...);
+
+// Parse a LINE_INST line into inst (errors go to ctx) - return 0 on success
+int parseInstruction(AsmContext* ctx, const AsmLine* line, int line_num, AsmInst* inst);
+
+// Machine words of inst, a label immediate left as 0 - return 1 or 2
+int encodeInstructionWords(const AsmInst* inst, uint32_t words[2]);
+int finishAsmResult(AsmContext* ctx, AsmResult* result);                // hand image/diagnostics over, free ctx
+
+// --- Modules: separately encoded pieces of one program ---------------
+// A source chunk (parallel assembly) or an object file (linking) holds
+// words, labels and fixups relative to its own start and line 1.
+
+typedef struct {
+    AsmContext ctx;                                                     // module-local labels, fixups and words
+    AsmContext* main;                                                   // shared context (labels/image, read-only while placing)
+    int base_word;                                                      // absolute address of the module's first word
+    int base_line;                                                      // lines of the modules before it
+} AsmModule;
+
+// Set up an empty module over src[0..len) for main - return 0 on success
+int initModule(AsmModule* module, AsmContext* main, const char* src, size_t len);
+
+// Give modules their base addresses and lines and merge their labels and
+// `.word` directives into main in order - return 0 if everything fits
+int layoutModules(AsmContext* main, AsmModule* modules, int count);
+
+// Copy one module's words into main->image and patch its label fixups (a ThreadFunc)
+void placeModule(void* module);
+
+// Move module diagnostics into main, free the modules, relax and apply `.word`
+void finishModules(AsmContext* main, AsmModule* modules, int count);
+
+// Add label to the label table (lab_name must stay alive while the table is used)
+void addLabel(AsmContext* ctx, const char* lab_name, int addr);
 
 // Get label_name address - return address or −1 if not found
-int getLabelAddr(const char* lab_name);
+int getLabelAddr(const AsmContext* ctx, const char* lab_name);
 
-// Get rid of comments
-void remComment(char* line);
+// Same as addLabel/getLabelAddr for a name of length len
+void defineLabel(AsmContext* ctx, const char* name, size_t len, int addr, int line_num);
+int lookupLabel(const AsmContext* ctx, const char* name, size_t len);
+const Label* findLabel(const AsmContext* ctx, const char* name, size_t len);   // NULL if not defined
+uint32_t hashLabel(const char* name, size_t len);                       // the label index's hash
 
-void trim(char* s);
+// Read a whole file into a malloc'd buffer - return NULL on failure
+char* readFileBytes(const char* filename, size_t* len_out);
+char* readSourceFile(const char* filename, size_t* len_out);            // same, minus a leading UTF-8 BOM
 
-// Split on whitespace or comma to get different parts of the instruction from assembly code
-int tokenizeInst(char* line, char* tokens[]);
+// Lex the line at *cursor (comments, labels, `.word`, `.global` and instructions) and advance past it
+void lexLine(const char** cursor, const char* end, AsmLine* line);
 
-// Check whether a string contains a decimal value
-int isDecimal(const char* s);
+// Parse a hex ("0x..") or decimal token - return 0 if it is neither (i.e. a label)
+int parseNumber(Token tok, int* value);
 
 // Check whether a decimal value fits in signed 8b
 int fitsInSigned8(int value);
 
+// --- Memory image output ---------------------------------------------
+
+#define IMAGE_LINE_LEN 33                                               // 32 binary digits + '\n' per text line
+
+typedef enum {
+    IMAGE_TEXT,                                                         // memin.txt: one 32-char binary line per word
+    IMAGE_BINARY,                                                       // raw little-endian 32-bit words
+    IMAGE_SPARSE                                                        // text lines of the non-zero words only, each run
+                                                                        // of them after an "@<hex address>" line
+} ImageFormat;
+
+// Write one word as 32 binary digits + '\n' (IMAGE_LINE_LEN chars) into out
+void formatBinaryWord(char* out, uint32_t word);
+
 void printBinaryWord(FILE* file_name, uint32_t word);
 
+// Number of words up to and including the last non-zero one
+int usedImageWords(const uint32_t* image, int size);
+
+// Write image[0..count) to filename with a single fwrite - return 0 on success
+int writeMemoryImage(const char* filename, const uint32_t* image, int count, ImageFormat format);
+
+// Same for words [0, count) of a sparse image (IMAGE_SPARSE skips the pages never written)
+int writeImage(const char* filename, const MemoryImage* image, int count, ImageFormat format);
+
+// Overwrite only the words at addrs (ascending) in a text or binary image file written by writeMemoryImage
+int rewriteImageWords(const char* filename, const uint32_t* image, const int* addrs, int count, ImageFormat format);
+
+// Write result's source map (needs opts.source_map) for source_name - return 0 on success
+int writeSourceMap(const char* filename, const char* source_name, const AsmResult* result);
+
+// Read a text (plain or sparse) or binary image into image[0..size) (rest zeroed) - return 0 on success.
+// *count_out is one past the highest word the file sets.
+int readMemoryImage(const char* filename, uint32_t* image, int size, int* count_out);
+
 int processWordDirective(
-    char* tokens[],      // array of token strings
+    AsmContext* ctx,       // label table and diagnostics
+    Token    tokens[],     // ".word", address and data tokens
     int      ntok,         // number of tokens found
     int      lineNo,       // current line number (for error messages)
-    uint32_t memory_image[] // the 4096‐word memory image to write into
+    int*     addr_out,     // resolved target address
+    uint32_t* data_out     // resolved 32-bit data value
 );
 
 #endif // ASSEMBLER_H
@@ -0,0 +1,465 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+// -----------------------------------------------------------------------
+//    --- Assembler phase benchmark ---
+// -----------------------------------------------------------------------
+//  Generates a synthetic SIMP source (or reads one) and times each phase
+//  of the assembler on its own: lexing, parsing, encoding, the first
+//  pass, label resolution, and image output through printBinaryWord and
+//  writeMemoryImage. The result is one JSON object per run on stdout
+//  (append runs to a .jsonl file to track regressions), with a readable
+//  table on stderr.
+//
+//  Large sources do not fit in the 4096-word SIMP memory, so the first
+//  pass runs with the image limit lifted - every phase still runs the
+//  real assembler code.
+//
+//  Build (from the repository root):
+//      make build/asm_bench
+//  Run:
+//      build/asm_bench --lines 1000000 --labels 5 --words 1 --big 20
+//      build/asm_bench --input rectangle.asm --repeat 20
+//      make bench                  (the whole matrix into build/bench-results.jsonl)
+// -----------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include "../assembler.h"
+#include "../platform.h"
+
+static volatile uint32_t sink;                                          // keeps the compiler from dropping results
+
+// -----------------------------------------------------------------------
+//    --- Synthetic source generator ---
+// -----------------------------------------------------------------------
+
+typedef struct {
+    long long lines;                                                    // source lines, including the final halt
+    int label_pct;                                                      // lines that define a label
+    int word_pct;                                                       // `.word` directives
+    int comment_pct;                                                    // blank and comment-only lines
+    int big_pct;                                                        // numeric immediates outside signed 8b
+    int label_ref_pct;                                                  // immediates that name a label
+    uint32_t seed;
+} GenConfig;
+
+typedef struct {
+    char* data;
+    size_t len, cap;
+} TextBuffer;
+
+static uint32_t rng_state;
+
+static uint32_t nextRandom(void) {                                      // xorshift32
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return rng_state = x;
+}
+
+static int chance(int pct) {
+    return (int)(nextRandom() % 100) < pct;
+}
+
+static void appendText(TextBuffer* buf, const char* fmt, ...) {
+    if (buf->cap - buf->len < 128) {
+        size_t new_cap = buf->cap ? buf->cap * 2 : (1u << 20);
+        char* grown = realloc(buf->data, new_cap);
+        if (!grown) {
+            fprintf(stderr, "Out of memory!\n");
+            exit(1);
+        }
+        buf->data = grown;
+        buf->cap = new_cap;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, args);
+    va_end(args);
+    buf->len += (size_t)n;                                              // every line is well under 128 chars
+}
+
+// Immediate operand text: a label, a signed 8b number or a big one
+static void formatImmediate(char* out, size_t size, const GenConfig* cfg, long long num_labels) {
+    if (num_labels > 0 && chance(cfg->label_ref_pct)) {
+        snprintf(out, size, "L%lld", (long long)(nextRandom() % (uint32_t)num_labels));
+    }
+    else if (chance(cfg->big_pct)) {
+        uint32_t value = nextRandom() | 0x100;                          // never fits in signed 8b
+        if (value & 1) {
+            snprintf(out, size, "0x%X", value);
+        }
+        else {
+            snprintf(out, size, "%d", (int)(value >> 1));
+        }
+    }
+    else {
+        snprintf(out, size, "%d", (int)(nextRandom() % 256) - 128);
+    }
+}
+
+static char* generateSource(const GenConfig* cfg, size_t* len_out) {
+    TextBuffer buf = { 0 };
+    rng_state = cfg->seed ? cfg->seed : 1;
+    long long num_labels = cfg->lines * cfg->label_pct / 100;
+    long long defined = 0;
+    char imm[32];
+
+    for (long long i = 0; i + 1 < cfg->lines; i++) {
+        // Labels are spread evenly so references reach both forward and back
+        if (defined < num_labels && i * num_labels >= defined * (cfg->lines - 1)) {
+            appendText(&buf, "L%lld:\n", defined++);
+            continue;
+        }
+        if (chance(cfg->comment_pct)) {
+            appendText(&buf, (i & 1) ? "\n" : "# synthetic workload\n");
+        }
+        else if (chance(cfg->word_pct)) {
+            formatImmediate(imm, sizeof(imm), cfg, num_labels);
+            appendText(&buf, "\t.word %d, %s\n", (int)(nextRandom() % MEM_SIZE), imm);
+        }
+        else {
+            formatImmediate(imm, sizeof(imm), cfg, num_labels);
+            appendText(&buf, "\t%s %s, %s, %s, %s\t\t# generated\n", opcode_table[nextRandom() % OP_HALT],
+                reg_table[nextRandom() % NUM_REGS], reg_table[nextRandom() % NUM_REGS],
+                reg_table[nextRandom() % NUM_REGS], imm);
+        }
+    }
+    while (defined < num_labels) {                                      // tiny sources: define the rest at the end
+        appendText(&buf, "L%lld:\n", defined++);
+    }
+    appendText(&buf, "\thalt $zero, $zero, $zero, 0\n");
+    *len_out = buf.len;
+    return buf.data;
+}
+
+// -----------------------------------------------------------------------
+//    --- Phases ---
+// -----------------------------------------------------------------------
+
+typedef enum {
+    PHASE_LEX,                                                          // lexLine over every line
+    PHASE_PARSE,                                                        // parseInstruction over lexed instructions
+    PHASE_ENCODE,                                                       // encodeInstructionWords over parsed instructions
+    PHASE_FIRST_PASS,                                                   // assembleSource: all of the above plus labels and fixups
+    PHASE_RESOLVE,                                                      // resolveFixups: label immediates and `.word`
+    PHASE_PRINT_WORDS,                                                  // printBinaryWord for every image word
+    PHASE_WRITE_IMAGE,                                                  // writeMemoryImage (one buffered fwrite)
+    PHASE_COUNT
+} Phase;
+
+static const char* const phase_names[PHASE_COUNT] = {
+    "lex", "parse", "encode", "first_pass", "resolve", "print_binary_word", "write_image"
+};
+
+typedef struct {
+    double seconds;                                                     // best of the repeats
+    long long lines;                                                    // source lines read, or image lines written
+    long long bytes;                                                    // source bytes read, or image bytes written
+    long long peak_rss;                                                 // process peak after the phase first ran
+} PhaseResult;
+
+typedef struct {
+    const char* src;
+    size_t len;
+    long long lines;
+    int image_words;                                                    // room for every word of the source
+    const char* out_filename;                                           // scratch file for the output phases
+    PhaseResult phases[PHASE_COUNT];
+    int words, labels, fixups, word_fixups, errors;
+} Bench;
+
+#define BLOCK_LINES 4096                                                // lines lexed ahead of the parse/encode timers
+
+static void recordPhase(Bench* b, Phase phase, double seconds, long long lines, long long bytes) {
+    PhaseResult* r = &b->phases[phase];
+    if (r->peak_rss == 0 || seconds < r->seconds) {
+        r->seconds = seconds;
+    }
+    if (r->peak_rss == 0) {
+        r->peak_rss = peakResidentBytes();
+    }
+    r->lines = lines;
+    r->bytes = bytes;
+}
+
+static void runLex(Bench* b) {
+    const char* cursor = b->src;
+    const char* end = b->src + b->len;
+    long long lines = 0;
+    uint32_t kinds = 0;
+    AsmLine line;
+
+    double start = wallSeconds();
+    while (cursor < end) {
+        lexLine(&cursor, end, &line);
+        kinds += (uint32_t)line.kind;
+        lines++;
+    }
+    double seconds = wallSeconds() - start;
+    sink += kinds;
+    b->lines = lines;
+    recordPhase(b, PHASE_LEX, seconds, lines, (long long)b->len);
+}
+
+// Parse and encode block by block so only those calls are inside the timers
+static void runParseEncode(Bench* b) {
+    AsmLine* lines = malloc(BLOCK_LINES * sizeof(AsmLine));
+    AsmInst* insts = malloc(BLOCK_LINES * sizeof(AsmInst));
+    AsmContext ctx;
+    if (!lines || !insts || initAsmContext(&ctx, b->src, b->len, NULL)) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(1);
+    }
+    const char* cursor = b->src;
+    const char* end = b->src + b->len;
+    double parse_s = 0.0, encode_s = 0.0;
+    long long parsed = 0;
+    uint32_t check = 0;
+
+    while (cursor < end) {
+        int n = 0;
+        while (n < BLOCK_LINES && cursor < end) {
+            lexLine(&cursor, end, &lines[n]);
+            n += (lines[n].kind == LINE_INST);
+        }
+
+        double t0 = wallSeconds();
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            m += !parseInstruction(&ctx, &lines[i], 0, &insts[m]);
+        }
+        double t1 = wallSeconds();
+        for (int i = 0; i < m; i++) {
+            uint32_t words[2];
+            encodeInstructionWords(&insts[i], words);
+            check ^= words[0];
+        }
+        double t2 = wallSeconds();
+
+        parse_s += t1 - t0;
+        encode_s += t2 - t1;
+        parsed += m;
+    }
+    sink += check;
+    recordPhase(b, PHASE_PARSE, parse_s, parsed, (long long)b->len);
+    recordPhase(b, PHASE_ENCODE, encode_s, parsed, (long long)b->len);
+    freeAsmContext(&ctx);
+    free(lines);
+    free(insts);
+}
+
+// First pass and label resolution on a fresh context; the context is kept
+// for the output phases
+static void runAssemble(Bench* b, AsmContext* ctx) {
+    AsmOptions opts = { 0 };
+    opts.mem_size = b->image_words;                                     // lift the 4096-word limit (pages are allocated on demand)
+    if (initAsmContext(ctx, b->src, b->len, &opts)) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(1);
+    }
+
+    double start = wallSeconds();
+    assembleSource(ctx);
+    double first_pass = wallSeconds() - start;
+    recordPhase(b, PHASE_FIRST_PASS, first_pass, b->lines, (long long)b->len);
+
+    start = wallSeconds();
+    resolveFixups(ctx);
+    double resolve = wallSeconds() - start;
+    recordPhase(b, PHASE_RESOLVE, resolve, b->lines, (long long)b->len);
+
+    b->words = ctx->current_word;
+    b->labels = ctx->label_count;
+    b->fixups = ctx->fixup_count;
+    b->word_fixups = ctx->word_fixup_count;
+    b->errors = ctx->error_count;
+}
+
+static void runOutput(Bench* b, const AsmContext* ctx) {
+    long long bytes = (long long)ctx->current_word * IMAGE_LINE_LEN;
+
+    double start = wallSeconds();
+    FILE* file = fopen(b->out_filename, "w");
+    if (!file) {
+        fprintf(stderr, "Couldn't write %s\n", b->out_filename);
+        exit(1);
+    }
+    for (int i = 0; i < ctx->current_word; i++) {
+        printBinaryWord(file, imageWord(&ctx->image, i));
+    }
+    fclose(file);
+    recordPhase(b, PHASE_PRINT_WORDS, wallSeconds() - start, ctx->current_word, bytes);
+
+    start = wallSeconds();
+    if (writeImage(b->out_filename, &ctx->image, ctx->current_word, IMAGE_TEXT)) {
+        fprintf(stderr, "Couldn't write %s\n", b->out_filename);
+        exit(1);
+    }
+    recordPhase(b, PHASE_WRITE_IMAGE, wallSeconds() - start, ctx->current_word, bytes);
+    remove(b->out_filename);
+}
+
+// -----------------------------------------------------------------------
+//    --- Report ---
+// -----------------------------------------------------------------------
+
+static double perSecond(long long count, double seconds) {
+    return seconds > 0 ? (double)count / seconds : 0.0;
+}
+
+static void printJson(const Bench* b, const GenConfig* cfg, const char* input, int repeat) {
+    printf("{\"bench\":\"asm_bench\",");
+    if (input) {
+        printf("\"input\":\"%s\",", input);                             // file names are taken as they are
+    }
+    else {
+        printf("\"generator\":{\"lines\":%lld,\"label_pct\":%d,\"word_pct\":%d,\"comment_pct\":%d,"
+            "\"big_pct\":%d,\"label_ref_pct\":%d,\"seed\":%u},",
+            cfg->lines, cfg->label_pct, cfg->word_pct, cfg->comment_pct, cfg->big_pct, cfg->label_ref_pct, cfg->seed);
+    }
+    printf("\"repeat\":%d,\"source_lines\":%lld,\"source_bytes\":%zu,\"words\":%d,\"labels\":%d,"
+        "\"label_fixups\":%d,\"word_directives\":%d,\"errors\":%d,\"phases\":{",
+        repeat, b->lines, b->len, b->words, b->labels, b->fixups, b->word_fixups, b->errors);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const PhaseResult* r = &b->phases[p];
+        printf("%s\"%s\":{\"seconds\":%.6f,\"lines\":%lld,\"bytes\":%lld,\"lines_per_sec\":%.0f,"
+            "\"bytes_per_sec\":%.0f,\"peak_rss_bytes\":%lld}",
+            p ? "," : "", phase_names[p], r->seconds, r->lines, r->bytes,
+            perSecond(r->lines, r->seconds), perSecond(r->bytes, r->seconds), r->peak_rss);
+    }
+    printf("},\"peak_rss_bytes\":%lld}\n", peakResidentBytes());
+}
+
+static void printTable(const Bench* b) {
+    fprintf(stderr, "%lld lines, %zu bytes -> %d words, %d labels, %d label fixups, %d .word\n",
+        b->lines, b->len, b->words, b->labels, b->fixups, b->word_fixups);
+    fprintf(stderr, "%-18s %10s %14s %10s %10s\n", "phase", "ms", "lines/s", "MB/s", "peak MB");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const PhaseResult* r = &b->phases[p];
+        fprintf(stderr, "%-18s %10.3f %14.0f %10.1f %10.1f\n", phase_names[p], r->seconds * 1e3,
+            perSecond(r->lines, r->seconds), perSecond(r->bytes, r->seconds) / 1e6, r->peak_rss / 1e6);
+    }
+}
+
+static void printUsage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  --lines N        generated source lines (default 100000)\n");
+    fprintf(stderr, "  --labels PCT     lines that define a label (default 5)\n");
+    fprintf(stderr, "  --words PCT      `.word` directives (default 1)\n");
+    fprintf(stderr, "  --comments PCT   blank and comment lines (default 5)\n");
+    fprintf(stderr, "  --big PCT        numeric immediates that need the big_imm word (default 20)\n");
+    fprintf(stderr, "  --label-refs PCT immediates that name a label (default 10)\n");
+    fprintf(stderr, "  --seed N         generator seed (default 1)\n");
+    fprintf(stderr, "  --emit FILE      also write the generated source to FILE\n");
+    fprintf(stderr, "  --input FILE     benchmark FILE instead of a generated source\n");
+    fprintf(stderr, "  --repeat N       keep the best of N runs per phase (default 3)\n");
+    fprintf(stderr, "  --out FILE       scratch image for the output phases (default asm_bench_image.txt)\n");
+}
+
+int main(int argc, char** argv) {
+    GenConfig cfg = { 100000, 5, 1, 5, 20, 10, 1 };
+    const char* emit = NULL;
+    const char* input = NULL;
+    int repeat = 3;
+    Bench b;
+    memset(&b, 0, sizeof(b));
+    b.out_filename = "asm_bench_image.txt";
+
+    for (int i = 1; i < argc; i++) {
+        int has_value = (i + 1 < argc);                                 // every option takes a value
+        if (has_value && strcmp(argv[i], "--lines") == 0) {
+            cfg.lines = atoll(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--labels") == 0) {
+            cfg.label_pct = atoi(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--words") == 0) {
+            cfg.word_pct = atoi(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--comments") == 0) {
+            cfg.comment_pct = atoi(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--big") == 0) {
+            cfg.big_pct = atoi(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--label-refs") == 0) {
+            cfg.label_ref_pct = atoi(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--seed") == 0) {
+            cfg.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (has_value && strcmp(argv[i], "--emit") == 0) {
+            emit = argv[++i];
+        }
+        else if (has_value && strcmp(argv[i], "--input") == 0) {
+            input = argv[++i];
+        }
+        else if (has_value && strcmp(argv[i], "--repeat") == 0) {
+            repeat = atoi(argv[++i]);
+        }
+        else if (has_value && strcmp(argv[i], "--out") == 0) {
+            b.out_filename = argv[++i];
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.lines < 1) {
+        cfg.lines = 1;
+    }
+    if (repeat < 1) {
+        repeat = 1;
+    }
+
+    // --- Source ----------------------------------------------------------
+    char* src;
+    if (input) {
+        src = readSourceFile(input, &b.len);
+        if (!src) {
+            fprintf(stderr, "Couldn't open %s\n", input);
+            return 1;
+        }
+    }
+    else {
+        src = generateSource(&cfg, &b.len);
+        if (emit) {
+            FILE* file = fopen(emit, "wb");
+            if (!file || fwrite(src, 1, b.len, file) != b.len) {
+                fprintf(stderr, "Couldn't write %s\n", emit);
+                return 1;
+            }
+            fclose(file);
+        }
+    }
+    b.src = src;
+
+    // --- Phases ----------------------------------------------------------
+    runLex(&b);
+    long long max_words = b.lines * 2 + 2;                              // at most two words per line
+    b.image_words = (max_words > (1 << 30)) ? (1 << 30) : (int)max_words;
+    if (b.image_words < MEM_SIZE) {
+        b.image_words = MEM_SIZE;
+    }
+
+    for (int r = 0; r < repeat; r++) {
+        if (r > 0) {
+            runLex(&b);
+        }
+        runParseEncode(&b);
+        AsmContext ctx;
+        runAssemble(&b, &ctx);
+        runOutput(&b, &ctx);
+        freeAsmContext(&ctx);
+    }
+
+    printTable(&b);
+    printJson(&b, &cfg, input, repeat);
+    free(src);
+    return 0;
+}
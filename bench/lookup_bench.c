@@ -0,0 +1,152 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+// -----------------------------------------------------------------------
+//    --- Lookup microbenchmark ---
+// -----------------------------------------------------------------------
+//  Compares the old linear-scan lookups (copied below) with the switch
+//  based opcode/register lookup and the hashed label table.
+//
+//  Build (from the repository root):
+//      make build/lookup_bench
+//  Run:
+//      build/lookup_bench [labels]
+// -----------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../assembler.h"
+
+#define NAME_LEN 50
+
+static volatile int sink;                                               // keeps the compiler from dropping the lookups
+
+// --- Old implementations (linear scans) ------------------------------
+
+static int linearInstruction(const char* opcode) {
+    for (int i = 0; i < NUM_OPCODES; i++) {
+        if (strcmp(opcode, opcode_table[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int linearReg(const char* reg) {
+    for (int i = 0; i < NUM_REGS; i++) {
+        if (strcmp(reg, reg_table[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static char (*linear_names)[NAME_LEN];
+static int linear_count;
+
+static int linearLabelAddr(const char* lab_name) {
+    for (int i = 0; i < linear_count; i++) {
+        if (strcmp(linear_names[i], lab_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// --- Timing helpers ---------------------------------------------------
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void report(const char* what, long lookups, double old_s, double new_s) {
+    printf("%-22s  linear %12.0f lookups/s   new %12.0f lookups/s   speedup %6.1fx\n",
+        what, lookups / old_s, lookups / new_s, old_s / new_s);
+}
+
+int main(int argc, char** argv) {
+    int num_labels = (argc > 1) ? atoi(argv[1]) : 4096;
+    if (num_labels < 1) {
+        num_labels = 1;
+    }
+
+    // --- Opcodes and registers ---------------------------------------
+    const long rounds = 2000000;
+    int check = 0;
+
+    clock_t t = clock();
+    for (long r = 0; r < rounds; r++) {
+        check += linearInstruction(opcode_table[r % NUM_OPCODES]);
+    }
+    double old_op = seconds(t);
+
+    t = clock();
+    for (long r = 0; r < rounds; r++) {
+        check -= convertInstruction(opcode_table[r % NUM_OPCODES]);
+    }
+    double new_op = seconds(t);
+
+    t = clock();
+    for (long r = 0; r < rounds; r++) {
+        check += linearReg(reg_table[r % NUM_REGS]);
+    }
+    double old_reg = seconds(t);
+
+    t = clock();
+    for (long r = 0; r < rounds; r++) {
+        check -= convertReg(reg_table[r % NUM_REGS]);
+    }
+    double new_reg = seconds(t);
+
+    if (check != 0) {
+        fprintf(stderr, "Lookup mismatch between old and new tables!\n");
+        return 1;
+    }
+
+    // --- Labels --------------------------------------------------------
+    AsmContext ctx;
+    linear_names = malloc((size_t)num_labels * sizeof(*linear_names));
+    if (!linear_names || initAsmContext(&ctx, NULL, 0, NULL)) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+    for (int i = 0; i < num_labels; i++) {
+        snprintf(linear_names[i], NAME_LEN, "LABEL_%d", i);
+        addLabel(&ctx, linear_names[i], i);
+    }
+    linear_count = num_labels;
+
+    long label_lookups = 0;
+    t = clock();
+    do {                                                                // look every label up at least once
+        for (int i = 0; i < num_labels; i++) {
+            check += linearLabelAddr(linear_names[(i * 7919) % num_labels]);
+        }
+        label_lookups += num_labels;
+    } while (seconds(t) < 0.2);
+    double old_lab = seconds(t);
+
+    t = clock();
+    for (long n = 0; n < label_lookups; n += num_labels) {
+        for (int i = 0; i < num_labels; i++) {
+            check -= getLabelAddr(&ctx, linear_names[(i * 7919) % num_labels]);
+        }
+    }
+    double new_lab = seconds(t);
+    sink = check;
+
+    if (check != 0) {
+        fprintf(stderr, "Lookup mismatch between old and new label tables!\n");
+        return 1;
+    }
+
+    printf("opcode/register lookups: %ld each, labels: %d\n", rounds, num_labels);
+    report("convertInstruction", rounds, old_op, new_op);
+    report("convertReg", rounds, old_reg, new_reg);
+    report("getLabelAddr", label_lookups, old_lab, new_lab);
+
+    freeAsmContext(&ctx);
+    free(linear_names);
+    return 0;
+}
@@ -0,0 +1,556 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "simulator.h"
+#include "devices.h"
+#include "blocks.h"
+
+typedef enum {
+    BOP_ADD_RR, BOP_SUB_RR, BOP_MUL_RR, BOP_AND_RR, BOP_OR_RR,          // both operands registers
+    BOP_XOR_RR, BOP_SLL_RR, BOP_SRA_RR, BOP_SRL_RR,
+    BOP_ADD_RC, BOP_SUB_RC, BOP_MUL_RC, BOP_AND_RC, BOP_OR_RC,          // rt is the constant
+    BOP_XOR_RC, BOP_SLL_RC, BOP_SRA_RC, BOP_SRL_RC,
+    BOP_SUB_CR, BOP_SLL_CR, BOP_SRA_CR, BOP_SRL_CR,                     // rs is (the others are swapped to _RC)
+    BOP_LI,                                                             // both constant, folded
+    BOP_LW_RR, BOP_LW_RC, BOP_LW_C,
+    BOP_SW, BOP_IN, BOP_OUT,                                            // as decoded, with $imm loaded
+    BOP_OUT_STORE, BOP_OUT_MONITOR,                                     // out to a constant register: rs holds it
+    BOP_BEQ_T, BOP_BNE_T, BOP_BLT_T, BOP_BGT_T, BOP_BLE_T, BOP_BGE_T,   // constant target: leave for next_pc if taken
+    BOP_BEQ_F, BOP_BNE_F, BOP_BLT_F, BOP_BGT_F, BOP_BLE_F, BOP_BGE_F,   // ... or if not taken
+    BOP_BEQ, BOP_BNE, BOP_BLT, BOP_BGT, BOP_BLE, BOP_BGE,               // register target - the rest end a block
+    BOP_JAL, BOP_RETI, BOP_HALT, BOP_INVALID,
+    BOP_EXIT,                                                           // cut at SIM_BLOCK_MAX - go on at next_pc
+    NUM_BLOCK_OPS
+} BlockOpKind;
+
+#if defined(__GNUC__) && !defined(SIM_NO_COMPUTED_GOTO)
+#define BLOCK_COMPUTED_GOTO 1
+#else
+#define BLOCK_COMPUTED_GOTO 0
+#endif
+
+// -----------------------------------------------------------------------
+//    --- Translation ---
+// -----------------------------------------------------------------------
+
+void flushBlocks(BlockCache* cache) {
+    memset(cache->block_at, 0, sizeof(cache->block_at));
+    memset(cache->covered, 0, sizeof(cache->covered));
+    cache->block_count = 0;
+    cache->op_count = 0;
+    cache->flushes++;
+}
+
+static uint32_t foldAlu(uint32_t opcode, uint32_t a, uint32_t b) {
+    switch (opcode) {
+    case OP_ADD: return a + b;
+    case OP_SUB: return a - b;
+    case OP_MUL: return a * b;
+    case OP_AND: return a & b;
+    case OP_OR:  return a | b;
+    case OP_XOR: return a ^ b;
+    case OP_SLL: return a << (b & 31);
+    case OP_SRA: return (uint32_t)((int32_t)a >> (b & 31));
+    default:     return a >> (b & 31);                                  // OP_SRL
+    }
+}
+
+// $zero and $imm read as constants
+static int isConstant(uint8_t reg) {
+    return reg <= REG_IMM;
+}
+
+static uint32_t constantOf(uint8_t reg, int32_t imm) {
+    return (reg == REG_ZERO) ? 0 : (uint32_t)imm;
+}
+
+// Pick the op for one instruction - return 0 if it needs none ($zero / $imm writes)
+static int specialise(const SimInst* d, BlockOp* op) {
+    int rs_const = isConstant(d->rs);
+    int rt_const = isConstant(d->rt);
+    uint32_t a = constantOf(d->rs, d->imm);
+    uint32_t b = constantOf(d->rt, d->imm);
+
+    switch (d->opcode) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_AND: case OP_OR:
+    case OP_XOR: case OP_SLL: case OP_SRA: case OP_SRL:
+        if (d->wd == SIM_REG_SINK) {
+            return 0;
+        }
+        if (rs_const && rt_const) {
+            op->kind = BOP_LI;
+            op->imm = (int32_t)foldAlu(d->opcode, a, b);
+        }
+        else if (rt_const) {
+            op->kind = (uint8_t)(BOP_ADD_RC + d->opcode - OP_ADD);
+            op->imm = (int32_t)b;
+        }
+        else if (rs_const && (d->opcode == OP_SUB || d->opcode >= OP_SLL)) {
+            op->kind = (uint8_t)((d->opcode == OP_SUB) ? BOP_SUB_CR : BOP_SLL_CR + d->opcode - OP_SLL);
+            op->imm = (int32_t)a;
+        }
+        else if (rs_const) {                                            // commutative: constant second
+            op->kind = (uint8_t)(BOP_ADD_RC + d->opcode - OP_ADD);
+            op->rs = d->rt;
+            op->imm = (int32_t)a;
+        }
+        else {
+            op->kind = (uint8_t)(BOP_ADD_RR + d->opcode - OP_ADD);
+        }
+        return 1;
+    case OP_LW:
+        if (d->wd == SIM_REG_SINK) {
+            return 0;
+        }
+        if (rs_const && rt_const) {
+            op->kind = BOP_LW_C;
+            op->imm = (int32_t)((a + b) & SIM_ADDR_MASK);
+        }
+        else if (rs_const || rt_const) {
+            op->kind = BOP_LW_RC;
+            op->rs = rs_const ? d->rt : d->rs;
+            op->imm = (int32_t)(rs_const ? a : b);
+        }
+        else {
+            op->kind = BOP_LW_RR;
+        }
+        return 1;
+    case OP_SW:   op->kind = BOP_SW;   return 1;
+    case OP_IN:   op->kind = BOP_IN;   return 1;
+    case OP_OUT:
+        op->kind = BOP_OUT;
+        if (rs_const && rt_const && (a + b == IO_MONITORCMD || isPlainIoRegister(a + b))) {
+            op->kind = (a + b == IO_MONITORCMD) ? BOP_OUT_MONITOR : BOP_OUT_STORE;
+            op->rs = (uint8_t)(a + b);
+        }
+        return 1;
+    case OP_JAL:  op->kind = BOP_JAL;  return 1;
+    case OP_RETI: op->kind = BOP_RETI; return 1;
+    case OP_HALT: op->kind = BOP_HALT; return 1;
+    default:
+        op->kind = (uint8_t)((d->opcode >= OP_BEQ && d->opcode <= OP_BGE) ? BOP_BEQ + d->opcode - OP_BEQ : BOP_INVALID);
+        return 1;
+    }
+}
+
+// Outcome of a branch that doesn't depend on the registers: 1 / 0, or -1 if it does
+static int knownCondition(const SimInst* d) {
+    uint32_t a = constantOf(d->rs, d->imm);
+    uint32_t b = constantOf(d->rt, d->imm);
+    if (d->rs == d->rt) {
+        a = b = 0;                                                      // same register - same value
+    }
+    else if (!isConstant(d->rs) || !isConstant(d->rt)) {
+        return -1;
+    }
+    switch (d->opcode) {
+    case OP_BEQ: return a == b;
+    case OP_BNE: return a != b;
+    case OP_BLT: return (int32_t)a <  (int32_t)b;
+    case OP_BGT: return (int32_t)a >  (int32_t)b;
+    case OP_BLE: return (int32_t)a <= (int32_t)b;
+    default:     return (int32_t)a >= (int32_t)b;                      // OP_BGE
+    }
+}
+
+// Translate the block starting at start - return its index.
+// Translation follows branches whose target is a constant: one that is
+// always taken just moves on to the target, one that is never taken
+// disappears, and the rest become side exits that assume a backward
+// branch is taken and a forward one isn't - so a short loop is unrolled,
+// as many whole times round as fit in SIM_BLOCK_MAX instructions. jal to
+// a constant is a load of the return address followed by the callee.
+static uint32_t translateBlock(SimState* sim, uint32_t start) {
+    BlockCache* bc = &sim->blocks;
+    if (bc->op_count + SIM_BLOCK_MAX + 1 > SIM_BLOCK_OPS) {
+        flushBlocks(bc);                                                // full - start over
+    }
+    uint32_t index = bc->block_count++;
+    Block* block = &bc->blocks[index];
+    block->first = bc->op_count;
+
+    uint32_t pc = start;
+    unsigned count = 0;
+    unsigned cycles = 0;
+    uint32_t last_pc = start;
+    int32_t last_imm = 0;
+    unsigned loop_length = 0;                                           // instructions once round, if it came back to start
+    int ended = 0;
+    while (!ended && count < SIM_BLOCK_MAX) {
+        if (pc == start && count > 0) {
+            if (!loop_length) {
+                loop_length = count;
+            }
+            if (count + loop_length > SIM_BLOCK_MAX) {
+                break;                                                  // end where it began - idle loops are seen
+            }
+        }
+        const SimInst* d = &sim->code[pc];
+        block->last_fetch = (uint8_t)cycles;
+        count++;
+        cycles += d->words;
+        bc->covered[pc] = 1;
+        bc->covered[(pc + d->words - 1) & SIM_ADDR_MASK] = 1;           // and the big_imm word
+
+        BlockOp* op = &bc->ops[bc->op_count];
+        op->rd = d->rd;
+        op->rs = d->rs;
+        op->rt = d->rt;
+        op->wd = d->wd;
+        op->imm = d->imm;
+        op->executed = (uint8_t)count;
+        op->cycles = (uint8_t)cycles;
+        op->pc = (uint16_t)pc;
+        op->next_pc = d->next_pc;
+        uint32_t next = d->next_pc;
+
+        int is_branch = (d->opcode >= OP_BEQ && d->opcode <= OP_BGE);
+        if ((is_branch || d->opcode == OP_JAL) && isConstant(d->opcode == OP_JAL ? d->rs : d->rd)) {
+            uint32_t target = constantOf(d->opcode == OP_JAL ? d->rs : d->rd, d->imm) & SIM_ADDR_MASK;
+            int known = is_branch ? knownCondition(d) : 1;
+            if (d->opcode == OP_JAL && d->wd != SIM_REG_SINK) {
+                op->kind = BOP_LI;                                      // the return address
+                op->imm = (int32_t)d->next_pc;
+                bc->op_count++;
+            }
+            if (known >= 0) {
+                next = known ? target : d->next_pc;
+            }
+            else {
+                int backward = (target <= pc);                          // predicted taken
+                op->kind = (uint8_t)((backward ? BOP_BEQ_F : BOP_BEQ_T) + d->opcode - OP_BEQ);
+                op->next_pc = (uint16_t)(backward ? d->next_pc : target);   // where the side exit goes
+                bc->op_count++;
+                next = backward ? target : d->next_pc;
+            }
+        }
+        else if (specialise(d, op)) {
+            bc->op_count++;
+            ended = (op->kind >= BOP_BEQ);
+        }
+        last_pc = pc;
+        last_imm = d->imm;
+        pc = next;
+    }
+    if (!ended) {
+        BlockOp* op = &bc->ops[bc->op_count++];
+        memset(op, 0, sizeof(*op));
+        op->kind = BOP_EXIT;
+        op->imm = last_imm;                                             // what the last instruction left in $imm
+        op->executed = (uint8_t)count;
+        op->cycles = (uint8_t)cycles;
+        op->pc = (uint16_t)last_pc;
+        op->next_pc = (uint16_t)pc;
+    }
+    block->count = (uint8_t)count;
+    block->cycles = (uint8_t)cycles;
+    bc->block_at[start] = index + 1;
+    bc->translated++;
+    return index;
+}
+
+// -----------------------------------------------------------------------
+//    --- Run loop ---
+// -----------------------------------------------------------------------
+
+// Same idle-loop fast-forward as the interpreter, at block granularity
+typedef struct {
+    uint32_t pc;                                                        // target of the last backward branch, UINT32_MAX = none
+    uint64_t instructions;
+    uint64_t cycles;
+    uint32_t regs[NUM_REGS];
+} IdleLoop;
+
+static void checkIdleLoop(SimState* sim, IdleLoop* idle, uint32_t pc, uint64_t limit) {
+    if (sim->next_event == SIM_NO_EVENT) {
+        return;
+    }
+    if (pc == idle->pc && memcmp(idle->regs, sim->regs, sizeof(idle->regs)) == 0) {
+        uint64_t per_instructions = sim->instructions - idle->instructions;
+        uint64_t per_cycles = sim->cycles - idle->cycles;
+        uint64_t n = (sim->next_event > sim->cycles) ? (sim->next_event - sim->cycles) / per_cycles : 0;
+        if (n > (limit - sim->instructions) / per_instructions) {
+            n = (limit - sim->instructions) / per_instructions;
+        }
+        sim->instructions += n * per_instructions;
+        sim->cycles += n * per_cycles;
+        sim->skipped_cycles += n * per_cycles;
+    }
+    else {
+        idle->pc = pc;
+        memcpy(idle->regs, sim->regs, sizeof(idle->regs));
+    }
+    idle->instructions = sim->instructions;
+    idle->cycles = sim->cycles;
+}
+
+SimStatus runBlocks(SimState* sim, uint64_t max_instructions) {
+    BlockCache* bc = &sim->blocks;
+    uint32_t* R = sim->regs;
+    uint32_t* mem = sim->mem;
+    uint64_t limit = (max_instructions && max_instructions <= UINT64_MAX - sim->instructions) ?
+                     sim->instructions + max_instructions : UINT64_MAX;
+    uint32_t pc = sim->pc;
+    SimStatus status = SIM_LIMIT;
+    IdleLoop idle;
+    idle.pc = UINT32_MAX;
+
+#if BLOCK_COMPUTED_GOTO
+    static void* const handlers[NUM_BLOCK_OPS] = {
+        [BOP_ADD_RR] = &&bop_ADD_RR, [BOP_SUB_RR] = &&bop_SUB_RR, [BOP_MUL_RR] = &&bop_MUL_RR,
+        [BOP_AND_RR] = &&bop_AND_RR, [BOP_OR_RR] = &&bop_OR_RR, [BOP_XOR_RR] = &&bop_XOR_RR,
+        [BOP_SLL_RR] = &&bop_SLL_RR, [BOP_SRA_RR] = &&bop_SRA_RR, [BOP_SRL_RR] = &&bop_SRL_RR,
+        [BOP_ADD_RC] = &&bop_ADD_RC, [BOP_SUB_RC] = &&bop_SUB_RC, [BOP_MUL_RC] = &&bop_MUL_RC,
+        [BOP_AND_RC] = &&bop_AND_RC, [BOP_OR_RC] = &&bop_OR_RC, [BOP_XOR_RC] = &&bop_XOR_RC,
+        [BOP_SLL_RC] = &&bop_SLL_RC, [BOP_SRA_RC] = &&bop_SRA_RC, [BOP_SRL_RC] = &&bop_SRL_RC,
+        [BOP_SUB_CR] = &&bop_SUB_CR, [BOP_SLL_CR] = &&bop_SLL_CR, [BOP_SRA_CR] = &&bop_SRA_CR,
+        [BOP_SRL_CR] = &&bop_SRL_CR, [BOP_LI] = &&bop_LI,
+        [BOP_LW_RR] = &&bop_LW_RR, [BOP_LW_RC] = &&bop_LW_RC, [BOP_LW_C] = &&bop_LW_C,
+        [BOP_SW] = &&bop_SW, [BOP_IN] = &&bop_IN, [BOP_OUT] = &&bop_OUT,
+        [BOP_OUT_STORE] = &&bop_OUT_STORE, [BOP_OUT_MONITOR] = &&bop_OUT_MONITOR,
+        [BOP_BEQ_T] = &&bop_BEQ_T, [BOP_BNE_T] = &&bop_BNE_T, [BOP_BLT_T] = &&bop_BLT_T,
+        [BOP_BGT_T] = &&bop_BGT_T, [BOP_BLE_T] = &&bop_BLE_T, [BOP_BGE_T] = &&bop_BGE_T,
+        [BOP_BEQ_F] = &&bop_BEQ_F, [BOP_BNE_F] = &&bop_BNE_F, [BOP_BLT_F] = &&bop_BLT_F,
+        [BOP_BGT_F] = &&bop_BGT_F, [BOP_BLE_F] = &&bop_BLE_F, [BOP_BGE_F] = &&bop_BGE_F,
+        [BOP_BEQ] = &&bop_BEQ, [BOP_BNE] = &&bop_BNE, [BOP_BLT] = &&bop_BLT,
+        [BOP_BGT] = &&bop_BGT, [BOP_BLE] = &&bop_BLE, [BOP_BGE] = &&bop_BGE,
+        [BOP_JAL] = &&bop_JAL, [BOP_RETI] = &&bop_RETI,
+        [BOP_HALT] = &&bop_HALT, [BOP_INVALID] = &&bop_INVALID, [BOP_EXIT] = &&bop_EXIT
+    };
+#define BOP(name) bop_##name:
+#define NEXT_OP()                                                       \
+    do {                                                                \
+        op++;                                                           \
+        goto *handlers[op->kind];                                       \
+    } while (0)
+#define DISPATCH() goto *handlers[op->kind]
+#else
+#define BOP(name) case BOP_##name:
+#define NEXT_OP()                                                       \
+    do {                                                                \
+        op++;                                                           \
+        goto dispatch;                                                  \
+    } while (0)
+#define DISPATCH() goto dispatch
+#endif
+
+// Leave the block early for next_pc, with the counts up to op
+#define LEAVE_BLOCK()                                                   \
+    do {                                                                \
+        sim->cycles = cycles0 + op->cycles;                             \
+        sim->instructions = instructions0 + op->executed;               \
+        pc = op->next_pc;                                               \
+        goto block_done;                                                \
+    } while (0)
+
+// Side exit: leave for next_pc when cond comes out as `leave`
+#define SIDE_EXIT(cond, leave)                                          \
+    do {                                                                \
+        R[REG_IMM] = (uint32_t)op->imm;                                 \
+        if ((cond) == (leave)) {                                        \
+            backward = (op->next_pc <= op->pc);                         \
+            LEAVE_BLOCK();                                              \
+        }                                                               \
+        NEXT_OP();                                                      \
+    } while (0)
+
+// Conditional branch at the end of a block: pc = R[rd] when cond holds
+#define BLOCK_BRANCH(cond)                                              \
+    do {                                                                \
+        R[REG_IMM] = (uint32_t)op->imm;                                 \
+        if (cond) {                                                     \
+            pc = R[op->rd] & SIM_ADDR_MASK;                             \
+            backward = (pc <= op->pc);                                  \
+        }                                                               \
+        else {                                                          \
+            pc = op->next_pc;                                           \
+        }                                                               \
+        goto block_done;                                                \
+    } while (0)
+
+    while (sim->instructions < limit) {
+        if (sim->cycles >= sim->next_event) {
+            pc = serviceEvents(sim, pc, sim->cycles);
+            idle.pc = UINT32_MAX;
+        }
+        uint32_t index = bc->block_at[pc];
+        const Block* block = &bc->blocks[index ? index - 1 : translateBlock(sim, pc)];
+        if (block->count > limit - sim->instructions || sim->cycles + block->last_fetch >= sim->next_event) {
+            sim->pc = pc;                                               // an event or the limit falls inside
+            status = runInterpreter(sim, 1);
+            pc = sim->pc;
+            idle.pc = UINT32_MAX;
+            if (status != SIM_LIMIT) {
+                break;
+            }
+            continue;
+        }
+
+        // The counts for the whole block go on up front; the ops that
+        // need the time within it (or leave early) use their own offsets.
+        const BlockOp* op = &bc->ops[block->first];
+        uint64_t cycles0 = sim->cycles;
+        uint64_t instructions0 = sim->instructions;
+        uint64_t last_fetch = cycles0 + block->last_fetch;
+        sim->cycles += block->cycles;
+        sim->instructions += block->count;
+        uint32_t block_pc = pc;
+        int backward = 0;
+        DISPATCH();
+
+#if !BLOCK_COMPUTED_GOTO
+    dispatch:
+        switch (op->kind) {
+#endif
+
+        BOP(ADD_RR) R[op->wd] = R[op->rs] + R[op->rt];                  NEXT_OP();
+        BOP(SUB_RR) R[op->wd] = R[op->rs] - R[op->rt];                  NEXT_OP();
+        BOP(MUL_RR) R[op->wd] = R[op->rs] * R[op->rt];                  NEXT_OP();
+        BOP(AND_RR) R[op->wd] = R[op->rs] & R[op->rt];                  NEXT_OP();
+        BOP(OR_RR)  R[op->wd] = R[op->rs] | R[op->rt];                  NEXT_OP();
+        BOP(XOR_RR) R[op->wd] = R[op->rs] ^ R[op->rt];                  NEXT_OP();
+        BOP(SLL_RR) R[op->wd] = R[op->rs] << (R[op->rt] & 31);          NEXT_OP();
+        BOP(SRA_RR) R[op->wd] = (uint32_t)((int32_t)R[op->rs] >> (R[op->rt] & 31)); NEXT_OP();
+        BOP(SRL_RR) R[op->wd] = R[op->rs] >> (R[op->rt] & 31);          NEXT_OP();
+
+        BOP(ADD_RC) R[op->wd] = R[op->rs] + (uint32_t)op->imm;          NEXT_OP();
+        BOP(SUB_RC) R[op->wd] = R[op->rs] - (uint32_t)op->imm;          NEXT_OP();
+        BOP(MUL_RC) R[op->wd] = R[op->rs] * (uint32_t)op->imm;          NEXT_OP();
+        BOP(AND_RC) R[op->wd] = R[op->rs] & (uint32_t)op->imm;          NEXT_OP();
+        BOP(OR_RC)  R[op->wd] = R[op->rs] | (uint32_t)op->imm;          NEXT_OP();
+        BOP(XOR_RC) R[op->wd] = R[op->rs] ^ (uint32_t)op->imm;          NEXT_OP();
+        BOP(SLL_RC) R[op->wd] = R[op->rs] << (op->imm & 31);            NEXT_OP();
+        BOP(SRA_RC) R[op->wd] = (uint32_t)((int32_t)R[op->rs] >> (op->imm & 31)); NEXT_OP();
+        BOP(SRL_RC) R[op->wd] = R[op->rs] >> (op->imm & 31);            NEXT_OP();
+
+        BOP(SUB_CR) R[op->wd] = (uint32_t)op->imm - R[op->rt];          NEXT_OP();
+        BOP(SLL_CR) R[op->wd] = (uint32_t)op->imm << (R[op->rt] & 31);  NEXT_OP();
+        BOP(SRA_CR) R[op->wd] = (uint32_t)(op->imm >> (R[op->rt] & 31)); NEXT_OP();
+        BOP(SRL_CR) R[op->wd] = (uint32_t)op->imm >> (R[op->rt] & 31);  NEXT_OP();
+        BOP(LI)     R[op->wd] = (uint32_t)op->imm;                      NEXT_OP();
+
+        BOP(LW_RR) R[op->wd] = mem[(R[op->rs] + R[op->rt]) & SIM_ADDR_MASK];          NEXT_OP();
+        BOP(LW_RC) R[op->wd] = mem[(R[op->rs] + (uint32_t)op->imm) & SIM_ADDR_MASK];  NEXT_OP();
+        BOP(LW_C)  R[op->wd] = mem[op->imm];                                          NEXT_OP();
+
+        BOP(SW) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            uint32_t addr = (R[op->rs] + R[op->rt]) & SIM_ADDR_MASK;
+            uint64_t flushes = bc->flushes;
+            storeWord(sim, addr, R[op->rd]);
+            idle.pc = UINT32_MAX;
+            if (bc->flushes != flushes) {                               // wrote translated code - maybe this block
+                LEAVE_BLOCK();
+            }
+            NEXT_OP();
+        }
+        BOP(IN) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            uint32_t reg = R[op->rs] + R[op->rt];
+            if (reg == IO_CLKS || reg == IO_TIMERCURRENT) {
+                idle.pc = UINT32_MAX;                                   // changes without an event
+            }
+            R[op->wd] = (reg < SIM_NUM_IO_REGS) ? readIo(sim, reg, cycles0 + op->cycles) : 0;
+            NEXT_OP();
+        }
+        BOP(OUT) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            uint32_t reg = R[op->rs] + R[op->rt];
+            if (reg < SIM_NUM_IO_REGS) {
+                writeIo(sim, reg, R[op->rd], cycles0 + op->cycles);
+            }
+            idle.pc = UINT32_MAX;
+            if (sim->next_event <= last_fetch) {                        // it started something due within the block
+                LEAVE_BLOCK();
+            }
+            NEXT_OP();
+        }
+
+        BOP(OUT_STORE) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            sim->io[op->rs] = R[op->rd];
+            idle.pc = UINT32_MAX;
+            NEXT_OP();
+        }
+        BOP(OUT_MONITOR) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            monitorCommand(sim, R[op->rd]);
+            idle.pc = UINT32_MAX;
+            NEXT_OP();
+        }
+
+        BOP(BEQ_T) SIDE_EXIT(R[op->rs] == R[op->rt], 1);
+        BOP(BNE_T) SIDE_EXIT(R[op->rs] != R[op->rt], 1);
+        BOP(BLT_T) SIDE_EXIT((int32_t)R[op->rs] <  (int32_t)R[op->rt], 1);
+        BOP(BGT_T) SIDE_EXIT((int32_t)R[op->rs] >  (int32_t)R[op->rt], 1);
+        BOP(BLE_T) SIDE_EXIT((int32_t)R[op->rs] <= (int32_t)R[op->rt], 1);
+        BOP(BGE_T) SIDE_EXIT((int32_t)R[op->rs] >= (int32_t)R[op->rt], 1);
+        BOP(BEQ_F) SIDE_EXIT(R[op->rs] == R[op->rt], 0);
+        BOP(BNE_F) SIDE_EXIT(R[op->rs] != R[op->rt], 0);
+        BOP(BLT_F) SIDE_EXIT((int32_t)R[op->rs] <  (int32_t)R[op->rt], 0);
+        BOP(BGT_F) SIDE_EXIT((int32_t)R[op->rs] >  (int32_t)R[op->rt], 0);
+        BOP(BLE_F) SIDE_EXIT((int32_t)R[op->rs] <= (int32_t)R[op->rt], 0);
+        BOP(BGE_F) SIDE_EXIT((int32_t)R[op->rs] >= (int32_t)R[op->rt], 0);
+
+        BOP(BEQ) BLOCK_BRANCH(R[op->rs] == R[op->rt]);
+        BOP(BNE) BLOCK_BRANCH(R[op->rs] != R[op->rt]);
+        BOP(BLT) BLOCK_BRANCH((int32_t)R[op->rs] <  (int32_t)R[op->rt]);
+        BOP(BGT) BLOCK_BRANCH((int32_t)R[op->rs] >  (int32_t)R[op->rt]);
+        BOP(BLE) BLOCK_BRANCH((int32_t)R[op->rs] <= (int32_t)R[op->rt]);
+        BOP(BGE) BLOCK_BRANCH((int32_t)R[op->rs] >= (int32_t)R[op->rt]);
+        BOP(JAL) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            pc = R[op->rs] & SIM_ADDR_MASK;                             // read before rd is written (rd may be rs)
+            R[op->wd] = op->next_pc;
+            goto block_done;
+        }
+        BOP(RETI) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            pc = returnFromInterrupt(sim, cycles0 + op->cycles);
+            idle.pc = UINT32_MAX;
+            goto block_done;
+        }
+        BOP(HALT) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            pc = op->pc;
+            status = SIM_HALTED;
+            break;
+        }
+        BOP(INVALID) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            pc = op->pc;
+            status = SIM_BAD_OPCODE;
+            break;
+        }
+        BOP(EXIT) {
+            R[REG_IMM] = (uint32_t)op->imm;
+            pc = op->next_pc;
+            backward = (pc <= op->pc);
+            goto block_done;
+        }
+
+#if !BLOCK_COMPUTED_GOTO
+        }
+        break;                                                          // halt / invalid left the switch
+#endif
+
+    block_done:
+        if (backward || pc == block_pc) {
+            checkIdleLoop(sim, &idle, pc, limit);
+        }
+    }
+
+#undef BOP
+#undef NEXT_OP
+#undef DISPATCH
+#undef BLOCK_BRANCH
+#undef SIDE_EXIT
+#undef LEAVE_BLOCK
+
+    sim->pc = pc;
+    sim->status = status;
+    return status;
+}
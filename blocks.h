@@ -0,0 +1,20 @@
+﻿#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include <stdint.h>
+#include "simulator.h"
+
+// -----------------------------------------------------------------------
+//  Basic-block translation cache for the simulator. runBlocks looks up
+//  (or translates) the block at pc and runs it as a whole when neither
+//  an event nor the instruction limit falls inside it; otherwise the
+//  interpreter takes single steps until the next block boundary, so
+//  events and limits land on the same instruction either way.
+// -----------------------------------------------------------------------
+
+SimStatus runBlocks(SimState* sim, uint64_t max_instructions);
+
+// Forget every translated block - called when a word they cover changes
+void flushBlocks(BlockCache* cache);
+
+#endif // BLOCKS_H
@@ -0,0 +1,317 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "simulator.h"
+#include "devices.h"
+
+// -----------------------------------------------------------------------
+//    --- Event heap ---
+// -----------------------------------------------------------------------
+
+static void swapEvents(SimEvent* a, SimEvent* b) {
+    SimEvent t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void siftDown(SimDevices* dev, int i) {
+    for (;;) {
+        int least = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < dev->event_count && dev->heap[l].cycle < dev->heap[least].cycle) {
+            least = l;
+        }
+        if (r < dev->event_count && dev->heap[r].cycle < dev->heap[least].cycle) {
+            least = r;
+        }
+        if (least == i) {
+            return;
+        }
+        swapEvents(&dev->heap[i], &dev->heap[least]);
+        i = least;
+    }
+}
+
+static void siftUp(SimDevices* dev, int i) {
+    while (i > 0 && dev->heap[i].cycle < dev->heap[(i - 1) / 2].cycle) {
+        swapEvents(&dev->heap[i], &dev->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
+
+static void cancelEvent(SimDevices* dev, SimEventKind kind) {
+    for (int i = 0; i < dev->event_count; i++) {
+        if (dev->heap[i].kind == kind) {
+            dev->heap[i] = dev->heap[--dev->event_count];
+            if (i < dev->event_count) {
+                siftDown(dev, i);
+                siftUp(dev, i);
+            }
+            return;
+        }
+    }
+}
+
+static void scheduleEvent(SimDevices* dev, SimEventKind kind, uint64_t cycle) {
+    cancelEvent(dev, kind);                                             // one per kind
+    dev->heap[dev->event_count].kind = kind;
+    dev->heap[dev->event_count].cycle = cycle;
+    siftUp(dev, dev->event_count++);
+}
+
+static SimEvent popEvent(SimDevices* dev) {
+    SimEvent e = dev->heap[0];
+    dev->heap[0] = dev->heap[--dev->event_count];
+    siftDown(dev, 0);
+    return e;
+}
+
+static int interruptPending(const SimState* sim) {
+    const uint32_t* io = sim->io;
+    return (io[IO_IRQ0ENABLE] && io[IO_IRQ0STATUS]) ||
+           (io[IO_IRQ1ENABLE] && io[IO_IRQ1STATUS]) ||
+           (io[IO_IRQ2ENABLE] && io[IO_IRQ2STATUS]);
+}
+
+// What the run loop waits for: the earliest event, or now when an interrupt can be taken
+static void updateNextEvent(SimState* sim, uint64_t now) {
+    sim->next_event = sim->dev.event_count ? sim->dev.heap[0].cycle : SIM_NO_EVENT;
+    if (!sim->dev.in_handler && interruptPending(sim)) {
+        sim->next_event = now;
+    }
+}
+
+// -----------------------------------------------------------------------
+//    --- Devices ---
+// -----------------------------------------------------------------------
+
+// The timer is not stepped: while enabled, timercurrent at cycle c is
+// (timer_value + c - timer_base) mod (timermax + 1), and only the cycle
+// it next reaches timermax is on the heap.
+static uint32_t timerValue(const SimState* sim, uint64_t now) {
+    if (!sim->io[IO_TIMERENABLE]) {
+        return sim->io[IO_TIMERCURRENT];
+    }
+    uint64_t period = (uint64_t)sim->io[IO_TIMERMAX] + 1;
+    return (uint32_t)((sim->dev.timer_value + (now - sim->dev.timer_base)) % period);
+}
+
+static void restartTimer(SimState* sim, uint64_t now) {
+    cancelEvent(&sim->dev, EVENT_TIMER);
+    if (!sim->io[IO_TIMERENABLE]) {
+        return;
+    }
+    uint32_t max = sim->io[IO_TIMERMAX];
+    uint64_t period = (uint64_t)max + 1;
+    sim->dev.timer_base = now;
+    sim->dev.timer_value = (uint32_t)(sim->io[IO_TIMERCURRENT] % period);   // larger values wrap
+    scheduleEvent(&sim->dev, EVENT_TIMER, now + (max - sim->dev.timer_value));
+}
+
+static void finishDiskCommand(SimState* sim) {
+    uint32_t sector = sim->io[IO_DISKSECTOR] % SIM_DISK_SECTORS;
+    uint32_t* disk = sim->dev.disk + sector * SIM_SECTOR_WORDS;
+    uint32_t buffer = sim->io[IO_DISKBUFFER];
+    for (uint32_t i = 0; i < SIM_SECTOR_WORDS; i++) {
+        uint32_t addr = (buffer + i) & SIM_ADDR_MASK;
+        if (sim->io[IO_DISKCMD] == 1) {
+            storeWord(sim, addr, disk[i]);                              // the sector may hold code
+        }
+        else {
+            disk[i] = sim->mem[addr];
+        }
+    }
+    if (sim->io[IO_DISKCMD] == 2) {
+        sim->dirty[SIM_DISK_PAGE(sector * SIM_SECTOR_WORDS)] = 1;       // a sector never straddles pages
+    }
+    sim->io[IO_DISKCMD] = 0;
+    sim->io[IO_DISKSTATUS] = 0;
+    sim->io[IO_IRQ1STATUS] = 1;
+}
+
+static void fireEvent(SimState* sim, SimEvent e) {
+    SimDevices* dev = &sim->dev;
+    switch (e.kind) {
+    case EVENT_TIMER:
+        sim->io[IO_IRQ0STATUS] = 1;
+        scheduleEvent(dev, EVENT_TIMER, e.cycle + (uint64_t)sim->io[IO_TIMERMAX] + 1);
+        break;
+    case EVENT_DISK:
+        finishDiskCommand(sim);
+        break;
+    case EVENT_IRQ2:
+        sim->io[IO_IRQ2STATUS] = 1;
+        while (dev->irq2_next < dev->irq2_count && dev->irq2_cycles[dev->irq2_next] <= e.cycle) {
+            dev->irq2_next++;                                           // duplicates and stragglers
+        }
+        if (dev->irq2_next < dev->irq2_count) {
+            scheduleEvent(dev, EVENT_IRQ2, dev->irq2_cycles[dev->irq2_next]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void logChange(FILE* log, uint32_t old_value, uint32_t value, uint64_t now) {
+    if (log && value != old_value) {
+        fprintf(log, "%llu %08X\n", (unsigned long long)now, (unsigned)value);
+    }
+}
+
+uint32_t readIo(SimState* sim, uint32_t reg, uint64_t now) {
+    switch (reg) {
+    case IO_CLKS:
+        return (uint32_t)now;                                           // the running cycle count
+    case IO_TIMERCURRENT:
+        return timerValue(sim, now);
+    default:
+        return sim->io[reg];
+    }
+}
+
+void writeIo(SimState* sim, uint32_t reg, uint32_t value, uint64_t now) {
+    uint32_t* io = sim->io;
+    switch (reg) {
+    case IO_CLKS:
+        break;                                                          // read-only
+    case IO_TIMERENABLE:
+    case IO_TIMERCURRENT:
+    case IO_TIMERMAX:
+        io[IO_TIMERCURRENT] = timerValue(sim, now);                     // freeze the count before changing it
+        io[reg] = value;
+        restartTimer(sim, now);
+        break;
+    case IO_DISKCMD:
+        if (io[IO_DISKSTATUS] == 0 && (value == 1 || value == 2)) {     // ignored while busy
+            io[IO_DISKCMD] = value;
+            io[IO_DISKSTATUS] = 1;
+            scheduleEvent(&sim->dev, EVENT_DISK, now + SIM_DISK_CYCLES);
+        }
+        break;
+    case IO_MONITORCMD:
+        monitorCommand(sim, value);
+        break;                                                          // reads back as 0
+    case IO_LEDS:
+        logChange(sim->dev.leds_log, io[reg], value, now);
+        io[reg] = value;
+        break;
+    case IO_DISPLAY7SEG:
+        logChange(sim->dev.display_log, io[reg], value, now);
+        io[reg] = value;
+        break;
+    default:
+        io[reg] = value;
+        break;
+    }
+    updateNextEvent(sim, now);                                          // enables, statuses and timers all move it
+}
+
+int isPlainIoRegister(uint32_t reg) {
+    switch (reg) {
+    case IO_IRQHANDLER: case IO_IRQRETURN:
+    case IO_DISKSECTOR: case IO_DISKBUFFER:
+    case IO_RESERVED18: case IO_RESERVED19:
+    case IO_MONITORADDR: case IO_MONITORDATA:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+uint32_t serviceEvents(SimState* sim, uint32_t pc, uint64_t now) {
+    SimDevices* dev = &sim->dev;
+    while (dev->event_count && dev->heap[0].cycle <= now) {
+        fireEvent(sim, popEvent(dev));
+    }
+    if (!dev->in_handler && interruptPending(sim)) {
+        sim->io[IO_IRQRETURN] = pc;
+        pc = sim->io[IO_IRQHANDLER] & SIM_ADDR_MASK;
+        dev->in_handler = 1;
+    }
+    updateNextEvent(sim, now);
+    return pc;
+}
+
+uint32_t returnFromInterrupt(SimState* sim, uint64_t now) {
+    sim->dev.in_handler = 0;
+    updateNextEvent(sim, now);                                          // a status left set interrupts again
+    return sim->io[IO_IRQRETURN] & SIM_ADDR_MASK;
+}
+
+void setIrq2Cycles(SimState* sim, const uint64_t* cycles, int count) {
+    sim->dev.irq2_cycles = cycles;
+    sim->dev.irq2_count = count;
+    sim->dev.irq2_next = 0;
+    cancelEvent(&sim->dev, EVENT_IRQ2);
+    if (count > 0) {
+        scheduleEvent(&sim->dev, EVENT_IRQ2, cycles[0]);
+    }
+    updateNextEvent(sim, sim->cycles);
+}
+
+// -----------------------------------------------------------------------
+//    --- Files ---
+// -----------------------------------------------------------------------
+
+uint64_t* readIrq2File(const char* filename, int* count) {
+    size_t len = 0;
+    char* text = readFileBytes(filename, &len);
+    if (!text) {
+        return NULL;
+    }
+    int cap = 16;
+    int n = 0;
+    uint64_t* cycles = malloc((size_t)cap * sizeof(uint64_t));
+    for (size_t pos = 0; cycles && pos < len; ) {
+        if (text[pos] < '0' || text[pos] > '9') {
+            pos++;                                                      // line breaks, blanks, stray characters
+            continue;
+        }
+        uint64_t v = 0;                                                 // not strtoull: text isn't terminated
+        while (pos < len && text[pos] >= '0' && text[pos] <= '9') {
+            v = v * 10 + (uint64_t)(text[pos++] - '0');
+        }
+        if (n == cap) {
+            cap *= 2;
+            uint64_t* grown = realloc(cycles, (size_t)cap * sizeof(uint64_t));
+            if (!grown) {
+                free(cycles);
+                cycles = NULL;
+                break;
+            }
+            cycles = grown;
+        }
+        if (n > 0 && v < cycles[n - 1]) {
+            free(cycles);                                               // must be ascending
+            cycles = NULL;
+            break;
+        }
+        cycles[n++] = v;
+    }
+    free(text);
+    *count = n;
+    return cycles;
+}
+
+int writeMonitor(const char* filename, const SimState* sim) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        return 1;
+    }
+    int used = SIM_MONITOR_PIXELS;
+    while (used > 0 && sim->dev.monitor[used - 1] == 0) {
+        used--;
+    }
+    for (int i = 0; i < used; i++) {
+        fprintf(out, "%02X\n", (unsigned)sim->dev.monitor[i]);
+    }
+    int failed = ferror(out);
+    failed |= (fclose(out) != 0);
+    return failed;
+}
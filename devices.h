@@ -0,0 +1,60 @@
+﻿#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <stdint.h>
+#include "simulator.h"
+
+// -----------------------------------------------------------------------
+//  SIMP devices behind `in` / `out`, driven by the event heap in
+//  SimDevices:
+//
+//      timer       counts 0..timermax while timerenable, one step per
+//                  cycle; reaching timermax raises irq0
+//      disk        diskcmd 1 = read sector disksector into memory at
+//                  diskbuffer, 2 = write it; busy (diskstatus = 1) for
+//                  SIM_DISK_CYCLES, then raises irq1
+//      irq2        raised at each cycle listed in the irq2 input
+//      monitor     a non-zero write to monitorcmd stores monitordata at
+//                  monitoraddr
+//      leds, 7seg  every change is logged with its cycle
+//
+//  An interrupt is taken at the next instruction fetch once any
+//  irqNenable & irqNstatus is set, unless the handler is still running:
+//  irqreturn = pc, pc = irqhandler, until `reti`.
+//  `now` is always the cycle count after the current instruction.
+// -----------------------------------------------------------------------
+
+// `in`: value of IO register reg (< SIM_NUM_IO_REGS)
+uint32_t readIo(SimState* sim, uint32_t reg, uint64_t now);
+
+// `out`: write IO register reg (< SIM_NUM_IO_REGS) and start whatever the write starts
+void writeIo(SimState* sim, uint32_t reg, uint32_t value, uint64_t now);
+
+// 1 if writeIo to reg is just a store - nothing starts, nothing is logged
+int isPlainIoRegister(uint32_t reg);
+
+// The part of writeIo for monitorcmd
+static inline void monitorCommand(SimState* sim, uint32_t value) {
+    if (value) {
+        uint32_t pixel = sim->io[IO_MONITORADDR] % SIM_MONITOR_PIXELS;
+        sim->dev.monitor[pixel] = (uint8_t)sim->io[IO_MONITORDATA];
+        sim->dirty[SIM_MONITOR_PAGE(pixel)] = 1;
+    }
+}
+
+// Fire the events due by cycle now and take a pending interrupt - return the pc to fetch
+uint32_t serviceEvents(SimState* sim, uint32_t pc, uint64_t now);
+
+// `reti` - return the pc to fetch
+uint32_t returnFromInterrupt(SimState* sim, uint64_t now);
+
+// Raise irq2 at cycles[0..count) (ascending, kept by the caller) - call before running
+void setIrq2Cycles(SimState* sim, const uint64_t* cycles, int count);
+
+// Read an irq2 input file, one decimal cycle per line - NULL on failure
+uint64_t* readIrq2File(const char* filename, int* count);
+
+// Write the monitor as text, one pixel per line in 2 hex digits, up to the last non-zero one - return 0 on success
+int writeMonitor(const char* filename, const SimState* sim);
+
+#endif // DEVICES_H
@@ -0,0 +1,235 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "disassembler.h"
+#include "platform.h"
+
+// -----------------------------------------------------------------------
+//    --- Command-line front end for the SIMP disassembler ---
+// -----------------------------------------------------------------------
+
+static void printUsage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options] <image>...\n", prog);
+    fprintf(stderr, "       %s --verify <program.asm> <image>\n", prog);
+    fprintf(stderr, "  -o FILE          write the listing to FILE instead of stdout (one image only)\n");
+    fprintf(stderr, "  --trim           stop each listing after the last non-zero word\n");
+    fprintf(stderr, "  --quiet          decode without printing (throughput only)\n");
+    fprintf(stderr, "  --verify         assemble program.asm and compare it with image field by field\n");
+}
+
+// Name every field that differs between two decoded instructions into out
+static void listFieldDiffs(const DecodedWord* a, const DecodedWord* b, char* out, size_t out_len) {
+    static const char* const names[] = { "opcode", "rd", "rs", "rt", "big_imm", "imm" };
+    int diff[6] = { a->opcode != b->opcode, a->rd != b->rd, a->rs != b->rs, a->rt != b->rt,
+                    a->bigimm != b->bigimm, a->imm != b->imm };
+    size_t len = 0;
+    out[0] = '\0';
+    for (int f = 0; f < 6; f++) {
+        if (diff[f] && len + 12 < out_len) {
+            len += (size_t)sprintf(out + len, "%s%s", len ? ", " : "", names[f]);
+        }
+    }
+}
+
+// Strip the '\n' formatInstruction ends a line with
+static void formatInline(const DecodedWord* inst, char* out) {
+    size_t len = formatInstruction(inst, out);
+    out[len - 1] = '\0';
+}
+
+// Assemble source and diff it against image_file - return 0 if they match
+static int verifyImage(const char* source, const char* image_file) {
+    size_t src_len = 0;
+    char* src = readSourceFile(source, &src_len);
+    if (!src) {
+        fprintf(stderr, "Couldn't open the assembly file %s\n", source);
+        return 2;
+    }
+    AsmResult result;
+    int status = assembleProgram(src, src_len, NULL, &result);
+    printDiagnostics(stderr, source, &result);
+    free(src);
+    if (status) {
+        freeAsmResult(&result);
+        return 2;
+    }
+
+    uint32_t* image = malloc(MEM_SIZE * sizeof(uint32_t));
+    if (!image || readMemoryImage(image_file, image, MEM_SIZE, NULL)) {
+        fprintf(stderr, "Couldn't read memory image %s\n", image_file);
+        free(image);
+        freeAsmResult(&result);
+        return 2;
+    }
+    uint32_t* expected = malloc(MEM_SIZE * sizeof(uint32_t));           // the source's image, flat like the file's
+    if (!expected) {
+        fprintf(stderr, "Out of memory!\n");
+        free(image);
+        freeAsmResult(&result);
+        return 2;
+    }
+    readImageWords(&result.image, 0, MEM_SIZE, expected);               // image.size == MEM_SIZE
+
+    // --- Instructions: decode both sides at the same address -------------
+    int differing = 0;
+    int addr = 0;
+    while (addr < result.words_used) {
+        DecodedWord want, got;
+        int words = decodeInstruction(expected, MEM_SIZE, addr, &want);
+        decodeInstruction(image, MEM_SIZE, addr, &got);
+        if (words == 0) {
+            words = 1;
+        }
+        if (memcmp(expected + addr, image + addr, (size_t)words * sizeof(uint32_t)) != 0) {
+            char want_text[DISASM_LINE_MAX], got_text[DISASM_LINE_MAX], fields[64];
+            formatInline(&want, want_text);
+            formatInline(&got, got_text);
+            listFieldDiffs(&want, &got, fields, sizeof(fields));
+            printf("0x%03X: expected `%s`, image has `%s` (%s)\n", addr, want_text, got_text, fields);
+            for (int w = 0; w < words; w++) {
+                differing += (expected[addr + w] != image[addr + w]);
+            }
+        }
+        addr += words;
+    }
+
+    // --- Data: everything after the code, word by word -------------------
+    for (; addr < MEM_SIZE; addr++) {
+        if (expected[addr] != image[addr]) {
+            printf("0x%03X: expected data 0x%08X, image has 0x%08X\n", addr, (unsigned)expected[addr], (unsigned)image[addr]);
+            differing++;
+        }
+    }
+
+    if (differing) {
+        printf("%s: %d of %d words differ from %s\n", image_file, differing, MEM_SIZE, source);
+    }
+    else {
+        printf("%s matches %s (%d code words)\n", image_file, source, result.words_used);
+    }
+    free(image);
+    free(expected);
+    freeAsmResult(&result);
+    return differing ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+
+    // -----------------------------------------------------------------------
+    //    --- Parse the command line ---
+    // -----------------------------------------------------------------------
+
+    const char* out_filename = NULL;
+    int trim_image = 0;
+    int quiet = 0;
+    int verify = 0;
+    int num_images = 0;
+    const char** images = calloc((size_t)argc, sizeof(char*));
+    if (!images) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trim") == 0) {
+            trim_image = 1;
+        }
+        else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = 1;
+        }
+        else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            printUsage(argv[0]);
+            free(images);
+            return 1;
+        }
+        else {
+            images[num_images++] = argv[i];
+        }
+    }
+
+    if (verify) {
+        int status = 1;
+        if (num_images == 2) {
+            status = verifyImage(images[0], images[1]);
+        }
+        else {
+            printUsage(argv[0]);
+        }
+        free(images);
+        return status;
+    }
+    if (num_images == 0 || (out_filename && num_images > 1)) {
+        printUsage(argv[0]);
+        free(images);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (out_filename && !quiet) {
+        out = fopen(out_filename, "wb");
+        if (!out) {
+            fprintf(stderr, "Couldn't open %s for output\n", out_filename);
+            free(images);
+            return 1;
+        }
+    }
+
+    // -----------------------------------------------------------------------
+    //    --- Disassemble every image ---
+    // -----------------------------------------------------------------------
+
+    uint32_t* image = malloc(MEM_SIZE * sizeof(uint32_t));
+    int failed = !image;
+    long long total_words = 0;
+    int decoded = 0;
+    double start = wallSeconds();
+
+    for (int i = 0; i < num_images && image; i++) {
+        int count = 0;
+        if (readMemoryImage(images[i], image, MEM_SIZE, &count)) {
+            fprintf(stderr, "Couldn't read memory image %s\n", images[i]);
+            failed = 1;
+            continue;
+        }
+        if (trim_image) {
+            count = usedImageWords(image, count);
+        }
+        size_t len = 0;
+        char* text = disassembleImage(image, count, &len);
+        if (!text) {
+            failed = 1;
+            break;
+        }
+        if (!quiet) {
+            if (num_images > 1) {
+                fprintf(out, "; %s\n", images[i]);
+            }
+            fwrite(text, 1, len, out);
+        }
+        free(text);
+        total_words += count;
+        decoded++;
+    }
+
+    double seconds = wallSeconds() - start;
+    fprintf(stderr, "Disassembled %d images (%lld words) in %.3f ms: %.1f images/s\n", decoded, total_words,
+            seconds * 1000.0, seconds > 0 ? decoded / seconds : 0.0);
+
+    if (out != stdout && fclose(out) != 0) {
+        failed = 1;
+    }
+    free(image);
+    free(images);
+    return failed;
+}
@@ -0,0 +1,103 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "disassembler.h"
+
+// -----------------------------------------------------------------------
+//    --- Decode ---
+// -----------------------------------------------------------------------
+
+int decodeInstruction(const uint32_t* image, int count, int addr, DecodedWord* inst) {
+    uint32_t w = image[addr];
+    inst->opcode = (int)(w >> 24);
+    inst->rd = (int)((w >> 20) & 0xF);
+    inst->rs = (int)((w >> 16) & 0xF);
+    inst->rt = (int)((w >> 12) & 0xF);
+    inst->bigimm = (int)((w >> 8) & 1);
+
+    if (!inst->bigimm) {
+        inst->imm = (int8_t)(w & 0xFF);                                 // sign-extend imm8
+        inst->words = 1;
+    }
+    else if (addr + 1 < count) {
+        inst->imm = (int32_t)image[addr + 1];
+        inst->words = 2;
+    }
+    else {
+        inst->imm = 0;
+        inst->words = 0;                                                // the image ends before the immediate
+    }
+    return inst->words;
+}
+
+// -----------------------------------------------------------------------
+//    --- Format ---
+// -----------------------------------------------------------------------
+//  Lines are built with memcpy and a small integer formatter instead of
+//  snprintf - a 4096-word image is 4096 lines and this is the hot loop.
+
+static char* appendText(char* out, const char* text) {
+    size_t len = strlen(text);
+    memcpy(out, text, len);
+    return out + len;
+}
+
+static char* appendInt(char* out, int32_t value) {
+    char digits[12];
+    int n = 0;
+    uint32_t v = (value < 0) ? 0u - (uint32_t)value : (uint32_t)value;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (n) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+size_t formatInstruction(const DecodedWord* inst, char* out) {
+    char* p = out;
+    if (inst->opcode < NUM_OPCODES) {
+        p = appendText(p, opcode_table[inst->opcode]);
+    }
+    else {
+        p = appendText(p, "OP_");                                       // same spelling as asm_checker.py
+        p = appendInt(p, inst->opcode);
+    }
+    *p++ = ' ';
+    p = appendText(p, reg_table[inst->rd]);
+    p = appendText(p, ", ");
+    p = appendText(p, reg_table[inst->rs]);
+    p = appendText(p, ", ");
+    p = appendText(p, reg_table[inst->rt]);
+    p = appendText(p, ", ");
+    p = appendInt(p, inst->imm);
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+char* disassembleImage(const uint32_t* image, int count, size_t* len_out) {
+    char* text = malloc((size_t)count * DISASM_LINE_MAX + DISASM_LINE_MAX);
+    if (!text) {
+        return NULL;
+    }
+    size_t len = 0;
+    for (int addr = 0; addr < count;) {
+        DecodedWord inst;
+        if (decodeInstruction(image, count, addr, &inst) == 0) {
+            len += (size_t)sprintf(text + len, "; ERROR: bigimm=1 at line %d, but no low-word found\n", addr);
+            break;
+        }
+        len += formatInstruction(&inst, text + len);
+        addr += inst.words;
+    }
+    *len_out = len;
+    return text;
+}
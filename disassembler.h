@@ -0,0 +1,33 @@
+﻿#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "assembler.h"                                                  // opcode_table, reg_table
+
+// -----------------------------------------------------------------------
+//  SIMP disassembler - the C replacement for asm_checker.py. Output
+//  lines have the same "mnemonic rd, rs, rt, imm" form.
+// -----------------------------------------------------------------------
+
+#define DISASM_LINE_MAX 64                                              // longest line formatInstruction writes
+
+// One instruction split into its fields
+typedef struct {
+    int opcode;                                                         // 0-255 (only 0-21 are valid)
+    int rd, rs, rt;
+    int bigimm;
+    int32_t imm;                                                        // sign-extended imm8 or the big_imm word
+    int words;                                                          // 1, 2 with big_imm, 0 if big_imm has no second word
+} DecodedWord;
+
+// Decode the instruction at image[addr] (image holds count words) - return the words it takes
+int decodeInstruction(const uint32_t* image, int count, int addr, DecodedWord* inst);
+
+// Write "mnemonic rd, rs, rt, imm\n" into out[0..DISASM_LINE_MAX) - return its length
+size_t formatInstruction(const DecodedWord* inst, char* out);
+
+// Disassemble image[0..count) into one malloc'd text buffer - NULL if out of memory
+char* disassembleImage(const uint32_t* image, int count, size_t* len_out);
+
+#endif // DISASSEMBLER_H
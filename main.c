@@ -0,0 +1,715 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "object.h"
+#include "platform.h"
+#include "watch.h"
+
+// -----------------------------------------------------------------------
+//    --- Command-line front end for libsimpasm ---
+// -----------------------------------------------------------------------
+
+typedef struct {
+    ImageFormat format;
+    int trim_image;                                                     // stop after the last non-zero word
+    int stats;                                                          // report each program as a JSON object
+    const char* map_filename;                                           // --map: write a source map for the profiler
+    int mem_size;                                                       // --mem-size, 0 = MEM_SIZE
+} OutputOptions;
+
+// File side of one assembly, next to the assembler's own AsmStats
+typedef struct {
+    size_t src_bytes;
+    double read_seconds;
+    double write_seconds;
+} FileReport;
+
+static void printUsage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options] <program.asm> <memin>\n", prog);
+    fprintf(stderr, "       %s [options] --batch <manifest>\n", prog);
+    fprintf(stderr, "       %s [options] -c <module.asm> <module.obj>\n", prog);
+    fprintf(stderr, "       %s [options] --link <memin> <module.obj>...\n", prog);
+    fprintf(stderr, "       %s [options] --watch <program.asm> <memin>\n", prog);
+    fprintf(stderr, "  --binary         write little-endian 32-bit words instead of text lines\n");
+    fprintf(stderr, "  --trim           stop the image after the last non-zero word\n");
+    fprintf(stderr, "  --sparse         write only the non-zero words, each run after an \"@<hex address>\" line\n");
+    fprintf(stderr, "  --mem-size N     address space of the image in words (default %d, at most %d)\n", MEM_SIZE, MAX_MEM_SIZE);
+    fprintf(stderr, "  --relax          use the one-word form for label immediates that fit in 8 bits\n");
+    fprintf(stderr, "  -O               run the peephole optimizer and report what each rule changed\n");
+    fprintf(stderr, "  --batch FILE     assemble every \"input output\" pair listed in FILE\n");
+    fprintf(stderr, "  -c               write a relocatable object instead of an image (its labels are\n");
+    fprintf(stderr, "                   local unless listed as \".global NAME\")\n");
+    fprintf(stderr, "  --link           place the objects one after another and resolve their labels\n");
+    fprintf(stderr, "  --map FILE       also write a source map (address -> line and label) for the simulator's\n");
+    fprintf(stderr, "                   --profile (single program only)\n");
+    fprintf(stderr, "  --stats          print pass times, counts, big_imm use and image fill as JSON\n");
+    fprintf(stderr, "                   (one object per program; with --batch one line per file)\n");
+    fprintf(stderr, "  --watch          reassemble on every save, rewriting only the image lines that changed\n");
+    fprintf(stderr, "                   (always the full %d-word image; --trim, --sparse, --mem-size, --relax\n", MEM_SIZE);
+    fprintf(stderr, "                   and -O do not apply)\n");
+    fprintf(stderr, "  -j N             worker threads (default: one per core); --batch runs files in\n");
+    fprintf(stderr, "                   parallel, a single large source is split into chunks\n");
+}
+
+// Read, assemble and write one program (and its source map with --map).
+// The diagnostics stay in *result (image and labels are released);
+// returns 0 on success.
+static int assembleFile(const char* in_filename, const char* out_filename, const AsmOptions* opts,
+                        const OutputOptions* out, AsmResult* result, FileReport* report) {
+    memset(report, 0, sizeof(*report));
+    double start = wallSeconds();
+    size_t src_len = 0;
+    char* src = readSourceFile(in_filename, &src_len);                  // the assembler works on views into this buffer
+    report->src_bytes = src_len;
+    report->read_seconds = wallSeconds() - start;
+    if (!src) {
+        memset(result, 0, sizeof(*result));
+        return -1;                                                      // could not read the source
+    }
+
+    AsmOptions file_opts = *opts;
+    file_opts.source_map = (out->map_filename != NULL);
+    int status = assembleProgram(src, src_len, &file_opts, result);
+    if (status == 0 && out->map_filename && writeSourceMap(out->map_filename, in_filename, result)) {
+        status = -3;                                                    // could not write the source map
+    }
+    free(src);
+    free(result->labels);                                               // their names pointed into src
+    result->labels = NULL;
+    result->label_count = 0;
+
+    if (status == 0) {
+        start = wallSeconds();
+        int out_words = out->trim_image ? imageUsedWords(&result->image) : result->image.size;
+        if (writeImage(out_filename, &result->image, out_words, out->format)) {
+            status = -2;                                                // could not write the image
+        }
+        report->write_seconds = wallSeconds() - start;
+    }
+    int image_size = result->image.size;
+    freeImage(&result->image);
+    result->image.size = image_size;                                    // still reported by the caller
+    return status;
+}
+
+// -----------------------------------------------------------------------
+//    --- --stats: one JSON object per program ---
+// -----------------------------------------------------------------------
+
+static void printJsonString(FILE* file, const char* s) {
+    fputc('"', file);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        }
+        else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        }
+        else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static double ratio(long long part, long long whole) {
+    return whole > 0 ? (double)part / (double)whole : 0.0;
+}
+
+// Print result's statistics as a single line of JSON
+static void printStatsJson(FILE* file, const char* source, int status, const AsmResult* result,
+                           const FileReport* report, const AsmOptions* opts) {
+    const AsmStats* st = &result->stats;
+    int warnings = result->diagnostic_count - result->error_count;
+    int big_label = st->big_imm_label - result->relaxed_count;          // relaxed immediates gave their word back
+    int big_total = big_label + st->big_imm_constant;
+
+    fprintf(file, "{\"source\":");
+    printJsonString(file, source);
+    fprintf(file, ",\"status\":\"%s\",\"errors\":%d,\"warnings\":%d,", status ? "error" : "ok",
+        result->error_count, warnings < 0 ? 0 : warnings);
+    fprintf(file, "\"seconds\":{\"read\":%.6f,\"first_pass\":%.6f,\"resolve\":%.6f,\"write\":%.6f,\"total\":%.6f},",
+        report->read_seconds, st->first_pass_seconds, st->resolve_seconds, report->write_seconds,
+        report->read_seconds + st->first_pass_seconds + st->resolve_seconds + report->write_seconds);
+    fprintf(file, "\"source_bytes\":%zu,\"lines\":%d,\"labels\":%d,\"instructions\":%d,\"word_directives\":%d,",
+        report->src_bytes, st->lines, st->labels, st->instructions, st->word_directives);
+    fprintf(file, "\"big_imm\":{\"instructions\":%d,\"share\":%.4f,\"label\":%d,\"constant\":%d,\"relaxed\":%d},",
+        big_total, ratio(big_total, st->instructions), big_label, st->big_imm_constant, result->relaxed_count);
+    fprintf(file, "\"label_lookups\":%lld,", st->label_lookups);
+    fprintf(file, "\"image\":{\"size\":%d,\"words_used\":%d,\"nonzero_words\":%d,\"fill_ratio\":%.4f,"
+        "\"allocated_words\":%lld}", result->image.size, result->words_used, st->nonzero_words,
+        ratio(result->words_used, result->image.size), st->allocated_words);
+    if (opts && opts->optimize) {
+        fprintf(file, ",\"peephole\":{");
+        for (int r = 0; r < PEEP_RULE_COUNT; r++) {
+            fprintf(file, "%s", r ? "," : "");
+            printJsonString(file, peephole_rule_names[r]);
+            fprintf(file, ":%d", result->peephole_hits[r]);
+        }
+        fprintf(file, ",\"words_saved\":%d}", result->peephole_words_saved);
+    }
+    fprintf(file, "}\n");
+}
+
+// -----------------------------------------------------------------------
+//    --- Batch mode - work-stealing pool over a manifest ---
+// -----------------------------------------------------------------------
+//  Every worker starts with a contiguous slice of the jobs and takes jobs
+//  from the front of its own slice. An idle worker steals the back half
+//  of the largest remaining slice, so long files do not leave cores idle.
+//  Each job writes only its own output file and the report is printed in
+//  manifest order, so results do not depend on scheduling.
+
+typedef struct {
+    char* in_filename;
+    char* out_filename;
+    int line_num;                                                       // manifest line
+    int status;
+    double seconds;
+    FileReport file;
+    AsmResult result;                                                   // diagnostics only
+} BatchJob;
+
+typedef struct {
+    Mutex lock;
+    int next;                                                           // first job not yet taken
+    int end;                                                            // one past the last job of this slice
+} JobSlice;
+
+typedef struct {
+    BatchJob* jobs;
+    JobSlice* slices;
+    int num_workers;
+    const AsmOptions* opts;                                             // per-file options (each file assembles serially)
+    const OutputOptions* out;
+} BatchPool;
+
+typedef struct {
+    BatchPool* pool;
+    int id;
+} BatchWorker;
+
+// Take the next job from slice s (front) - return -1 if it is empty
+static int popJob(JobSlice* s) {
+    lockMutex(&s->lock);
+    int job = (s->next < s->end) ? s->next++ : -1;
+    unlockMutex(&s->lock);
+    return job;
+}
+
+// Move the back half of the fullest other slice into slice self - return 0 if nothing was left
+static int stealJobs(BatchPool* pool, int self) {
+    for (;;) {
+        int victim = -1;
+        int most = 0;
+        for (int w = 0; w < pool->num_workers; w++) {                   // pick a victim, re-checked when taking its jobs
+            if (w == self) {
+                continue;
+            }
+            lockMutex(&pool->slices[w].lock);
+            int left = pool->slices[w].end - pool->slices[w].next;
+            unlockMutex(&pool->slices[w].lock);
+            if (left > most) {
+                most = left;
+                victim = w;
+            }
+        }
+        if (victim < 0) {
+            return 0;
+        }
+
+        JobSlice* v = &pool->slices[victim];
+        lockMutex(&v->lock);
+        int left = v->end - v->next;
+        int lo = 0, hi = 0;
+        if (left > 0) {
+            hi = v->end;
+            lo = hi - (left + 1) / 2;                                   // take the back half (at least one job)
+            v->end = lo;
+        }
+        unlockMutex(&v->lock);
+
+        if (hi > lo) {
+            JobSlice* mine = &pool->slices[self];
+            lockMutex(&mine->lock);
+            mine->next = lo;
+            mine->end = hi;
+            unlockMutex(&mine->lock);
+            return 1;
+        }
+    }
+}
+
+static void batchWorker(void* arg) {
+    BatchWorker* worker = arg;
+    BatchPool* pool = worker->pool;
+
+    for (;;) {
+        int j = popJob(&pool->slices[worker->id]);
+        if (j < 0) {
+            if (!stealJobs(pool, worker->id)) {
+                return;                                                 // every slice is empty
+            }
+            continue;
+        }
+        BatchJob* job = &pool->jobs[j];
+        double start = wallSeconds();
+        job->status = assembleFile(job->in_filename, job->out_filename, pool->opts, pool->out, &job->result, &job->file);
+        job->seconds = wallSeconds() - start;
+    }
+}
+
+// Duplicate a token as a '\0'-terminated string
+static char* copyToken(const Token* tok) {
+    char* s = malloc(tok->len + 1);
+    if (s) {
+        memcpy(s, tok->ptr, tok->len);
+        s[tok->len] = '\0';
+    }
+    return s;
+}
+
+// Parse "input output" lines ('#' comments allowed) - return the job count or -1
+static int readManifest(const char* filename, BatchJob** jobs_out) {
+    size_t len = 0;
+    char* text = readSourceFile(filename, &len);
+    if (!text) {
+        fprintf(stderr, "Couldn't open batch manifest %s\n", filename);
+        return -1;
+    }
+
+    BatchJob* jobs = NULL;
+    int count = 0, cap = 0;
+    const char* cursor = text;
+    int line_num = 0;
+    int failed = 0;
+
+    while (cursor < text + len && !failed) {                            // same lexer as the assembler: tokens split on blanks/commas
+        AsmLine line;
+        line_num++;
+        lexLine(&cursor, text + len, &line);
+        if (line.kind == LINE_BLANK) {
+            continue;
+        }
+        if (line.ntok != 2) {
+            fprintf(stderr, "%s (line %d): expected \"input.asm output\"\n", filename, line_num);
+            failed = 1;
+            break;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            BatchJob* grown = realloc(jobs, (size_t)cap * sizeof(BatchJob));
+            if (!grown) {
+                failed = 1;
+                break;
+            }
+            jobs = grown;
+        }
+        BatchJob* job = &jobs[count++];
+        memset(job, 0, sizeof(*job));
+        job->line_num = line_num;
+        job->in_filename = copyToken(&line.tokens[0]);
+        job->out_filename = copyToken(&line.tokens[1]);
+        if (!job->in_filename || !job->out_filename) {
+            failed = 1;
+        }
+    }
+    free(text);
+
+    if (failed) {
+        for (int i = 0; i < count; i++) {
+            free(jobs[i].in_filename);
+            free(jobs[i].out_filename);
+        }
+        free(jobs);
+        return -1;
+    }
+    *jobs_out = jobs;
+    return count;
+}
+
+static int runBatch(const char* manifest, int num_workers, const AsmOptions* opts, const OutputOptions* out) {
+    BatchJob* jobs = NULL;
+    int num_jobs = readManifest(manifest, &jobs);
+    if (num_jobs < 0) {
+        return 1;
+    }
+    if (num_workers <= 0) {
+        num_workers = processorCount();
+    }
+    if (num_workers > num_jobs) {
+        num_workers = num_jobs > 0 ? num_jobs : 1;
+    }
+
+    BatchPool pool;
+    pool.jobs = jobs;
+    pool.num_workers = num_workers;
+    pool.opts = opts;
+    pool.out = out;
+    pool.slices = calloc((size_t)num_workers, sizeof(JobSlice));
+    BatchWorker* workers = calloc((size_t)num_workers, sizeof(BatchWorker));
+    Thread* threads = calloc((size_t)num_workers, sizeof(Thread));
+    if (!pool.slices || !workers || !threads) {
+        fprintf(stderr, "Out of memory!\n");
+        free(pool.slices);
+        free(workers);
+        free(threads);
+        return 1;
+    }
+
+    for (int w = 0; w < num_workers; w++) {                              // even initial split, stealing evens out the rest
+        initMutex(&pool.slices[w].lock);
+        pool.slices[w].next = (int)((long long)num_jobs * w / num_workers);
+        pool.slices[w].end = (int)((long long)num_jobs * (w + 1) / num_workers);
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+
+    double start = wallSeconds();
+    int started = 0;
+    for (int w = 1; w < num_workers; w++) {                              // the calling thread is worker 0
+        if (startThread(&threads[w], batchWorker, &workers[w]) != 0) {
+            break;                                                      // its slice gets stolen by the others
+        }
+        started = w;
+    }
+    batchWorker(&workers[0]);
+    for (int w = 1; w <= started; w++) {
+        joinThread(threads[w]);
+    }
+    double total = wallSeconds() - start;
+
+    // --- Report in manifest order ------------------------------------
+    int failures = 0;
+    size_t total_bytes = 0;
+    double busy = 0.0;
+    for (int i = 0; i < num_jobs; i++) {
+        BatchJob* job = &jobs[i];
+        printDiagnostics(stderr, job->in_filename, &job->result);
+        if (job->status == -1) {
+            fprintf(stderr, "%s: couldn't open the assembly file\n", job->in_filename);
+        }
+        else if (job->status == -2) {
+            fprintf(stderr, "%s: couldn't write %s\n", job->in_filename, job->out_filename);
+        }
+        if (out->stats) {
+            printStatsJson(stdout, job->in_filename, job->status, &job->result, &job->file, opts);
+        }
+        else {
+            printf("%-40s %s  %8.3f ms  %d words\n", job->in_filename, job->status ? "FAIL" : "ok  ",
+                job->seconds * 1e3, job->result.words_used);
+        }
+        failures += (job->status != 0);
+        total_bytes += job->file.src_bytes;
+        busy += job->seconds;
+        freeAsmResult(&job->result);
+        free(job->in_filename);
+        free(job->out_filename);
+    }
+    fprintf(out->stats ? stderr : stdout, "Assembled %d of %d programs with %d threads in %.3f ms: %.1f programs/s, %.2f MB/s of source, average concurrency %.1f\n",
+        num_jobs - failures, num_jobs, num_workers, total * 1e3,
+        total > 0 ? num_jobs / total : 0.0, total > 0 ? total_bytes / total / 1e6 : 0.0,
+        total > 0 ? busy / total : 0.0);
+
+    for (int w = 0; w < num_workers; w++) {
+        destroyMutex(&pool.slices[w].lock);
+    }
+    free(pool.slices);
+    free(workers);
+    free(threads);
+    free(jobs);
+    return failures ? 1 : 0;
+}
+
+// -----------------------------------------------------------------------
+//    --- Separate assembly: -c and --link ---
+// -----------------------------------------------------------------------
+
+static int compileObject(const char* in_filename, const char* obj_filename, const AsmOptions* opts) {
+    size_t src_len = 0;
+    char* src = readSourceFile(in_filename, &src_len);
+    if (!src) {
+        fprintf(stderr, "Couldn't open the assembly file!\n");
+        return 1;
+    }
+    AsmResult result;
+    int status = assembleObject(src, src_len, opts, in_filename, obj_filename, &result);
+    printDiagnostics(stderr, in_filename, &result);
+    if (status == -2) {
+        fprintf(stderr, "Couldn't write object file %s\n", obj_filename);
+    }
+    else if (status == 0) {
+        printf("Assembled object: %d words.\n", result.words_used);
+    }
+    freeAsmResult(&result);
+    free(src);
+    return status ? 1 : 0;
+}
+
+static int linkProgram(const char* out_filename, const char* const* objects, int count, const AsmOptions* opts,
+                       const OutputOptions* out) {
+    LinkResult link;
+    int status = linkObjects(objects, count, opts, &link);
+    printLinkDiagnostics(stderr, &link);
+    FileReport report = { 0 };
+    if (status == 0) {
+        AsmResult* result = &link.result;
+        double start = wallSeconds();
+        int out_words = out->trim_image ? imageUsedWords(&result->image) : result->image.size;
+        if (writeImage(out_filename, &result->image, out_words, out->format)) {
+            fprintf(stderr, "Couldn't write machine code file for output!\n");
+            status = 1;
+        }
+        else if (!out->stats) {
+            printf("Linked %d objects: used %d words out of %d.\n", count, result->words_used, result->image.size);
+        }
+        report.write_seconds = wallSeconds() - start;
+    }
+    if (out->stats && status >= 0) {
+        printStatsJson(stdout, out_filename, status, &link.result, &report, opts);
+    }
+    freeLinkResult(&link);
+    return status ? 1 : 0;
+}
+
+// -----------------------------------------------------------------------
+//    --- Watch mode - reassemble on every save ---
+// -----------------------------------------------------------------------
+
+#define WATCH_POLL_MS 50                                                // how often the source is checked for changes
+
+// Bring the image file up to date - return how many lines were written, -1 on failure
+static int writeWatchImage(const WatchSession* ws, const char* out_filename, ImageFormat format, int* have_file) {
+    if (*have_file && rewriteImageWords(out_filename, ws->image, ws->changed, ws->changed_count, format) == 0) {
+        return ws->changed_count;
+    }
+    if (writeMemoryImage(out_filename, ws->image, MEM_SIZE, format)) {  // first build, or the file went away
+        return -1;
+    }
+    *have_file = 1;
+    return MEM_SIZE;
+}
+
+static int watchProgram(const char* in_filename, const char* out_filename, const OutputOptions* out) {
+    WatchSession* ws = malloc(sizeof(WatchSession));                    // holds three full images - too big for the stack
+    if (!ws || initWatchSession(ws)) {
+        fprintf(stderr, "Out of memory!\n");
+        free(ws);
+        return 1;
+    }
+    if (out->trim_image || out->format == IMAGE_SPARSE || out->mem_size) {
+        fprintf(stderr, "--watch writes the full image so lines can be rewritten in place; ignoring --trim, --sparse and --mem-size\n");
+    }
+    // Sparse lines have no fixed stride to rewrite in place
+    ImageFormat format = (out->format == IMAGE_BINARY) ? IMAGE_BINARY : IMAGE_TEXT;
+    printf("Watching %s - press Ctrl+C to stop.\n", in_filename);
+    fflush(stdout);
+
+    long long seen_mtime = -1, seen_size = -1;
+    int have_file = 0;
+    for (;;) {
+        long long mtime, size;
+        if (fileStamp(in_filename, &mtime, &size) != 0 || (mtime == seen_mtime && size == seen_size)) {
+            sleepMilliseconds(WATCH_POLL_MS);
+            continue;
+        }
+        size_t src_len = 0;
+        char* src = readSourceFile(in_filename, &src_len);
+        if (!src) {
+            sleepMilliseconds(WATCH_POLL_MS);                           // still being saved - try again
+            continue;
+        }
+        seen_mtime = mtime;
+        seen_size = size;
+
+        double start = wallSeconds();
+        WatchStats stats;
+        int status = updateWatchSession(ws, src, src_len, &stats);
+        int written = 0;
+        if (status == 0) {
+            written = writeWatchImage(ws, out_filename, format, &have_file);
+        }
+        double ms = (wallSeconds() - start) * 1e3;
+
+        AsmResult report = { 0 };                                       // a view of the session's diagnostics
+        report.diagnostics = ws->ctx.diags;
+        report.diagnostic_count = ws->ctx.diag_count;
+        printDiagnostics(stderr, in_filename, &report);
+        if (status != 0) {
+            printf("Not updated: %d lines have errors (unchanged lines are reported once).\n", stats.error_lines);
+        }
+        else if (written < 0) {
+            fprintf(stderr, "Couldn't write machine code file for output!\n");
+        }
+        else {
+            printf("Reassembled in %.3f ms: %d lines reparsed, %d labels moved, %d label immediates resolved, %d image lines written.\n",
+                ms, stats.lines_reparsed, stats.labels_moved, stats.fixups_resolved, written);
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv) {
+
+    // -----------------------------------------------------------------------
+    //    --- Parse the command line ---
+    // -----------------------------------------------------------------------
+
+    OutputOptions out = { IMAGE_TEXT, 0, 0, NULL, 0 };
+    const char* manifest = NULL;
+    int num_workers = 0;                                                // 0 = one per core
+    int relax = 0;
+    int optimize = 0;
+    int compile_only = 0;
+    int link = 0;
+    int watch = 0;
+    int num_files = 0;
+    const char** files = calloc((size_t)argc, sizeof(char*));           // file arguments in order
+    if (!files) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--binary") == 0) {
+            out.format = IMAGE_BINARY;
+        }
+        else if (strcmp(argv[i], "--trim") == 0) {
+            out.trim_image = 1;
+        }
+        else if (strcmp(argv[i], "--sparse") == 0) {
+            out.format = IMAGE_SPARSE;
+        }
+        else if (strcmp(argv[i], "--mem-size") == 0 && i + 1 < argc) {
+            long long size = strtoll(argv[++i], NULL, 0);
+            if (size < 1 || size > MAX_MEM_SIZE) {
+                fprintf(stderr, "--mem-size must be between 1 and %d words\n", MAX_MEM_SIZE);
+                free(files);
+                return 1;
+            }
+            out.mem_size = (int)size;
+        }
+        else if (strcmp(argv[i], "--relax") == 0) {
+            relax = 1;
+        }
+        else if (strcmp(argv[i], "-O") == 0) {
+            optimize = 1;
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            compile_only = 1;
+        }
+        else if (strcmp(argv[i], "--link") == 0) {
+            link = 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            out.stats = 1;
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        }
+        else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+            out.map_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_workers = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            printUsage(argv[0]);
+            free(files);
+            return 1;
+        }
+        else {
+            files[num_files++] = argv[i];
+        }
+    }
+    const char* in_filename = (num_files > 0) ? files[0] : NULL;
+    const char* out_filename = (num_files > 1) ? files[1] : NULL;
+
+    if (out.map_filename && (manifest || watch || compile_only || link)) {
+        fprintf(stderr, "--map works when assembling a single program\n");
+        free(files);
+        return 1;
+    }
+
+    if (manifest) {
+        AsmOptions batch_opts = { 0 };
+        batch_opts.relax = relax;
+        batch_opts.optimize = optimize;
+        batch_opts.mem_size = out.mem_size;
+        free(files);
+        return runBatch(manifest, num_workers, &batch_opts, &out);
+    }
+
+    if (!in_filename || !out_filename) {
+        printUsage(argv[0]);
+        free(files);
+        return 1;
+    }
+
+    if (watch) {
+        int status = watchProgram(in_filename, out_filename, &out);
+        free(files);
+        return status;
+    }
+
+    // -----------------------------------------------------------------------
+    //    --- Assemble one program ---
+    // -----------------------------------------------------------------------
+
+    AsmOptions opts = { 0 };
+    opts.threads = (num_workers > 0) ? num_workers : processorCount();  // only used for sources big enough to split
+    opts.relax = relax;
+    opts.optimize = optimize;
+    opts.mem_size = out.mem_size;
+
+    if (compile_only || link) {
+        int status = compile_only ? compileObject(in_filename, out_filename, &opts)
+                                  : linkProgram(in_filename, files + 1, num_files - 1, &opts, &out);
+        free(files);
+        return status;
+    }
+
+    AsmResult result;
+    FileReport report;
+    int status = assembleFile(in_filename, out_filename, &opts, &out, &result, &report);
+    printDiagnostics(stderr, in_filename, &result);
+
+    if (status == -1) {
+        fprintf(stderr, "Couldn't open the assembly file!\n");
+    }
+    else if (status == -2) {
+        fprintf(stderr, "Couldn't write machine code file for output!\n");
+    }
+    else if (status == -3) {
+        fprintf(stderr, "Couldn't write source map %s\n", out.map_filename);
+    }
+    if (out.stats && status != -1) {
+        printStatsJson(stdout, in_filename, status, &result, &report, &opts);
+    }
+    else if (status == 0) {
+        printf("Assembled program: used %d words out of %d.\n", result.words_used, result.image.size);
+        if (relax) {
+            printf("Relaxed %d label immediates to the one-word form.\n", result.relaxed_count);
+        }
+        if (optimize) {
+            printf("Peephole:");
+            for (int r = 0; r < PEEP_RULE_COUNT; r++) {
+                printf("%s %s %d", r ? "," : "", peephole_rule_names[r], result.peephole_hits[r]);
+            }
+            printf(" - saved %d words.\n", result.peephole_words_saved);
+        }
+    }
+
+    freeAsmResult(&result);
+    free(files);
+    return status ? 1 : 0;
+}
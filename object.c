@@ -0,0 +1,428 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "object.h"
+#include "platform.h"
+
+// -----------------------------------------------------------------------
+//    --- Object file layout ---
+// -----------------------------------------------------------------------
+//  Every field is a little-endian 32-bit word; names and `.word` tokens
+//  are (offset, length) pairs into the string table at the end.
+//
+//      "SIMPOBJ\0", version, word_count, label_count, fixup_count,
+//      word_fixup_count, line_count, source name (offset, length),
+//      string table length
+//      words       word_count x  word
+//      labels      label_count x (name offset, name length, address, line, exported)
+//      fixups      fixup_count x (word index, line, label offset, label length)
+//      .word       word_fixup_count x (line, first free word, 3 x (offset, length))
+//      strings
+
+#define OBJECT_HEADER_WORDS 9
+
+typedef struct {
+    unsigned char* data;
+    size_t len, cap;
+    int failed;                                                         // an allocation failed - the buffer is incomplete
+} ByteBuffer;
+
+static void putBytes(ByteBuffer* buf, const void* bytes, size_t len) {
+    if (buf->failed) {
+        return;
+    }
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) {
+            cap *= 2;
+        }
+        unsigned char* grown = realloc(buf->data, cap);
+        if (!grown) {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+}
+
+static void putU32(ByteBuffer* buf, uint32_t value) {
+    unsigned char bytes[4] = {
+        (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24)
+    };
+    putBytes(buf, bytes, 4);
+}
+
+// Append text to the string table and write its (offset, length) to body
+static void putString(ByteBuffer* body, ByteBuffer* strings, const char* text, size_t len) {
+    putU32(body, (uint32_t)strings->len);
+    putU32(body, (uint32_t)len);
+    putBytes(strings, text, len);
+}
+
+static uint32_t getU32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// -----------------------------------------------------------------------
+//    --- Writing objects ---
+// -----------------------------------------------------------------------
+
+// Save ctx (after assembleSource, before resolveFixups) - labels found in
+// exported are marked for other objects to use - return 0 on success
+static int writeObject(const AsmContext* ctx, const AsmContext* exported, const char* source_name, const char* filename) {
+    ByteBuffer body = { 0 }, strings = { 0 };
+
+    for (int i = 0; i < ctx->current_word; i++) {
+        putU32(&body, imageWord(&ctx->image, i));
+    }
+    for (int i = 0; i < ctx->label_count; i++) {
+        const Label* lab = &ctx->labels[i];
+        putString(&body, &strings, lab->name, lab->len);
+        putU32(&body, (uint32_t)lab->address);
+        putU32(&body, (uint32_t)lab->line_num);
+        putU32(&body, findLabel(exported, lab->name, lab->len) != NULL);
+    }
+    for (int i = 0; i < ctx->fixup_count; i++) {
+        const Fixup* f = &ctx->fixups[i];
+        putU32(&body, (uint32_t)f->word_index);
+        putU32(&body, (uint32_t)f->line_num);
+        putString(&body, &strings, f->label.ptr, f->label.len);
+    }
+    for (int i = 0; i < ctx->word_fixup_count; i++) {
+        const WordFixup* wf = &ctx->word_fixups[i];
+        putU32(&body, (uint32_t)wf->line_num);
+        putU32(&body, (uint32_t)wf->first_free_word);
+        for (int t = 0; t < 3; t++) {
+            putString(&body, &strings, wf->tokens[t].ptr, wf->tokens[t].len);
+        }
+    }
+    uint32_t name_off = (uint32_t)strings.len;
+    putBytes(&strings, source_name, strlen(source_name));
+
+    ByteBuffer header = { 0 };
+    putBytes(&header, OBJECT_MAGIC, 8);
+    putU32(&header, OBJECT_VERSION);
+    putU32(&header, (uint32_t)ctx->current_word);
+    putU32(&header, (uint32_t)ctx->label_count);
+    putU32(&header, (uint32_t)ctx->fixup_count);
+    putU32(&header, (uint32_t)ctx->word_fixup_count);
+    putU32(&header, (uint32_t)ctx->line_count);
+    putU32(&header, name_off);
+    putU32(&header, (uint32_t)strlen(source_name));
+    putU32(&header, (uint32_t)strings.len);
+
+    int failed = header.failed || body.failed || strings.failed;
+    FILE* file = failed ? NULL : fopen(filename, "wb");
+    if (file) {
+        failed |= fwrite(header.data, 1, header.len, file) != header.len;
+        failed |= fwrite(body.data, 1, body.len, file) != body.len;
+        failed |= strings.len && fwrite(strings.data, 1, strings.len, file) != strings.len;
+        failed |= fclose(file) != 0;
+    }
+    else {
+        failed = 1;
+    }
+    free(header.data);
+    free(body.data);
+    free(strings.data);
+    return failed;
+}
+
+int assembleObject(const char* src, size_t len, const AsmOptions* opts, const char* source_name,
+                   const char* obj_filename, AsmResult* result) {
+    memset(result, 0, sizeof(*result));
+
+    AsmOptions object_opts = { 0 };
+    if (opts) {
+        object_opts = *opts;
+    }
+    object_opts.relax = 0;                                              // addresses are only final after linking
+    object_opts.threads = 1;
+
+    AsmContext ctx;
+    if (initAsmContext(&ctx, src, len, &object_opts)) {
+        freeAsmContext(&ctx);
+        result->error_count = 1;
+        return 1;
+    }
+    assembleSource(&ctx);                                               // labels from other objects stay as fixups
+
+    AsmContext exported;                                                // the `.global` names, for writeObject to look up
+    if (initAsmContext(&exported, NULL, 0, NULL)) {
+        ctx.out_of_memory = 1;
+    }
+    for (int i = 0; i < ctx.export_count && !ctx.out_of_memory; i++) {
+        const Label* exp = &ctx.exports[i];
+        if (!findLabel(&ctx, exp->name, exp->len)) {
+            addDiagnostic(&ctx, 1, exp->line_num, "`.global` label `%.*s` is not defined", (int)exp->len, exp->name);
+        }
+        else if (!findLabel(&exported, exp->name, exp->len)) {
+            defineLabel(&exported, exp->name, exp->len, 0, exp->line_num);
+        }
+    }
+    ctx.out_of_memory |= exported.out_of_memory;
+
+    int status = 0;
+    if (ctx.error_count == 0 && !ctx.out_of_memory && writeObject(&ctx, &exported, source_name, obj_filename)) {
+        status = -2;
+    }
+    freeAsmContext(&exported);
+    return finishAsmResult(&ctx, result) ? 1 : status;
+}
+
+// -----------------------------------------------------------------------
+//    --- Reading objects ---
+// -----------------------------------------------------------------------
+
+// Check that (offset, length) at p lies inside the string table and make a token of it
+static int getToken(const unsigned char* p, const char* strings, uint32_t strings_len, Token* tok) {
+    uint32_t off = getU32(p);
+    uint32_t len = getU32(p + 4);
+    if (off > strings_len || len > strings_len - off) {
+        return 1;
+    }
+    tok->ptr = strings + off;
+    tok->len = len;
+    return 0;
+}
+
+#define LOCAL_SUFFIX_LEN 12                                             // "#" and the object number
+
+// The module-local label a reference means, if the object defines one -
+// scratch must hold the name plus LOCAL_SUFFIX_LEN characters
+static Token scopeLabel(const AsmContext* ctx, Token name, int object, char* scratch) {
+    if (findLabel(ctx, name.ptr, name.len)) {
+        return name;                                                    // exported: everyone resolves it the same way
+    }
+    memcpy(scratch, name.ptr, name.len);
+    int n = (int)name.len + sprintf(scratch + name.len, "#%d", object);
+    const Label* local = findLabel(ctx, scratch, (size_t)n);
+    if (local) {
+        name.ptr = local->name;
+        name.len = local->len;
+    }
+    return name;                                                        // otherwise another object has to export it
+}
+
+// Turn the object in buf[0..len) into module (views into buf) - return 0 if it is well formed.
+// Labels it doesn't export get the unique name "NAME#object" in *names (the caller frees it),
+// and so do the fixups and `.word` tokens that refer to them; exported labels go into exports
+// with the object as address, and one already exported by another object is a link error.
+static int loadObject(const unsigned char* buf, size_t len, int object, const char* const* obj_filenames,
+                      AsmModule* module, AsmContext* main, AsmContext* exports, char** names, Token* source_name) {
+    if (len < 8 + 4 * OBJECT_HEADER_WORDS || memcmp(buf, OBJECT_MAGIC, 8) != 0 || getU32(buf + 8) != OBJECT_VERSION) {
+        return 1;
+    }
+    const unsigned char* h = buf + 12;
+    uint32_t words = getU32(h), labels = getU32(h + 4), fixups = getU32(h + 8), word_fixups = getU32(h + 12);
+    uint32_t lines = getU32(h + 16), strings_len = getU32(h + 28);
+    if (words > (uint32_t)main->image.size || labels > len || fixups > len || word_fixups > len) {
+        return 1;
+    }
+    size_t body = (size_t)words * 4 + (size_t)labels * 20 + (size_t)fixups * 16 + (size_t)word_fixups * 32;
+    const unsigned char* p = buf + 8 + 4 * OBJECT_HEADER_WORDS;
+    if ((size_t)(buf + len - p) != body + strings_len) {
+        return 1;
+    }
+    const char* strings = (const char*)p + body;
+    if (getToken(h + 20, strings, strings_len, source_name) || initModule(module, main, strings, strings_len)) {
+        return 1;
+    }
+
+    AsmContext* ctx = &module->ctx;
+    size_t names_len = (size_t)strings_len + (size_t)labels * LOCAL_SUFFIX_LEN;   // every name at most once, plus its suffix
+    ctx->fixups = malloc(((size_t)fixups + 1) * sizeof(Fixup));
+    ctx->word_fixups = malloc(((size_t)word_fixups + 1) * sizeof(WordFixup));
+    *names = malloc(names_len + strings_len + LOCAL_SUFFIX_LEN);        // the names, then room for one lookup
+    if (!ctx->fixups || !ctx->word_fixups || !*names || reserveImageWords(&ctx->image, 0, (int)words)) {
+        return 1;
+    }
+    char* next_name = *names;
+    char* scratch = *names + names_len;
+    ctx->current_word = (int)words;
+    ctx->line_count = (int)lines;
+    for (uint32_t i = 0; i < words; i++, p += 4) {
+        *imageSlot(&ctx->image, (int)i) = getU32(p);
+    }
+
+    for (uint32_t i = 0; i < labels; i++, p += 20) {
+        Token name;
+        uint32_t addr = getU32(p + 8);
+        int line_num = (int)getU32(p + 12);
+        if (getToken(p, strings, strings_len, &name) || addr > words) {
+            return 1;
+        }
+        if (!getU32(p + 16)) {                                          // module-local: no other object can see it
+            if (name.len + LOCAL_SUFFIX_LEN > (size_t)(*names + names_len - next_name)) {
+                return 1;                                               // names overlap in the string table
+            }
+            memcpy(next_name, name.ptr, name.len);
+            name.len += (size_t)sprintf(next_name + name.len, "#%d", object);
+            name.ptr = next_name;
+            next_name += name.len;
+        }
+        else {
+            const Label* other = findLabel(exports, name.ptr, name.len);
+            if (other) {
+                addDiagnostic(main, 1, 0, "label `%.*s` is exported by both `%s` and `%s`",
+                              (int)name.len, name.ptr, obj_filenames[other->address], obj_filenames[object]);
+            }
+            else {
+                defineLabel(exports, name.ptr, name.len, object, line_num);
+            }
+        }
+        defineLabel(ctx, name.ptr, name.len, (int)addr, line_num);
+    }
+
+    ctx->fixup_cap = (int)fixups;
+    for (uint32_t i = 0; i < fixups; i++, p += 16) {
+        Fixup* f = &ctx->fixups[ctx->fixup_count++];
+        uint32_t word_index = getU32(p);
+        if (word_index >= words || getToken(p + 8, strings, strings_len, &f->label)) {
+            return 1;
+        }
+        f->label = scopeLabel(ctx, f->label, object, scratch);
+        f->word_index = (int)word_index;
+        f->line_num = (int)getU32(p + 4);
+        f->short_form = 0;
+    }
+
+    ctx->word_fixup_cap = (int)word_fixups;
+    for (uint32_t i = 0; i < word_fixups; i++, p += 32) {
+        WordFixup* wf = &ctx->word_fixups[ctx->word_fixup_count++];
+        uint32_t first_free = getU32(p + 4);
+        if (first_free > words) {
+            return 1;
+        }
+        wf->line_num = (int)getU32(p);
+        wf->first_free_word = (int)first_free;
+        for (int t = 0; t < 3; t++) {
+            int value;
+            if (getToken(p + 8 + 8 * t, strings, strings_len, &wf->tokens[t])) {
+                return 1;
+            }
+            if (t > 0 && !parseNumber(wf->tokens[t], &value)) {         // address and data may name labels
+                wf->tokens[t] = scopeLabel(ctx, wf->tokens[t], object, scratch);
+            }
+        }
+    }
+    return ctx->out_of_memory || exports->out_of_memory;
+}
+
+// -----------------------------------------------------------------------
+//    --- Linking ---
+// -----------------------------------------------------------------------
+
+static char* copyName(const char* text, size_t len) {
+    char* copy = malloc(len + 1);
+    if (copy) {
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+int linkObjects(const char* const* obj_filenames, int count, const AsmOptions* opts, LinkResult* link) {
+    memset(link, 0, sizeof(*link));
+    AsmOptions link_opts = { 0 };
+    if (opts) {
+        link_opts = *opts;
+    }
+
+    AsmContext main, exports;                                           // exports: who exported each global label
+    char** buffers = calloc((size_t)count + 1, sizeof(char*));          // module tokens point into these
+    char** names = calloc((size_t)count + 1, sizeof(char*));            // and into these (module-local labels)
+    AsmModule* modules = calloc((size_t)count + 1, sizeof(AsmModule));
+    link->base_lines = calloc((size_t)count + 1, sizeof(int));
+    link->source_names = calloc((size_t)count + 1, sizeof(char*));
+    int init_failed = initAsmContext(&main, NULL, 0, &link_opts);
+    init_failed |= initAsmContext(&exports, NULL, 0, NULL);
+    if (init_failed || !buffers || !names || !modules || !link->base_lines || !link->source_names) {
+        freeAsmContext(&main);
+        freeAsmContext(&exports);
+        free(buffers);
+        free(names);
+        free(modules);
+        link->result.error_count = 1;
+        return 1;
+    }
+
+    // --- Load every object ----------------------------------------------
+    double start = wallSeconds();
+    int loaded = 0;
+    int unreadable = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = 0;
+        Token source = { 0 };
+        buffers[i] = readFileBytes(obj_filenames[i], &len);
+        if (!buffers[i] || loadObject((const unsigned char*)buffers[i], len, i, obj_filenames, &modules[loaded], &main, &exports,
+                                      &names[i], &source)) {
+            addDiagnostic(&main, 1, 0, "`%s` is not a readable SIMP object (version %d)", obj_filenames[i], OBJECT_VERSION);
+            freeAsmContext(&modules[loaded].ctx);
+            unreadable = 1;
+            continue;
+        }
+        link->source_names[loaded] = source.len ? copyName(source.ptr, source.len) : copyName(obj_filenames[i], strlen(obj_filenames[i]));
+        loaded++;
+    }
+
+    // --- Lay out, place and patch - the same steps as parallel assembly --
+    double resolve_start = wallSeconds();
+    main.stats.first_pass_seconds = resolve_start - start;
+    if (!unreadable && main.error_count == 0 && !layoutModules(&main, modules, loaded)) {
+        for (int i = 0; i < loaded; i++) {
+            placeModule(&modules[i]);
+        }
+    }
+    for (int i = 0; i < loaded; i++) {
+        link->base_lines[i] = modules[i].base_line;
+    }
+    link->object_count = loaded;
+    finishModules(&main, modules, loaded);
+    main.stats.resolve_seconds = wallSeconds() - resolve_start;
+    int status = finishAsmResult(&main, &link->result);
+
+    freeAsmContext(&exports);
+    for (int i = 0; i < count; i++) {
+        free(buffers[i]);
+        free(names[i]);
+    }
+    free(buffers);
+    free(names);
+    free(modules);
+    return unreadable ? -1 : status;
+}
+
+void freeLinkResult(LinkResult* link) {
+    freeAsmResult(&link->result);
+    for (int i = 0; link->source_names && i < link->object_count; i++) {
+        free(link->source_names[i]);
+    }
+    free(link->source_names);
+    free(link->base_lines);
+    memset(link, 0, sizeof(*link));
+}
+
+void printLinkDiagnostics(FILE* out, const LinkResult* link) {
+    for (int i = 0; i < link->result.diagnostic_count; i++) {
+        const AsmDiagnostic* d = &link->result.diagnostics[i];
+        const char* kind = d->is_error ? "Error" : "Warning";
+        int obj = link->object_count - 1;
+        while (obj > 0 && link->base_lines[obj] >= d->line) {          // the last object that starts before the line
+            obj--;
+        }
+        if (d->line > 0 && obj >= 0) {
+            fprintf(out, "%s: %s (line %d): %s\n", link->source_names[obj], kind, d->line - link->base_lines[obj], d->message);
+        }
+        else {
+            fprintf(out, "link: %s: %s\n", kind, d->message);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+﻿#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include "assembler.h"
+
+// -----------------------------------------------------------------------
+//  Relocatable objects and the linker. An object holds one source file
+//  assembled from address 0: its encoded words, every label it defines,
+//  the label immediates still to patch and its `.word` directives.
+//  Labels are local to their object unless it names them in `.global`;
+//  a reference binds to the object's own label first and otherwise to
+//  the one exported by another object, and exporting the same label from
+//  two objects is a link error. Linking places the objects one after
+//  another exactly like the chunks of a parallel assembly, so when no
+//  label name is defined twice, linking a.obj b.obj gives the same image
+//  as assembling a.asm and b.asm pasted together.
+// -----------------------------------------------------------------------
+
+#define OBJECT_MAGIC "SIMPOBJ"                                          // 8 bytes with the '\0'
+#define OBJECT_VERSION 2
+
+// What linkObjects hands back - release with freeLinkResult
+typedef struct {
+    AsmResult result;                                                   // image and diagnostics (lines counted over all objects)
+    int object_count;
+    int* base_lines;                                                    // lines of the objects before each object
+    char** source_names;                                                // source file each object was assembled from
+} LinkResult;
+
+// Assemble src into a relocatable object file - return 0 on success, 1 on
+// errors (reported in result), -2 if the object could not be written
+int assembleObject(const char* src, size_t len, const AsmOptions* opts, const char* source_name,
+                   const char* obj_filename, AsmResult* result);
+
+// Link object files in order into one image - return 0 on success, 1 on
+// errors (reported in link->result), -1 if an object could not be read
+int linkObjects(const char* const* obj_filenames, int count, const AsmOptions* opts, LinkResult* link);
+void freeLinkResult(LinkResult* link);
+
+// Print link diagnostics as "<source>: Error (line N): ..." with lines of the object's own source
+void printLinkDiagnostics(FILE* out, const LinkResult* link);
+
+#endif // OBJECT_H
@@ -0,0 +1,181 @@
+﻿#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L                                         // clock_gettime, sysconf
+#endif
+
+#include <stdlib.h>
+#include "platform.h"
+
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#else
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#endif
+
+// -----------------------------------------------------------------------
+//    --- Threads ---
+// -----------------------------------------------------------------------
+
+typedef struct {
+    ThreadFunc fn;
+    void* arg;
+} ThreadStart;                                                          // heap copy handed to the new thread
+
+#ifdef _WIN32
+static DWORD WINAPI threadTrampoline(LPVOID p) {
+#else
+static void* threadTrampoline(void* p) {
+#endif
+    ThreadStart start = *(ThreadStart*)p;
+    free(p);
+    start.fn(start.arg);
+    return 0;
+}
+
+int startThread(Thread* thread, ThreadFunc fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return 1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, threadTrampoline, start, 0, NULL);
+    if (*thread == NULL) {
+#else
+    if (pthread_create(thread, NULL, threadTrampoline, start) != 0) {
+#endif
+        free(start);
+        return 1;
+    }
+    return 0;
+}
+
+void joinThread(Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// -----------------------------------------------------------------------
+//    --- Locks and condition variables ---
+// -----------------------------------------------------------------------
+
+#ifdef _WIN32
+void initMutex(Mutex* m) { InitializeCriticalSection(m); }
+void destroyMutex(Mutex* m) { DeleteCriticalSection(m); }
+void lockMutex(Mutex* m) { EnterCriticalSection(m); }
+void unlockMutex(Mutex* m) { LeaveCriticalSection(m); }
+
+void initCondVar(CondVar* c) { InitializeConditionVariable(c); }
+void destroyCondVar(CondVar* c) { (void)c; }
+void waitCondVar(CondVar* c, Mutex* m) { SleepConditionVariableCS(c, m, INFINITE); }
+void signalCondVar(CondVar* c) { WakeConditionVariable(c); }
+void broadcastCondVar(CondVar* c) { WakeAllConditionVariable(c); }
+#else
+void initMutex(Mutex* m) { pthread_mutex_init(m, NULL); }
+void destroyMutex(Mutex* m) { pthread_mutex_destroy(m); }
+void lockMutex(Mutex* m) { pthread_mutex_lock(m); }
+void unlockMutex(Mutex* m) { pthread_mutex_unlock(m); }
+
+void initCondVar(CondVar* c) { pthread_cond_init(c, NULL); }
+void destroyCondVar(CondVar* c) { pthread_cond_destroy(c); }
+void waitCondVar(CondVar* c, Mutex* m) { pthread_cond_wait(c, m); }
+void signalCondVar(CondVar* c) { pthread_cond_signal(c); }
+void broadcastCondVar(CondVar* c) { pthread_cond_broadcast(c); }
+#endif
+
+// -----------------------------------------------------------------------
+//    --- System information and time ---
+// -----------------------------------------------------------------------
+
+int processorCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int n = (int)info.dwNumberOfProcessors;
+#else
+    int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (n > 0) ? n : 1;
+}
+
+double wallSeconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+// -----------------------------------------------------------------------
+//    --- Files ---
+// -----------------------------------------------------------------------
+
+int fileStamp(const char* path, long long* mtime_ns, long long* size) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) {
+        return 1;
+    }
+    *mtime_ns = (long long)(((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) |
+                            data.ftLastWriteTime.dwLowDateTime) * 100;   // FILETIME counts 100 ns steps
+    *size = (long long)(((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow);
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 1;
+    }
+    *mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    *size = (long long)st.st_size;
+#endif
+    return 0;
+}
+
+void sleepMilliseconds(int ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// -----------------------------------------------------------------------
+//    --- Memory ---
+// -----------------------------------------------------------------------
+
+long long peakResidentBytes(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return (long long)counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss;                                  // already in bytes
+#else
+    return (long long)usage.ru_maxrss * 1024;                           // kilobytes on Linux
+#endif
+#endif
+}
@@ -0,0 +1,54 @@
+﻿#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// -----------------------------------------------------------------------
+//  Minimal portability layer: threads, locks, condition variables, a
+//  monotonic clock, file polling and peak memory use on top of Win32 or
+//  POSIX.
+// -----------------------------------------------------------------------
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE CondVar;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#endif
+
+typedef void (*ThreadFunc)(void* arg);
+
+// Start fn(arg) on a new thread - return 0 on success
+int startThread(Thread* thread, ThreadFunc fn, void* arg);
+void joinThread(Thread thread);
+
+void initMutex(Mutex* m);
+void destroyMutex(Mutex* m);
+void lockMutex(Mutex* m);
+void unlockMutex(Mutex* m);
+
+void initCondVar(CondVar* c);
+void destroyCondVar(CondVar* c);
+void waitCondVar(CondVar* c, Mutex* m);                                 // m must be locked
+void signalCondVar(CondVar* c);
+void broadcastCondVar(CondVar* c);
+
+// Number of logical processors (at least 1)
+int processorCount(void);
+
+// Monotonic wall-clock time in seconds
+double wallSeconds(void);
+
+// Last-modified time and size of a file, for change polling - return 0 on success
+int fileStamp(const char* path, long long* mtime_ns, long long* size);
+
+void sleepMilliseconds(int ms);
+
+// Peak resident set size of this process so far, in bytes (0 if unknown)
+long long peakResidentBytes(void);
+
+#endif // PLATFORM_H
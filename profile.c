@@ -0,0 +1,379 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "simulator.h"
+#include "profile.h"
+
+// -----------------------------------------------------------------------
+//    --- Source map ---
+// -----------------------------------------------------------------------
+
+static char* copyText(const char* s, size_t len) {
+    char* out = malloc(len + 1);
+    if (out) {
+        memcpy(out, s, len);
+        out[len] = '\0';
+    }
+    return out;
+}
+
+static int compareMapLabels(const void* a, const void* b) {
+    const MapLabel* x = a;
+    const MapLabel* y = b;
+    if (x->address != y->address) {
+        return (x->address < y->address) ? -1 : 1;
+    }
+    return (x->line_num > y->line_num) - (x->line_num < y->line_num);
+}
+
+int readSourceMap(const char* filename, SourceMap* map) {
+    memset(map, 0, sizeof(*map));
+    size_t len = 0;
+    char* text = readFileBytes(filename, &len);
+    if (!text) {
+        return 1;
+    }
+
+    int failed = 0;
+    int label_cap = 0;
+    int line_num = 0;
+    char line[512];
+    for (size_t pos = 0; pos < len && !failed; ) {
+        const char* nl = memchr(text + pos, '\n', len - pos);
+        size_t end = nl ? (size_t)(nl - text) : len;
+        size_t n = end - pos;
+        if (n > 0 && text[end - 1] == '\r') {
+            n--;
+        }
+        if (n >= sizeof(line)) {
+            n = sizeof(line) - 1;                                       // overlong names are cut
+        }
+        memcpy(line, text + pos, n);
+        line[n] = '\0';
+        pos = end + 1;
+        line_num++;
+
+        int a, b, c, name_at = 0;
+        if (line_num == 1) {
+            failed = (strcmp(line, "SIMPMAP 1") != 0);
+        }
+        else if (strncmp(line, "source ", 7) == 0) {
+            free(map->source);
+            map->source = copyText(line + 7, strlen(line + 7));
+        }
+        else if (sscanf(line, "label %d %d %n", &a, &b, &name_at) == 2 && name_at > 0) {
+            if (map->label_count == label_cap) {
+                label_cap = label_cap ? label_cap * 2 : 64;
+                MapLabel* grown = realloc(map->labels, (size_t)label_cap * sizeof(MapLabel));
+                if (!grown) {
+                    failed = 1;
+                    break;
+                }
+                map->labels = grown;
+            }
+            MapLabel* lab = &map->labels[map->label_count++];
+            lab->address = a;
+            lab->line_num = b;
+            lab->name = copyText(line + name_at, strlen(line + name_at));
+        }
+        else if (sscanf(line, "inst %d %d %d", &a, &b, &c) == 3) {
+            if (a >= 0 && a < MEM_SIZE) {
+                map->line_of[a] = c;
+            }
+            if (a + b > map->code_end) {
+                map->code_end = a + b;
+            }
+        }
+        else if (line[0] != '\0') {
+            failed = 1;                                                 // not a map line
+        }
+    }
+    free(text);
+
+    if (failed) {
+        freeSourceMap(map);
+        return 1;
+    }
+    if (map->label_count > 1) {
+        qsort(map->labels, (size_t)map->label_count, sizeof(MapLabel), compareMapLabels);
+    }
+    return 0;
+}
+
+void freeSourceMap(SourceMap* map) {
+    for (int i = 0; i < map->label_count; i++) {
+        free(map->labels[i].name);
+    }
+    free(map->labels);
+    free(map->source);
+    memset(map, 0, sizeof(*map));
+}
+
+// -----------------------------------------------------------------------
+//    --- Flat profile ---
+// -----------------------------------------------------------------------
+
+typedef struct {
+    const char* name;
+    int is_label;                                                       // 0 for "(start)" / "(data)"
+    int first, end;                                                     // addresses [first, end)
+    int line_num;
+    uint64_t exec, cycles;
+    uint64_t branches, taken;
+    uint64_t loads, stores;                                             // data accesses into the range
+} ProfileRegion;
+
+static int isBranch(int opcode) {
+    return opcode >= OP_BEQ && opcode <= OP_BGE;
+}
+
+// Append a region starting at first - return the new count. Labels on the
+// address of an earlier label share its region; a label replaces the
+// "(start)" / "(data)" stand-in on its address.
+static int startRegion(ProfileRegion* regions, int count, const char* name, int first, int line_num, int is_label) {
+    ProfileRegion* last = count ? &regions[count - 1] : NULL;
+    if (last && last->first == first) {
+        if (!last->is_label && is_label) {
+            last->name = name;
+            last->line_num = line_num;
+            last->is_label = 1;
+        }
+        return count;
+    }
+    regions[count].name = name;
+    regions[count].is_label = is_label;
+    regions[count].first = first;
+    regions[count].line_num = line_num;
+    return count + 1;
+}
+
+static int compareRegions(const void* a, const void* b) {
+    const ProfileRegion* x = a;
+    const ProfileRegion* y = b;
+    if (x->cycles != y->cycles) {
+        return (x->cycles > y->cycles) ? -1 : 1;                        // hottest first
+    }
+    uint64_t xd = x->loads + x->stores, yd = y->loads + y->stores;
+    if (xd != yd) {
+        return (xd > yd) ? -1 : 1;
+    }
+    return x->first - y->first;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+// Name of the label region holding addr, as "LABEL+off" (or "-" without one)
+static void describeAddress(char* out, size_t size, const SourceMap* map, int addr) {
+    const MapLabel* best = NULL;
+    for (int i = 0; map && i < map->label_count && map->labels[i].address <= addr; i++) {
+        best = &map->labels[i];
+    }
+    if (best && addr >= map->code_end && best->address < map->code_end) {
+        best = NULL;                                                    // data past the code belongs to no code label
+    }
+    if (best && addr > best->address) {
+        snprintf(out, size, "%s+%d", best->name, addr - best->address);
+    }
+    else if (best) {
+        snprintf(out, size, "%s", best->name);
+    }
+    else {
+        snprintf(out, size, "-");
+    }
+}
+
+void printLabelProfile(FILE* out, const SimState* sim, const SourceMap* map) {
+    const SimProfile* prof = sim->profile;
+    ProfileRegion* regions = calloc((size_t)(map ? map->label_count + 2 : MEM_SIZE), sizeof(ProfileRegion));   // + "(start)" and "(data)"
+    if (!regions) {
+        return;
+    }
+
+    // --- Cut the address space at the labels (or at every address) ----
+    int count = 0;
+    if (map) {
+        count = startRegion(regions, count, "(start)", 0, 0, 0);        // code before the first label
+        int data_started = 0;
+        for (int i = 0; i < map->label_count && map->labels[i].address < MEM_SIZE; i++) {
+            const MapLabel* lab = &map->labels[i];
+            if (!data_started && lab->address >= map->code_end) {
+                count = startRegion(regions, count, "(data)", map->code_end, 0, 0);
+                data_started = 1;
+            }
+            count = startRegion(regions, count, lab->name, lab->address, lab->line_num, 1);
+        }
+        if (!data_started && map->code_end < MEM_SIZE) {
+            count = startRegion(regions, count, "(data)", map->code_end, 0, 0);
+        }
+        for (int r = 0; r < count; r++) {
+            regions[r].end = (r + 1 < count) ? regions[r + 1].first : MEM_SIZE;
+        }
+    }
+    else {
+        for (int a = 0; a < MEM_SIZE; a++) {
+            regions[count].name = NULL;
+            regions[count].first = a;
+            regions[count].end = a + 1;
+            count++;
+        }
+    }
+
+    uint64_t total_cycles = 0;
+    for (int r = 0; r < count; r++) {
+        ProfileRegion* reg = &regions[r];
+        for (int a = reg->first; a < reg->end; a++) {
+            reg->exec += prof->exec[a];
+            reg->cycles += prof->cycles[a];
+            reg->loads += prof->loads[a];
+            reg->stores += prof->stores[a];
+            if (prof->exec[a] && isBranch(sim->code[a].opcode)) {
+                reg->branches += prof->exec[a];
+                reg->taken += prof->taken[a];
+            }
+        }
+        total_cycles += reg->cycles;
+    }
+    qsort(regions, (size_t)count, sizeof(ProfileRegion), compareRegions);
+
+    fprintf(out, "Flat profile (%llu cycles):\n", (unsigned long long)total_cycles);
+    fprintf(out, "%14s %7s %14s %12s %7s %12s %12s  %s\n",
+        "cycles", "%", "instructions", "branches", "taken", "loads", "stores", map ? "label (line)" : "address");
+    for (int r = 0; r < count; r++) {
+        const ProfileRegion* reg = &regions[r];
+        if (reg->exec == 0 && reg->loads == 0 && reg->stores == 0) {
+            continue;
+        }
+        fprintf(out, "%14llu %6.2f%% %14llu %12llu ", (unsigned long long)reg->cycles,
+            percent(reg->cycles, total_cycles), (unsigned long long)reg->exec, (unsigned long long)reg->branches);
+        if (reg->branches) {
+            fprintf(out, "%6.1f%% ", percent(reg->taken, reg->branches));
+        }
+        else {
+            fprintf(out, "%7s ", "-");
+        }
+        fprintf(out, "%12llu %12llu  ", (unsigned long long)reg->loads, (unsigned long long)reg->stores);
+        if (reg->is_label) {
+            fprintf(out, "%s (%d)\n", reg->name, reg->line_num);
+        }
+        else if (reg->name) {
+            fprintf(out, "%s\n", reg->name);
+        }
+        else {
+            fprintf(out, "0x%03X\n", (unsigned)reg->first);
+        }
+    }
+    free(regions);
+
+    // --- Hottest data addresses -----------------------------------------
+    enum { HOT_DATA = 10 };
+    int hot[HOT_DATA];
+    int hot_count = 0;
+    for (int a = 0; a < MEM_SIZE; a++) {                                // keep the HOT_DATA busiest, busiest first
+        uint64_t uses = prof->loads[a] + prof->stores[a];
+        if (uses == 0) {
+            continue;
+        }
+        int at = hot_count;
+        while (at > 0 && prof->loads[hot[at - 1]] + prof->stores[hot[at - 1]] < uses) {
+            at--;
+        }
+        if (at >= HOT_DATA) {
+            continue;
+        }
+        if (hot_count < HOT_DATA) {
+            hot_count++;
+        }
+        memmove(&hot[at + 1], &hot[at], (size_t)(hot_count - 1 - at) * sizeof(int));
+        hot[at] = a;
+    }
+    if (hot_count > 0) {
+        fprintf(out, "\nHottest data addresses:\n%8s %12s %12s  %s\n", "address", "loads", "stores", "label");
+        for (int i = 0; i < hot_count; i++) {
+            char where[96];
+            describeAddress(where, sizeof(where), map, hot[i]);
+            fprintf(out, "   0x%03X %12llu %12llu  %s\n", (unsigned)hot[i],
+                (unsigned long long)prof->loads[hot[i]], (unsigned long long)prof->stores[hot[i]], where);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+//    --- Annotated listing ---
+// -----------------------------------------------------------------------
+
+int writeAnnotatedListing(const char* filename, const SimState* sim, const SourceMap* map, const char* src, size_t len) {
+    const SimProfile* prof = sim->profile;
+
+    // --- Counters per source line -----------------------------------------
+    int lines = 1;
+    for (size_t i = 0; i < len; i++) {
+        lines += (src[i] == '\n');
+    }
+    uint64_t* exec = calloc((size_t)lines + 1, sizeof(uint64_t));
+    uint64_t* cycles = calloc((size_t)lines + 1, sizeof(uint64_t));
+    uint64_t* branches = calloc((size_t)lines + 1, sizeof(uint64_t));
+    uint64_t* taken = calloc((size_t)lines + 1, sizeof(uint64_t));
+    FILE* file = (strcmp(filename, "-") == 0) ? stdout : fopen(filename, "w");
+    int failed = !exec || !cycles || !branches || !taken || !file;
+
+    uint64_t total_cycles = 0;
+    for (int a = 0; a < MEM_SIZE && !failed; a++) {
+        total_cycles += prof->cycles[a];
+        int n = map->line_of[a];
+        if (n <= 0 || n > lines) {
+            continue;                                                   // not an instruction start of this source
+        }
+        exec[n] += prof->exec[a];
+        cycles[n] += prof->cycles[a];
+        if (isBranch(sim->code[a].opcode)) {
+            branches[n] += prof->exec[a];
+            taken[n] += prof->taken[a];
+        }
+    }
+
+    if (!failed) {
+        fprintf(file, "# %s - %llu instructions, %llu cycles\n", map->source ? map->source : "source",
+            (unsigned long long)sim->instructions, (unsigned long long)sim->cycles);
+        fprintf(file, "# %12s %7s %7s |\n", "executed", "cycles", "taken");
+        const char* p = src;
+        const char* end = src + len;
+        for (int n = 1; p < end; n++) {
+            const char* nl = memchr(p, '\n', (size_t)(end - p));
+            const char* line_end = nl ? nl : end;
+            int text_len = (int)(line_end - p);
+            if (text_len > 0 && p[text_len - 1] == '\r') {
+                text_len--;
+            }
+            if (exec[n] || cycles[n]) {
+                fprintf(file, "  %12llu %6.2f%% ", (unsigned long long)exec[n], percent(cycles[n], total_cycles));
+                if (branches[n]) {
+                    fprintf(file, "%6.1f%% | ", percent(taken[n], branches[n]));
+                }
+                else {
+                    fprintf(file, "%7s | ", "");
+                }
+            }
+            else {
+                fprintf(file, "  %12s %7s %7s | ", "", "", "");
+            }
+            fprintf(file, "%.*s\n", text_len, p);
+            p = nl ? nl + 1 : end;
+        }
+    }
+
+    if (file && file != stdout) {
+        failed |= ferror(file);
+        failed |= (fclose(file) != 0);
+    }
+    free(exec);
+    free(cycles);
+    free(branches);
+    free(taken);
+    return failed;
+}
@@ -0,0 +1,40 @@
+﻿#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "simulator.h"
+
+// -----------------------------------------------------------------------
+//  Profiler reports. The assembler's --map writes which source line and
+//  label every instruction address came from; with it the per-address
+//  counters of a SimProfile become a flat per-label profile and an
+//  annotated source listing. Without a map the profile is per address.
+// -----------------------------------------------------------------------
+
+typedef struct {
+    int address;
+    int line_num;
+    char* name;
+} MapLabel;
+
+typedef struct {
+    char* source;                                                       // source file the map was written for
+    MapLabel* labels;                                                   // sorted by address, then line
+    int label_count;
+    int line_of[MEM_SIZE];                                              // source line of the instruction starting here, 0 = none
+    int code_end;                                                       // one past the last instruction word
+} SourceMap;
+
+// Read a map written by the assembler's --map - return 0 on success
+int readSourceMap(const char* filename, SourceMap* map);
+void freeSourceMap(SourceMap* map);
+
+// Flat profile, hottest first: per label with a map (else per address),
+// then the most used data addresses
+void printLabelProfile(FILE* out, const SimState* sim, const SourceMap* map);
+
+// Write src[0..len) with execution counts, cycle shares and branch
+// outcomes next to every line ("-" = stdout) - return 0 on success
+int writeAnnotatedListing(const char* filename, const SimState* sim, const SourceMap* map, const char* src, size_t len);
+
+#endif // PROFILE_H
@@ -0,0 +1,542 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "simulator.h"
+#include "platform.h"
+#include "profile.h"
+#include "trace.h"
+#include "devices.h"
+#include "snapshot.h"
+
+// -----------------------------------------------------------------------
+//    --- Command-line front end for the SIMP simulator ---
+// -----------------------------------------------------------------------
+
+#define MAX_POKES 256                                                   // --poke and --peek options each
+
+static void printUsage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options] <memin> [memout]\n", prog);
+    fprintf(stderr, "       %s [options] --resume <snapshot> [memout]\n", prog);
+    fprintf(stderr, "       %s --trace-text <trace> [textout]\n", prog);
+    fprintf(stderr, "  --max N          stop after N instructions (default: run until halt)\n");
+    fprintf(stderr, "  --regs           print the registers when the run ends\n");
+    fprintf(stderr, "  --interpret      one instruction at a time, without the basic-block cache\n");
+    fprintf(stderr, "  --binary         write memout as little-endian 32-bit words\n");
+    fprintf(stderr, "  --trim           stop memout after the last non-zero word\n");
+    fprintf(stderr, "  --sparse         write memout and diskout as their non-zero words, each run after an\n");
+    fprintf(stderr, "                   \"@<hex address>\" line (memin and diskin may be sparse too)\n");
+    fprintf(stderr, "  --diskin FILE    disk contents at start (%d words, same formats as memin)\n", SIM_DISK_WORDS);
+    fprintf(stderr, "  --diskout FILE   disk contents at the end\n");
+    fprintf(stderr, "  --irq2in FILE    cycles at which irq2 is raised, one per line, ascending\n");
+    fprintf(stderr, "  --monitor FILE   monitor pixels at the end, 2 hex digits per line\n");
+    fprintf(stderr, "  --leds FILE      log every change of the leds register as \"cycle value\"\n");
+    fprintf(stderr, "  --display7seg FILE  the same for the 7-segment display\n");
+    fprintf(stderr, "  --profile        count executions, branch outcomes and memory accesses per\n");
+    fprintf(stderr, "                   address and print a flat profile (per label with --map)\n");
+    fprintf(stderr, "  --map FILE       source map written by the assembler's --map\n");
+    fprintf(stderr, "  --listing FILE   with --profile and --map: the source annotated with counts (- = stdout)\n");
+    fprintf(stderr, "  --source FILE    source for the listing (default: the file named in the map)\n");
+    fprintf(stderr, "  --trace FILE     write a compact binary trace of every instruction\n");
+    fprintf(stderr, "  --trace-text     expand a binary trace into PC INST R0..R15 lines (default: stdout)\n");
+    fprintf(stderr, "  --snapshot FILE  save the machine state when the run ends (with --max: a checkpoint)\n");
+    fprintf(stderr, "  --resume FILE    start from a saved snapshot instead of memin\n");
+    fprintf(stderr, "  --poke ADDR=VAL  store VAL at ADDR before running (repeatable)\n");
+    fprintf(stderr, "  --peek ADDR      print the word at ADDR when the run ends (repeatable)\n");
+    fprintf(stderr, "  --batch FILE     one run per line of FILE, each from the starting state with the\n");
+    fprintf(stderr, "                   line's ADDR=VAL pokes applied; prints a line per run\n");
+}
+
+// Print the profile reports once the run is over - return 0 on success
+static int reportProfile(const SimState* sim, const char* map_filename, const char* listing_filename,
+                         const char* source_filename) {
+    SourceMap* map = NULL;
+    if (map_filename) {
+        map = malloc(sizeof(SourceMap));
+        if (!map || readSourceMap(map_filename, map)) {
+            fprintf(stderr, "Couldn't read source map %s\n", map_filename);
+            free(map);
+            return 1;
+        }
+    }
+    printf("\n");
+    printLabelProfile(stdout, sim, map);
+
+    int failed = 0;
+    if (listing_filename && map) {
+        const char* src_name = source_filename ? source_filename : map->source;
+        size_t len = 0;
+        char* src = src_name ? readSourceFile(src_name, &len) : NULL;
+        if (!src) {
+            fprintf(stderr, "Couldn't open source %s for the listing\n", src_name ? src_name : "(none in the map)");
+            failed = 1;
+        }
+        else if (writeAnnotatedListing(listing_filename, sim, map, src, len)) {
+            fprintf(stderr, "Couldn't write listing %s\n", listing_filename);
+            failed = 1;
+        }
+        free(src);
+    }
+    if (map) {
+        freeSourceMap(map);
+        free(map);
+    }
+    return failed;
+}
+
+// Device files named on the command line, NULL = not used
+typedef struct {
+    const char* diskin;
+    const char* diskout;
+    const char* irq2in;
+    const char* monitor;
+    const char* leds;
+    const char* display;
+} DeviceFiles;
+
+// Load the disk and irq2 inputs and open the logs - return 0 on success.
+// *irq2 must stay allocated while sim runs.
+static int openDevices(SimState* sim, const DeviceFiles* files, uint64_t** irq2) {
+    int count = 0;
+    if (files->diskin && readMemoryImage(files->diskin, sim->dev.disk, SIM_DISK_WORDS, &count)) {
+        fprintf(stderr, "Couldn't read disk image %s (at most %d words)\n", files->diskin, SIM_DISK_WORDS);
+        return 1;
+    }
+    if (files->irq2in) {
+        *irq2 = readIrq2File(files->irq2in, &count);
+        if (!*irq2) {
+            fprintf(stderr, "Couldn't read %s (expected ascending cycle numbers)\n", files->irq2in);
+            return 1;
+        }
+        setIrq2Cycles(sim, *irq2, count);
+    }
+    if (files->leds && !(sim->dev.leds_log = fopen(files->leds, "w"))) {
+        fprintf(stderr, "Couldn't create %s\n", files->leds);
+        return 1;
+    }
+    if (files->display && !(sim->dev.display_log = fopen(files->display, "w"))) {
+        fprintf(stderr, "Couldn't create %s\n", files->display);
+        return 1;
+    }
+    return 0;
+}
+
+// Close the logs and write the disk (like memout) and monitor outputs - return 0 on success
+static int closeDevices(SimState* sim, const DeviceFiles* files, ImageFormat format, int trim_image) {
+    int failed = 0;
+    FILE* logs[2] = { sim->dev.leds_log, sim->dev.display_log };
+    const char* names[2] = { files->leds, files->display };
+    for (int i = 0; i < 2; i++) {
+        if (logs[i]) {
+            int bad = ferror(logs[i]);
+            bad |= (fclose(logs[i]) != 0);
+            if (bad) {
+                fprintf(stderr, "Couldn't write %s\n", names[i] ? names[i] : "log");
+                failed = 1;
+            }
+        }
+    }
+    sim->dev.leds_log = NULL;
+    sim->dev.display_log = NULL;
+    int disk_words = trim_image ? usedImageWords(sim->dev.disk, SIM_DISK_WORDS) : SIM_DISK_WORDS;
+    if (files->diskout && writeMemoryImage(files->diskout, sim->dev.disk, disk_words, format)) {
+        fprintf(stderr, "Couldn't write disk image %s\n", files->diskout);
+        failed = 1;
+    }
+    if (files->monitor && writeMonitor(files->monitor, sim)) {
+        fprintf(stderr, "Couldn't write monitor %s\n", files->monitor);
+        failed = 1;
+    }
+    return failed;
+}
+
+// "ADDR=VALUE", both in C syntax - return 0 on success
+static int parsePoke(const char* text, uint32_t* addr, uint32_t* value) {
+    char* end = NULL;
+    unsigned long a = strtoul(text, &end, 0);
+    if (end == text || *end != '=' || a >= MEM_SIZE) {
+        return 1;
+    }
+    const char* v = end + 1;
+    long long n = strtoll(v, &end, 0);
+    if (end == v || *end != '\0') {
+        return 1;
+    }
+    *addr = (uint32_t)a;
+    *value = (uint32_t)n;
+    return 0;
+}
+
+static void printPeeks(const SimState* sim, const uint32_t* peeks, int count) {
+    for (int i = 0; i < count; i++) {
+        uint32_t v = sim->mem[peeks[i]];
+        printf("  [0x%03X] = 0x%08X (%d)", (unsigned)peeks[i], (unsigned)v, (int)(int32_t)v);
+    }
+}
+
+// One run per line of batch_filename, each restored to the state sim is in now - return 0 on success
+static int runBatch(SimState* sim, const char* batch_filename, uint64_t max_instructions, const uint32_t* peeks,
+                    int peek_count) {
+    size_t len = 0;
+    char* text = readFileBytes(batch_filename, &len);
+    Snapshot* start = text ? takeSnapshot(sim, NULL) : NULL;
+    if (!start) {
+        fprintf(stderr, text ? "Out of memory!\n" : "Couldn't read batch file %s\n", batch_filename);
+        free(text);
+        return 1;
+    }
+    static const char* const status_text[] = { "halted", "limit", "invalid opcode" };
+    int failed = 0;
+    int runs = 0;
+    uint64_t instructions = 0;
+    double begin = wallSeconds();
+    size_t pos = 0;
+    for (int line = 1; pos < len && !failed; line++) {
+        size_t eol = pos;
+        while (eol < len && text[eol] != '\n') {
+            eol++;
+        }
+        restoreSnapshot(sim, start);                                    // copies back only what the last run wrote
+        int pokes = 0;
+        while (pos < eol) {
+            while (pos < eol && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r')) {
+                pos++;
+            }
+            size_t word = pos;
+            while (pos < eol && text[pos] != ' ' && text[pos] != '\t' && text[pos] != '\r') {
+                pos++;
+            }
+            if (pos == word) {
+                break;
+            }
+            char token[64];
+            uint32_t addr = 0;
+            uint32_t value = 0;
+            size_t n = pos - word;
+            if (n >= sizeof(token)) {
+                n = sizeof(token) - 1;                                  // too long to be valid anyway
+            }
+            memcpy(token, text + word, n);
+            token[n] = '\0';
+            if (parsePoke(token, &addr, &value)) {
+                fprintf(stderr, "%s:%d: expected ADDR=VALUE, got %s\n", batch_filename, line, token);
+                failed = 1;
+                break;
+            }
+            storeWord(sim, addr, value);
+            pokes++;
+        }
+        pos = eol + 1;
+        if (failed || pokes == 0) {
+            continue;                                                   // blank line
+        }
+        uint64_t before = sim->instructions;
+        SimStatus status = runSimulator(sim, max_instructions);
+        instructions += sim->instructions - before;
+        runs++;
+        printf("line %d: %s at pc 0x%03X after %llu instructions (%llu cycles)", line, status_text[status],
+               (unsigned)sim->pc, (unsigned long long)sim->instructions, (unsigned long long)sim->cycles);
+        printPeeks(sim, peeks, peek_count);
+        printf("\n");
+        failed = (status == SIM_BAD_OPCODE);
+    }
+    double seconds = wallSeconds() - begin;
+    printf("Batch of %d runs (%llu instructions) in %.3f ms: %.1f MIPS\n", runs, (unsigned long long)instructions,
+           seconds * 1000.0, seconds > 0 ? (double)instructions / seconds / 1e6 : 0.0);
+    freeSnapshot(start);
+    free(text);
+    return failed;
+}
+
+static void printRegisters(const SimState* sim) {
+    for (int r = 2; r < NUM_REGS; r++) {                                // $zero and $imm hold nothing worth showing
+        printf("%-5s = 0x%08X (%d)\n", reg_table[r], (unsigned)sim->regs[r], (int)(int32_t)sim->regs[r]);
+    }
+}
+
+int main(int argc, char** argv) {
+
+    // -----------------------------------------------------------------------
+    //    --- Parse the command line ---
+    // -----------------------------------------------------------------------
+
+    const char* in_filename = NULL;
+    const char* out_filename = NULL;
+    unsigned long long max_instructions = 0;                            // 0 = until halt
+    int print_regs = 0;
+    int interpret = 0;
+    ImageFormat out_format = IMAGE_TEXT;
+    int trim_image = 0;
+    int profile = 0;
+    const char* map_filename = NULL;
+    const char* listing_filename = NULL;
+    const char* source_filename = NULL;
+    const char* trace_filename = NULL;
+    int trace_text = 0;
+    const char* snapshot_filename = NULL;
+    const char* resume_filename = NULL;
+    const char* batch_filename = NULL;
+    uint32_t pokes[MAX_POKES][2];                                       // address, value
+    uint32_t peeks[MAX_POKES];
+    int poke_count = 0;
+    int peek_count = 0;
+    DeviceFiles devices = { 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            max_instructions = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--regs") == 0) {
+            print_regs = 1;
+        }
+        else if (strcmp(argv[i], "--interpret") == 0) {
+            interpret = 1;
+        }
+        else if (strcmp(argv[i], "--binary") == 0) {
+            out_format = IMAGE_BINARY;
+        }
+        else if (strcmp(argv[i], "--trim") == 0) {
+            trim_image = 1;
+        }
+        else if (strcmp(argv[i], "--sparse") == 0) {
+            out_format = IMAGE_SPARSE;
+        }
+        else if (strcmp(argv[i], "--diskin") == 0 && i + 1 < argc) {
+            devices.diskin = argv[++i];
+        }
+        else if (strcmp(argv[i], "--diskout") == 0 && i + 1 < argc) {
+            devices.diskout = argv[++i];
+        }
+        else if (strcmp(argv[i], "--irq2in") == 0 && i + 1 < argc) {
+            devices.irq2in = argv[++i];
+        }
+        else if (strcmp(argv[i], "--monitor") == 0 && i + 1 < argc) {
+            devices.monitor = argv[++i];
+        }
+        else if (strcmp(argv[i], "--leds") == 0 && i + 1 < argc) {
+            devices.leds = argv[++i];
+        }
+        else if (strcmp(argv[i], "--display7seg") == 0 && i + 1 < argc) {
+            devices.display = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        }
+        else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+            map_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--listing") == 0 && i + 1 < argc) {
+            listing_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+            source_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace-text") == 0) {
+            trace_text = 1;
+        }
+        else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--poke") == 0 && i + 1 < argc && poke_count < MAX_POKES) {
+            if (parsePoke(argv[++i], &pokes[poke_count][0], &pokes[poke_count][1])) {
+                fprintf(stderr, "--poke expects ADDR=VALUE with ADDR below %d, got %s\n", MEM_SIZE, argv[i]);
+                return 1;
+            }
+            poke_count++;
+        }
+        else if (strcmp(argv[i], "--peek") == 0 && i + 1 < argc && peek_count < MAX_POKES) {
+            peeks[peek_count++] = (uint32_t)strtoul(argv[++i], NULL, 0) & SIM_ADDR_MASK;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 1;
+        }
+        else if (!in_filename) {
+            in_filename = argv[i];
+        }
+        else if (!out_filename) {
+            out_filename = argv[i];
+        }
+    }
+    if (resume_filename && !out_filename) {                            // the snapshot stands in for <memin>
+        out_filename = in_filename;
+        in_filename = NULL;
+    }
+    // A batch run leaves nothing behind but its lines; a resumed run has no trace start or disk image to load
+    int batch_conflict = batch_filename && (out_filename || profile || trace_filename || snapshot_filename ||
+                                            devices.diskout || devices.monitor || devices.leds || devices.display);
+    int resume_conflict = resume_filename && (in_filename || trace_filename || devices.diskin || trace_text);
+    if ((!in_filename && !resume_filename) || (listing_filename && (!profile || !map_filename)) ||
+        batch_conflict || resume_conflict) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (trace_text) {                                                   // <memin> is the trace, [memout] the text
+        FILE* out = out_filename ? fopen(out_filename, "w") : stdout;
+        if (!out) {
+            fprintf(stderr, "Couldn't create %s\n", out_filename);
+            return 1;
+        }
+        int status = convertTrace(in_filename, out);
+        if (out != stdout && fclose(out) != 0 && status == 0) {
+            status = 2;
+        }
+        if (status == 1) {
+            fprintf(stderr, "Couldn't read trace %s\n", in_filename);
+        }
+        else if (status == 2) {
+            fprintf(stderr, "Couldn't write %s\n", out_filename ? out_filename : "the trace text");
+        }
+        return status != 0;
+    }
+
+    // -----------------------------------------------------------------------
+    //    --- Load, predecode and run ---
+    // -----------------------------------------------------------------------
+
+    uint32_t* image = malloc(MEM_SIZE * sizeof(uint32_t));
+    SimState* sim = malloc(sizeof(SimState));                           // too big for the stack
+    SimProfile* counters = profile ? calloc(1, sizeof(SimProfile)) : NULL;
+    if (!image || !sim || (profile && !counters)) {
+        fprintf(stderr, "Out of memory!\n");
+        free(image);
+        free(sim);
+        free(counters);
+        return 1;
+    }
+    int count = 0;
+    Snapshot* resume = NULL;
+    if (resume_filename) {
+        resume = loadSnapshot(resume_filename);
+        if (!resume) {
+            fprintf(stderr, "Couldn't read snapshot %s\n", resume_filename);
+            free(image);
+            free(sim);
+            free(counters);
+            return 1;
+        }
+    }
+    else if (readMemoryImage(in_filename, image, MEM_SIZE, &count)) {
+        fprintf(stderr, "Couldn't read memory image %s (expected 32-digit binary lines or 32-bit words, at most %d)\n",
+                in_filename, MEM_SIZE);
+        free(image);
+        free(sim);
+        free(counters);
+        return 1;
+    }
+
+    initSimulator(sim, image, count);
+    sim->profile = counters;
+    sim->interpret = interpret;
+    uint64_t* irq2 = NULL;
+    int setup_failed = openDevices(sim, &devices, &irq2);
+    if (resume) {
+        restoreSnapshot(sim, resume);                                   // after setIrq2Cycles: its position in irq2in wins
+        freeSnapshot(resume);
+    }
+    for (int i = 0; i < poke_count; i++) {
+        storeWord(sim, pokes[i][0], pokes[i][1]);
+    }
+    if (!setup_failed && trace_filename) {
+        sim->trace = openTrace(trace_filename);
+        if (!sim->trace) {
+            fprintf(stderr, "Couldn't create trace %s\n", trace_filename);
+            setup_failed = 1;
+        }
+    }
+    if (setup_failed) {
+        closeDevices(sim, &(DeviceFiles){ 0 }, out_format, trim_image); // just the logs
+        free(irq2);
+        free(image);
+        free(sim);
+        free(counters);
+        return 1;
+    }
+    if (batch_filename) {
+        int failed = runBatch(sim, batch_filename, max_instructions, peeks, peek_count);
+        failed |= closeDevices(sim, &devices, out_format, trim_image);
+        free(irq2);
+        free(image);
+        free(sim);
+        free(counters);
+        return failed;
+    }
+    uint64_t resumed_at = sim->instructions;                            // executed before the snapshot, if resuming
+    double start = wallSeconds();
+    SimStatus status = runSimulator(sim, max_instructions);
+    uint64_t trace_records = 0;
+    uint64_t trace_bytes = 0;
+    int trace_failed = 0;
+    if (sim->trace) {                                                   // the writer drains before the clock stops
+        trace_records = sim->trace->records;
+        trace_failed = closeTrace(sim->trace, &trace_bytes);
+        sim->trace = NULL;
+    }
+    double seconds = wallSeconds() - start;
+
+    static const char* const status_text[] = { "halted", "stopped at the instruction limit", "hit an invalid opcode" };
+    printf("Simulation %s at pc 0x%03X after %llu instructions (%llu cycles) in %.3f ms: %.1f MIPS\n",
+           status_text[status], (unsigned)sim->pc, (unsigned long long)sim->instructions,
+           (unsigned long long)sim->cycles, seconds * 1000.0,
+           seconds > 0 ? (double)(sim->instructions - resumed_at) / seconds / 1e6 : 0.0);
+    if (sim->skipped_cycles) {
+        printf("Idle loops fast-forwarded through %llu cycles\n", (unsigned long long)sim->skipped_cycles);
+    }
+    if (trace_filename) {
+        printf("Trace %s: %llu records, %llu bytes (%.2f bytes per instruction)\n", trace_filename,
+               (unsigned long long)trace_records, (unsigned long long)trace_bytes,
+               trace_records ? (double)trace_bytes / (double)trace_records : 0.0);
+    }
+    if (print_regs) {
+        printRegisters(sim);
+    }
+    if (peek_count) {
+        printf("Memory:");
+        printPeeks(sim, peeks, peek_count);
+        printf("\n");
+    }
+
+    int failed = (status == SIM_BAD_OPCODE) || trace_failed;
+    if (trace_failed) {
+        fprintf(stderr, "Couldn't write trace %s\n", trace_filename);
+    }
+    if (profile) {
+        failed |= reportProfile(sim, map_filename, listing_filename, source_filename);
+    }
+    if (out_filename) {
+        int out_words = trim_image ? usedImageWords(sim->mem, MEM_SIZE) : MEM_SIZE;
+        if (writeMemoryImage(out_filename, sim->mem, out_words, out_format)) {
+            fprintf(stderr, "Couldn't write memory image %s\n", out_filename);
+            failed = 1;
+        }
+    }
+    if (snapshot_filename) {
+        Snapshot* snap = takeSnapshot(sim, NULL);
+        if (!snap || saveSnapshot(snapshot_filename, snap)) {
+            fprintf(stderr, "Couldn't write snapshot %s\n", snapshot_filename);
+            failed = 1;
+        }
+        freeSnapshot(snap);
+    }
+    failed |= closeDevices(sim, &devices, out_format, trim_image);
+
+    free(irq2);
+    free(image);
+    free(sim);
+    free(counters);
+    return failed;
+}
@@ -0,0 +1,97 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdint.h>
+#include <string.h>
+#include "simulator.h"
+#include "trace.h"
+#include "devices.h"
+#include "blocks.h"
+
+// -----------------------------------------------------------------------
+//    --- Predecode ---
+// -----------------------------------------------------------------------
+
+void predecodeWord(SimState* sim, uint32_t addr) {
+    addr &= SIM_ADDR_MASK;
+    uint32_t word = sim->mem[addr];
+    SimInst* inst = &sim->code[addr];
+    SimInst old = *inst;
+
+    uint32_t opcode = word >> 24;
+    inst->opcode = (uint8_t)(opcode < NUM_OPCODES ? opcode : SIM_OP_INVALID);
+    inst->rd = (uint8_t)((word >> 20) & 0xF);
+    inst->rs = (uint8_t)((word >> 16) & 0xF);
+    inst->rt = (uint8_t)((word >> 12) & 0xF);
+    inst->wd = (inst->rd > REG_IMM) ? inst->rd : SIM_REG_SINK;          // $zero and $imm ignore writes
+
+    if (word & (1u << 8)) {                                             // big_imm: the next word is the immediate
+        inst->imm = (int32_t)sim->mem[(addr + 1) & SIM_ADDR_MASK];
+        inst->words = 2;
+    }
+    else {
+        inst->imm = (int8_t)(word & 0xFF);                              // sign-extend imm8
+        inst->words = 1;
+    }
+    inst->next_pc = (uint16_t)((addr + inst->words) & SIM_ADDR_MASK);
+    if (sim->blocks.covered[addr] && memcmp(&old, inst, sizeof(old)) != 0) {
+        flushBlocks(&sim->blocks);                                      // self-modifying code: translate again
+    }
+}
+
+void storeWord(SimState* sim, uint32_t addr, uint32_t value) {
+    addr &= SIM_ADDR_MASK;
+    sim->mem[addr] = value;
+    sim->dirty[SIM_MEM_PAGE(addr)] = 1;
+    predecodeWord(sim, addr);                                           // the word may be code...
+    predecodeWord(sim, addr - 1);                                       // ...or the big_imm of the one before
+}
+
+void initSimulator(SimState* sim, const uint32_t* image, int count) {
+    memset(sim, 0, sizeof(*sim));
+    sim->next_event = SIM_NO_EVENT;
+    if (count > MEM_SIZE) {
+        count = MEM_SIZE;
+    }
+    memcpy(sim->mem, image, (size_t)count * sizeof(uint32_t));
+    for (uint32_t a = 0; a < MEM_SIZE; a++) {
+        predecodeWord(sim, a);
+    }
+}
+
+// -----------------------------------------------------------------------
+//    --- Run loop ---
+// -----------------------------------------------------------------------
+//  With GCC/Clang every handler jumps straight to the next one through a
+//  table of label addresses (computed goto), which gives the branch
+//  predictor one indirect jump per opcode. Other compilers get the same
+//  handlers as the cases of a switch. The handlers live in
+//  simulator_loop.h, compiled once plain and once with the profiling
+//  counters and trace hook, so a plain run pays nothing for them.
+
+#if defined(__GNUC__) && !defined(SIM_NO_COMPUTED_GOTO)
+#define SIM_COMPUTED_GOTO 1
+#else
+#define SIM_COMPUTED_GOTO 0
+#endif
+
+#define SIM_LOOP_NAME runPlain
+#define SIM_INSTRUMENTED 0
+#include "simulator_loop.h"
+
+#define SIM_LOOP_NAME runInstrumented
+#define SIM_INSTRUMENTED 1
+#include "simulator_loop.h"
+
+SimStatus runInterpreter(SimState* sim, uint64_t max_instructions) {
+    if (sim->profile || sim->trace) {
+        return runInstrumented(sim, max_instructions);
+    }
+    return runPlain(sim, max_instructions);
+}
+
+SimStatus runSimulator(SimState* sim, uint64_t max_instructions) {
+    if (sim->profile || sim->trace || sim->interpret) {
+        return runInterpreter(sim, max_instructions);                   // hooks see every instruction
+    }
+    return runBlocks(sim, max_instructions);
+}
@@ -0,0 +1,191 @@
+﻿#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "assembler.h"                                                  // MEM_SIZE, NUM_REGS, Opcode
+
+// -----------------------------------------------------------------------
+//  SIMP instruction-set simulator. Every memory word is decoded once
+//  into a SimInst; the run loop dispatches on the predecoded opcode and
+//  only decodes again when `sw` writes to memory.
+// -----------------------------------------------------------------------
+
+#define SIM_ADDR_MASK (MEM_SIZE - 1)                                    // addresses wrap (MEM_SIZE is a power of two)
+#define SIM_REG_SINK NUM_REGS                                           // writes to $zero / $imm land here
+#define SIM_OP_INVALID NUM_OPCODES                                      // opcode byte outside 0-21
+
+// IO registers used by `in` / `out`
+typedef enum {
+    IO_IRQ0ENABLE, IO_IRQ1ENABLE, IO_IRQ2ENABLE,
+    IO_IRQ0STATUS, IO_IRQ1STATUS, IO_IRQ2STATUS,
+    IO_IRQHANDLER, IO_IRQRETURN, IO_CLKS, IO_LEDS, IO_DISPLAY7SEG,
+    IO_TIMERENABLE, IO_TIMERCURRENT, IO_TIMERMAX,
+    IO_DISKCMD, IO_DISKSECTOR, IO_DISKBUFFER, IO_DISKSTATUS,
+    IO_RESERVED18, IO_RESERVED19,
+    IO_MONITORADDR, IO_MONITORDATA, IO_MONITORCMD,
+    SIM_NUM_IO_REGS
+} IoRegister;
+
+// One predecoded memory word
+typedef struct {
+    uint8_t opcode;                                                     // 0-21, or SIM_OP_INVALID
+    uint8_t rd, rs, rt;                                                 // register operands (rd as read by branches / sw / out)
+    uint8_t wd;                                                         // register written: rd, or SIM_REG_SINK for $zero / $imm
+    uint8_t words;                                                      // 1, or 2 with big_imm
+    uint16_t next_pc;                                                   // address of the following instruction
+    int32_t imm;                                                        // sign-extended imm8 or the big_imm word
+} SimInst;
+
+typedef enum {
+    SIM_HALTED,                                                         // executed `halt`
+    SIM_LIMIT,                                                          // instruction budget used up
+    SIM_BAD_OPCODE                                                      // opcode byte outside 0-21
+} SimStatus;
+
+typedef struct TraceWriter TraceWriter;                                 // trace.h
+
+// -----------------------------------------------------------------------
+//  Devices. Nothing is stepped per cycle: every device that will do
+//  something later (the timer reaching timermax, the disk finishing a
+//  transfer, the next irq2 line) has one event in a min-heap ordered by
+//  cycle, and the run loop only compares the cycle count with the
+//  earliest one. See devices.c.
+// -----------------------------------------------------------------------
+
+#define SIM_NO_EVENT UINT64_MAX
+#define SIM_DISK_SECTORS 128
+#define SIM_SECTOR_WORDS 128
+#define SIM_DISK_WORDS (SIM_DISK_SECTORS * SIM_SECTOR_WORDS)
+#define SIM_DISK_CYCLES 1024                                            // a read or write takes this long
+#define SIM_MONITOR_SIZE 256                                            // pixels per side, 8-bit grey
+#define SIM_MONITOR_PIXELS (SIM_MONITOR_SIZE * SIM_MONITOR_SIZE)
+
+typedef enum {
+    EVENT_TIMER,                                                        // timercurrent reaches timermax
+    EVENT_DISK,                                                         // the disk command completes
+    EVENT_IRQ2,                                                         // the next cycle listed in irq2in
+    SIM_NUM_EVENT_KINDS
+} SimEventKind;
+
+typedef struct {
+    uint64_t cycle;
+    SimEventKind kind;
+} SimEvent;
+
+typedef struct {
+    SimEvent heap[SIM_NUM_EVENT_KINDS];                                 // min-heap on cycle, at most one event per kind
+    int event_count;
+    int in_handler;                                                     // between entering irqhandler and `reti`
+    uint64_t timer_base;                                                // while enabled: timercurrent was timer_value at cycle timer_base
+    uint32_t timer_value;
+    uint32_t disk[SIM_DISK_WORDS];
+    uint8_t monitor[SIM_MONITOR_PIXELS];
+    const uint64_t* irq2_cycles;                                        // ascending, owned by the caller
+    int irq2_count;
+    int irq2_next;
+    FILE* leds_log;                                                     // "cycle value" per change, NULL = don't log
+    FILE* display_log;
+} SimDevices;
+
+// -----------------------------------------------------------------------
+//  Pages for snapshots (snapshot.c). Memory, the disk and the monitor are
+//  cut into SIM_PAGE_BYTES pages, numbered in that order; every write
+//  marks its page dirty, so a snapshot copies only the pages written
+//  since the last snapshot or restore and shares the rest.
+// -----------------------------------------------------------------------
+
+#define SIM_PAGE_BYTES 1024
+#define SIM_PAGE_WORDS (SIM_PAGE_BYTES / 4)
+#define SIM_MEM_PAGES (MEM_SIZE / SIM_PAGE_WORDS)
+#define SIM_DISK_PAGES (SIM_DISK_WORDS / SIM_PAGE_WORDS)
+#define SIM_MONITOR_PAGES (SIM_MONITOR_PIXELS / SIM_PAGE_BYTES)
+#define SIM_PAGES (SIM_MEM_PAGES + SIM_DISK_PAGES + SIM_MONITOR_PAGES)
+
+#define SIM_MEM_PAGE(addr) ((addr) / SIM_PAGE_WORDS)
+#define SIM_DISK_PAGE(word) (SIM_MEM_PAGES + (word) / SIM_PAGE_WORDS)
+#define SIM_MONITOR_PAGE(pixel) (SIM_MEM_PAGES + SIM_DISK_PAGES + (pixel) / SIM_PAGE_BYTES)
+
+// Per-address counters kept by runSimulator while sim->profile is set
+typedef struct {
+    uint64_t exec[MEM_SIZE];                                            // instructions fetched at each address
+    uint64_t cycles[MEM_SIZE];                                          // words fetched for them
+    uint64_t taken[MEM_SIZE];                                           // conditional branches there that were taken
+    uint64_t loads[MEM_SIZE];                                           // `lw` per data address
+    uint64_t stores[MEM_SIZE];                                          // `sw` per data address
+} SimProfile;
+
+// -----------------------------------------------------------------------
+//  Translated basic blocks (blocks.c). A block runs from a start pc to
+//  the first branch, jal, reti, halt or out, as ops specialised for
+//  their operands: $zero and $imm become constants and writes to them
+//  are dropped.
+// -----------------------------------------------------------------------
+
+#define SIM_BLOCK_MAX 64                                                // instructions per block
+#define SIM_BLOCK_OPS (4 * MEM_SIZE)                                    // ops translated before the cache starts over
+
+typedef struct {
+    uint8_t kind;                                                       // BlockOpKind (blocks.c)
+    uint8_t rd, rs, rt, wd;                                             // as in SimInst
+    uint8_t executed;                                                   // instructions of the block up to and including this one
+    uint8_t cycles;                                                     // cycles of the block up to and including this one
+    int32_t imm;                                                        // the folded constant operand, or SimInst.imm
+    uint16_t pc;
+    uint16_t next_pc;
+} BlockOp;
+
+typedef struct {
+    uint32_t first;                                                     // index of the first op
+    uint8_t count;                                                      // instructions, dropped ones included
+    uint8_t cycles;
+    uint8_t last_fetch;                                                 // cycles before the last instruction is fetched
+} Block;
+
+typedef struct {
+    uint32_t block_at[MEM_SIZE];                                        // 1 + index of the block starting here, 0 = none
+    uint8_t covered[MEM_SIZE];                                          // word belongs to a translated block
+    Block blocks[MEM_SIZE];
+    uint32_t block_count;
+    BlockOp ops[SIM_BLOCK_OPS];
+    uint32_t op_count;
+    uint64_t translated;                                                // blocks translated so far
+    uint64_t flushes;                                                   // times the cache was emptied
+} BlockCache;
+
+typedef struct {
+    uint32_t mem[MEM_SIZE];
+    SimInst code[MEM_SIZE];                                             // code[a] decodes mem[a] (and mem[a + 1] for big_imm)
+    uint32_t regs[NUM_REGS + 1];                                        // + the write sink
+    uint32_t io[SIM_NUM_IO_REGS];
+    uint32_t pc;
+    uint64_t instructions;                                              // executed so far
+    uint64_t cycles;                                                    // one per word fetched
+    SimStatus status;
+    uint64_t next_event;                                                // cycle of the earliest event, or now if an interrupt is due
+    uint64_t skipped_cycles;                                            // cycles fast-forwarded through idle loops
+    SimDevices dev;
+    uint8_t dirty[SIM_PAGES];                                           // written since page_id was set
+    uint64_t page_id[SIM_PAGES];                                        // snapshot page this one matched when last taken or restored, 0 = none
+    BlockCache blocks;
+    int interpret;                                                      // 1 = never use the block cache
+    SimProfile* profile;                                                // counters to update, NULL = none (set after initSimulator)
+    TraceWriter* trace;                                                 // execution trace to extend, NULL = none
+} SimState;
+
+// Reset sim and load image[0..count) at address 0
+void initSimulator(SimState* sim, const uint32_t* image, int count);
+
+// Decode mem[addr] into code[addr] again (after a store) - drops the translated blocks if they used it
+void predecodeWord(SimState* sim, uint32_t addr);
+
+// `sw` and disk reads: store value at addr, mark its page dirty and predecode what it changes
+void storeWord(SimState* sim, uint32_t addr, uint32_t value);
+
+// Run until `halt`, a bad opcode or max_instructions more instructions (0 = no limit)
+SimStatus runSimulator(SimState* sim, uint64_t max_instructions);
+
+// runSimulator one instruction at a time, without the block cache
+SimStatus runInterpreter(SimState* sim, uint64_t max_instructions);
+
+#endif // SIMULATOR_H
@@ -0,0 +1,232 @@
+﻿// -----------------------------------------------------------------------
+//  The SIMP run loop, included by simulator.c once per variant:
+//
+//      #define SIM_LOOP_NAME runPlain          name of the function
+//      #define SIM_INSTRUMENTED 0              1 = feed sim->profile / sim->trace
+//      #include "simulator_loop.h"
+//
+//  Keeping one copy of the handlers means the instrumented loop can never
+//  disagree with the plain one, and the plain loop carries no profiling
+//  or tracing code at all. Not a normal header - no include guard on purpose.
+//
+//  Devices cost one compare per instruction: `cycles` against `wake`,
+//  the next event relative to the start of this call. The plain loop
+//  also fast-forwards idle loops - when a backward branch lands where
+//  the last one did with every register the same and no store, `out` or
+//  clock read in between, the iterations to come are identical until
+//  the next event, so it adds up whole iterations instead of running
+//  them. Events then fire on exactly the instruction they would have.
+// -----------------------------------------------------------------------
+
+static SimStatus SIM_LOOP_NAME(SimState* sim, uint64_t max_instructions) {
+    uint32_t* R = sim->regs;
+    uint32_t* mem = sim->mem;
+    const SimInst* code = sim->code;
+    const SimInst* d;
+    uint32_t pc = sim->pc;
+    uint64_t budget = max_instructions ? max_instructions : UINT64_MAX;
+    uint64_t executed = 0;
+    uint64_t cycles = 0;
+    SimStatus status = SIM_LIMIT;
+    uint64_t wake;
+#define NOW() (sim->cycles + cycles)
+#define UPDATE_WAKE()                                                   \
+    wake = (sim->next_event == SIM_NO_EVENT) ? UINT64_MAX :             \
+           (sim->next_event > sim->cycles) ? sim->next_event - sim->cycles : 0
+    UPDATE_WAKE();
+
+#if !SIM_INSTRUMENTED && !defined(SIM_NO_FAST_FORWARD)
+    uint32_t idle_pc = UINT32_MAX;                                      // target of the last backward branch
+    uint64_t idle_executed = 0;
+    uint64_t idle_cycles = 0;
+    uint32_t idle_regs[NUM_REGS];
+#define IDLE_RESET() idle_pc = UINT32_MAX
+#define IDLE_CHECK()                                                    \
+    if (wake != UINT64_MAX) {                                           \
+        if (pc == idle_pc && memcmp(idle_regs, R, sizeof(idle_regs)) == 0) { \
+            uint64_t per_executed = executed - idle_executed;           \
+            uint64_t per_cycles = cycles - idle_cycles;                 \
+            uint64_t n = (wake > cycles) ? (wake - cycles) / per_cycles : 0; \
+            if (n > (budget - executed) / per_executed) {               \
+                n = (budget - executed) / per_executed;                 \
+            }                                                           \
+            executed += n * per_executed;                               \
+            cycles += n * per_cycles;                                   \
+            sim->skipped_cycles += n * per_cycles;                      \
+        }                                                               \
+        else {                                                          \
+            idle_pc = pc;                                               \
+            memcpy(idle_regs, R, sizeof(idle_regs));                    \
+        }                                                               \
+        idle_executed = executed;                                       \
+        idle_cycles = cycles;                                           \
+    }
+#else
+#define IDLE_RESET()
+#define IDLE_CHECK()
+#endif
+
+#if SIM_INSTRUMENTED
+    SimProfile* prof = sim->profile;
+    TraceWriter* trace = sim->trace;
+#define PROFILE(stmt) if (prof) { stmt; }
+#define TRACE() if (trace) { traceStep(trace, pc, mem[pc], R, d->wd); }
+#else
+#define PROFILE(stmt)
+#define TRACE()
+#endif
+
+#define FETCH()                                                         \
+    if (executed == budget) {                                           \
+        goto stop;                                                      \
+    }                                                                   \
+    if (cycles >= wake) {                                               \
+        pc = serviceEvents(sim, pc, NOW());                             \
+        UPDATE_WAKE();                                                  \
+        IDLE_RESET();                                                   \
+    }                                                                   \
+    d = &code[pc];                                                      \
+    R[REG_IMM] = (uint32_t)d->imm;                                      \
+    TRACE();                                                            \
+    executed++;                                                         \
+    cycles += d->words;                                                 \
+    PROFILE(prof->exec[pc]++; prof->cycles[pc] += d->words)
+
+// Conditional branch: pc = R[rd] when cond holds
+#define BRANCH(cond)                                                    \
+    do {                                                                \
+        int taken = (cond);                                             \
+        PROFILE(prof->taken[pc] += (uint64_t)taken);                    \
+        if (taken) {                                                    \
+            uint32_t from = pc;                                         \
+            pc = R[d->rd] & SIM_ADDR_MASK;                              \
+            if (pc <= from) {                                           \
+                IDLE_CHECK();                                           \
+            }                                                           \
+        }                                                               \
+        else {                                                          \
+            pc = d->next_pc;                                            \
+        }                                                               \
+        NEXT();                                                         \
+    } while (0)
+
+#if SIM_COMPUTED_GOTO
+    static void* const dispatch[NUM_OPCODES + 1] = {
+        &&op_add, &&op_sub, &&op_mul, &&op_and, &&op_or, &&op_xor, &&op_sll, &&op_sra, &&op_srl,
+        &&op_beq, &&op_bne, &&op_blt, &&op_bgt, &&op_ble, &&op_bge, &&op_jal,
+        &&op_lw, &&op_sw, &&op_reti, &&op_in, &&op_out, &&op_halt, &&op_invalid
+    };
+#define OP(name, num) op_##name:
+#define NEXT()                                                          \
+    do {                                                                \
+        FETCH();                                                        \
+        goto *dispatch[d->opcode];                                      \
+    } while (0)
+
+    NEXT();
+#else
+#define OP(name, num) case num:
+#define NEXT() goto next
+
+next:
+    FETCH();
+    switch (d->opcode) {
+#endif
+
+    // --- Arithmetic / logic ---------------------------------------------
+    OP(add, OP_ADD) R[d->wd] = R[d->rs] + R[d->rt];                     pc = d->next_pc; NEXT();
+    OP(sub, OP_SUB) R[d->wd] = R[d->rs] - R[d->rt];                     pc = d->next_pc; NEXT();
+    OP(mul, OP_MUL) R[d->wd] = R[d->rs] * R[d->rt];                     pc = d->next_pc; NEXT();
+    OP(and, OP_AND) R[d->wd] = R[d->rs] & R[d->rt];                     pc = d->next_pc; NEXT();
+    OP(or,  OP_OR)  R[d->wd] = R[d->rs] | R[d->rt];                     pc = d->next_pc; NEXT();
+    OP(xor, OP_XOR) R[d->wd] = R[d->rs] ^ R[d->rt];                     pc = d->next_pc; NEXT();
+    OP(sll, OP_SLL) R[d->wd] = R[d->rs] << (R[d->rt] & 31);             pc = d->next_pc; NEXT();
+    OP(sra, OP_SRA) R[d->wd] = (uint32_t)((int32_t)R[d->rs] >> (R[d->rt] & 31)); pc = d->next_pc; NEXT();
+    OP(srl, OP_SRL) R[d->wd] = R[d->rs] >> (R[d->rt] & 31);             pc = d->next_pc; NEXT();
+
+    // --- Branches: pc = R[rd] -------------------------------------------
+    OP(beq, OP_BEQ) BRANCH(R[d->rs] == R[d->rt]);
+    OP(bne, OP_BNE) BRANCH(R[d->rs] != R[d->rt]);
+    OP(blt, OP_BLT) BRANCH((int32_t)R[d->rs] <  (int32_t)R[d->rt]);
+    OP(bgt, OP_BGT) BRANCH((int32_t)R[d->rs] >  (int32_t)R[d->rt]);
+    OP(ble, OP_BLE) BRANCH((int32_t)R[d->rs] <= (int32_t)R[d->rt]);
+    OP(bge, OP_BGE) BRANCH((int32_t)R[d->rs] >= (int32_t)R[d->rt]);
+    OP(jal, OP_JAL) {
+        uint32_t target = R[d->rs] & SIM_ADDR_MASK;                     // read before rd is written (rd may be rs)
+        R[d->wd] = d->next_pc;
+        pc = target;
+        NEXT();
+    }
+
+    // --- Memory ---------------------------------------------------------
+    OP(lw, OP_LW) {
+        uint32_t addr = (R[d->rs] + R[d->rt]) & SIM_ADDR_MASK;
+        PROFILE(prof->loads[addr]++);
+        R[d->wd] = mem[addr];
+        pc = d->next_pc;
+        NEXT();
+    }
+    OP(sw, OP_SW) {
+        uint32_t addr = (R[d->rs] + R[d->rt]) & SIM_ADDR_MASK;
+        PROFILE(prof->stores[addr]++);
+        pc = d->next_pc;                                                // d itself may be decoded again below
+        IDLE_RESET();
+        storeWord(sim, addr, R[d->rd]);
+        NEXT();
+    }
+
+    // --- IO -------------------------------------------------------------
+    OP(reti, OP_RETI) {
+        pc = returnFromInterrupt(sim, NOW());
+        UPDATE_WAKE();
+        IDLE_RESET();
+        NEXT();
+    }
+    OP(in, OP_IN) {
+        uint32_t reg = R[d->rs] + R[d->rt];
+        if (reg == IO_CLKS || reg == IO_TIMERCURRENT) {
+            IDLE_RESET();                                               // changes without an event
+        }
+        R[d->wd] = (reg < SIM_NUM_IO_REGS) ? readIo(sim, reg, NOW()) : 0;
+        pc = d->next_pc;
+        NEXT();
+    }
+    OP(out, OP_OUT) {
+        uint32_t reg = R[d->rs] + R[d->rt];
+        if (reg < SIM_NUM_IO_REGS) {
+            writeIo(sim, reg, R[d->rd], NOW());
+            UPDATE_WAKE();
+        }
+        IDLE_RESET();
+        pc = d->next_pc;
+        NEXT();
+    }
+
+    OP(halt, OP_HALT) status = SIM_HALTED; goto stop;
+    OP(invalid, SIM_OP_INVALID) status = SIM_BAD_OPCODE; goto stop;
+
+#if !SIM_COMPUTED_GOTO
+    }
+#endif
+
+#undef FETCH
+#undef BRANCH
+#undef PROFILE
+#undef TRACE
+#undef NOW
+#undef UPDATE_WAKE
+#undef IDLE_RESET
+#undef IDLE_CHECK
+#undef OP
+#undef NEXT
+
+stop:
+    sim->pc = pc;
+    sim->instructions += executed;
+    sim->cycles += cycles;
+    sim->status = status;
+    return status;
+}
+
+#undef SIM_LOOP_NAME
+#undef SIM_INSTRUMENTED
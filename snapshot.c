@@ -0,0 +1,356 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "simulator.h"
+#include "snapshot.h"
+
+static const char snapshot_magic[8] = { 'S', 'I', 'M', 'P', 'S', 'N', 'P', '1' };
+
+#define SNAP_ZERO_ID 1                                                  // page_id of an all-zero page (stored as NULL)
+
+struct SnapPage {
+    uint32_t refs;                                                      // snapshots holding this page
+    uint64_t id;                                                        // unique, above SNAP_ZERO_ID
+    uint8_t data[SIM_PAGE_BYTES];                                       // as in SimState, host byte order
+};
+
+static uint64_t next_page_id = SNAP_ZERO_ID + 1;
+
+// -----------------------------------------------------------------------
+//    --- Pages ---
+// -----------------------------------------------------------------------
+
+static uint8_t* pageData(SimState* sim, int page) {
+    if (page < SIM_MEM_PAGES) {
+        return (uint8_t*)(sim->mem + (size_t)page * SIM_PAGE_WORDS);
+    }
+    page -= SIM_MEM_PAGES;
+    if (page < SIM_DISK_PAGES) {
+        return (uint8_t*)(sim->dev.disk + (size_t)page * SIM_PAGE_WORDS);
+    }
+    page -= SIM_DISK_PAGES;
+    return sim->dev.monitor + (size_t)page * SIM_PAGE_BYTES;
+}
+
+static int isWordPage(int page) {
+    return page < SIM_MEM_PAGES + SIM_DISK_PAGES;                       // memory and disk hold words, the monitor bytes
+}
+
+static uint64_t pageId(const SnapPage* page) {
+    return page ? page->id : SNAP_ZERO_ID;
+}
+
+static int isZeroPage(const uint8_t* data) {
+    for (int i = 0; i < SIM_PAGE_BYTES; i++) {
+        if (data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static SnapPage* newPage(const uint8_t* data) {
+    SnapPage* page = malloc(sizeof(SnapPage));
+    if (page) {
+        page->refs = 1;
+        page->id = next_page_id++;
+        memcpy(page->data, data, SIM_PAGE_BYTES);
+    }
+    return page;
+}
+
+static void releasePage(SnapPage* page) {
+    if (page && --page->refs == 0) {
+        free(page);
+    }
+}
+
+// -----------------------------------------------------------------------
+//    --- Take / restore ---
+// -----------------------------------------------------------------------
+
+Snapshot* takeSnapshot(SimState* sim, const Snapshot* base) {
+    Snapshot* snap = calloc(1, sizeof(Snapshot));
+    if (!snap) {
+        return NULL;
+    }
+    for (int p = 0; p < SIM_PAGES; p++) {
+        SnapPage* shared = base ? base->pages[p] : NULL;
+        if (base && !sim->dirty[p] && sim->page_id[p] == pageId(shared)) {
+            if (shared) {
+                shared->refs++;
+            }
+            snap->pages[p] = shared;
+        }
+        else if (!isZeroPage(pageData(sim, p)) && !(snap->pages[p] = newPage(pageData(sim, p)))) {
+            freeSnapshot(snap);
+            return NULL;
+        }
+    }
+    for (int p = 0; p < SIM_PAGES; p++) {                               // sim matches the snapshot now
+        sim->page_id[p] = pageId(snap->pages[p]);
+        sim->dirty[p] = 0;
+    }
+
+    snap->pc = sim->pc;
+    snap->status = sim->status;
+    memcpy(snap->regs, sim->regs, sizeof(snap->regs));
+    memcpy(snap->io, sim->io, sizeof(snap->io));
+    snap->instructions = sim->instructions;
+    snap->cycles = sim->cycles;
+    snap->skipped_cycles = sim->skipped_cycles;
+    snap->next_event = sim->next_event;
+    memcpy(snap->heap, sim->dev.heap, sizeof(snap->heap));
+    snap->event_count = sim->dev.event_count;
+    snap->in_handler = sim->dev.in_handler;
+    snap->timer_base = sim->dev.timer_base;
+    snap->timer_value = sim->dev.timer_value;
+    snap->irq2_next = sim->dev.irq2_next;
+    return snap;
+}
+
+void restoreSnapshot(SimState* sim, const Snapshot* snap) {
+    for (int p = 0; p < SIM_PAGES; p++) {
+        uint64_t id = pageId(snap->pages[p]);
+        if (sim->dirty[p] || sim->page_id[p] != id) {
+            uint8_t* data = pageData(sim, p);
+            if (snap->pages[p]) {
+                memcpy(data, snap->pages[p]->data, SIM_PAGE_BYTES);
+            }
+            else {
+                memset(data, 0, SIM_PAGE_BYTES);
+            }
+            if (p < SIM_MEM_PAGES) {
+                uint32_t first = (uint32_t)p * SIM_PAGE_WORDS;
+                for (uint32_t a = first - 1; a != first + SIM_PAGE_WORDS; a++) {
+                    predecodeWord(sim, a);                              // and the big_imm before the page
+                }
+            }
+        }
+        sim->page_id[p] = id;
+        sim->dirty[p] = 0;
+    }
+
+    sim->pc = snap->pc;
+    sim->status = snap->status;
+    memcpy(sim->regs, snap->regs, sizeof(snap->regs));                  // the write sink keeps its garbage
+    memcpy(sim->io, snap->io, sizeof(snap->io));
+    sim->instructions = snap->instructions;
+    sim->cycles = snap->cycles;
+    sim->skipped_cycles = snap->skipped_cycles;
+    sim->next_event = snap->next_event;
+    memcpy(sim->dev.heap, snap->heap, sizeof(snap->heap));
+    sim->dev.event_count = snap->event_count;
+    sim->dev.in_handler = snap->in_handler;
+    sim->dev.timer_base = snap->timer_base;
+    sim->dev.timer_value = snap->timer_value;
+    sim->dev.irq2_next = snap->irq2_next;
+}
+
+void freeSnapshot(Snapshot* snap) {
+    if (!snap) {
+        return;
+    }
+    for (int p = 0; p < SIM_PAGES; p++) {
+        releasePage(snap->pages[p]);
+    }
+    free(snap);
+}
+
+// -----------------------------------------------------------------------
+//    --- Files ---
+// -----------------------------------------------------------------------
+
+static uint8_t* putU16(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static uint8_t* putU32(uint8_t* p, uint32_t v) {
+    p = putU16(p, v & 0xFFFF);
+    return putU16(p, v >> 16);
+}
+
+static uint8_t* putU64(uint8_t* p, uint64_t v) {
+    p = putU32(p, (uint32_t)v);
+    return putU32(p, (uint32_t)(v >> 32));
+}
+
+int saveSnapshot(const char* filename, const Snapshot* snap) {
+    uint8_t header[512];
+    uint8_t* p = header;
+    memcpy(p, snapshot_magic, sizeof(snapshot_magic));
+    p += sizeof(snapshot_magic);
+    p = putU32(p, snap->pc);
+    p = putU32(p, (uint32_t)snap->status);
+    for (int r = 0; r < NUM_REGS; r++) {
+        p = putU32(p, snap->regs[r]);
+    }
+    for (int i = 0; i < SIM_NUM_IO_REGS; i++) {
+        p = putU32(p, snap->io[i]);
+    }
+    p = putU64(p, snap->instructions);
+    p = putU64(p, snap->cycles);
+    p = putU64(p, snap->skipped_cycles);
+    p = putU64(p, snap->next_event);
+    p = putU32(p, (uint32_t)snap->event_count);
+    for (int i = 0; i < snap->event_count; i++) {
+        p = putU64(p, snap->heap[i].cycle);
+        p = putU32(p, (uint32_t)snap->heap[i].kind);
+    }
+    p = putU32(p, (uint32_t)snap->in_handler);
+    p = putU64(p, snap->timer_base);
+    p = putU32(p, snap->timer_value);
+    p = putU32(p, (uint32_t)snap->irq2_next);
+    uint32_t stored = 0;
+    for (int i = 0; i < SIM_PAGES; i++) {
+        stored += (snap->pages[i] != NULL);
+    }
+    p = putU32(p, stored);
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        return 1;
+    }
+    int failed = fwrite(header, 1, (size_t)(p - header), file) != (size_t)(p - header);
+    for (int i = 0; i < SIM_PAGES && !failed; i++) {
+        const SnapPage* page = snap->pages[i];
+        if (!page) {
+            continue;
+        }
+        uint8_t out[4 + SIM_PAGE_BYTES];
+        if (isWordPage(i)) {
+            const uint32_t* words = (const uint32_t*)page->data;
+            for (int w = 0; w < SIM_PAGE_WORDS; w++) {
+                putU32(out + 4 + 4 * w, words[w]);
+            }
+        }
+        else {
+            memcpy(out + 4, page->data, SIM_PAGE_BYTES);
+        }
+        uint32_t len = SIM_PAGE_BYTES;
+        while (len > 0 && out[4 + len - 1] == 0) {
+            len--;                                                      // the rest reads back as zeros
+        }
+        putU16(putU16(out, (uint32_t)i), len);
+        failed = fwrite(out, 1, 4 + len, file) != 4 + len;
+    }
+    failed |= ferror(file);
+    failed |= (fclose(file) != 0);
+    return failed;
+}
+
+// Bounds-checked cursor over a snapshot file
+typedef struct {
+    const uint8_t* p;
+    size_t left;
+    int bad;                                                            // ran past the end
+} SnapReader;
+
+static const uint8_t* take(SnapReader* r, size_t n) {
+    if (r->left < n) {
+        r->bad = 1;
+        r->left = 0;
+        return NULL;
+    }
+    const uint8_t* p = r->p;
+    r->p += n;
+    r->left -= n;
+    return p;
+}
+
+static uint32_t getU16(SnapReader* r) {
+    const uint8_t* p = take(r, 2);
+    return p ? (uint32_t)p[0] | ((uint32_t)p[1] << 8) : 0;
+}
+
+static uint32_t getU32(SnapReader* r) {
+    uint32_t lo = getU16(r);
+    return lo | (getU16(r) << 16);
+}
+
+static uint64_t getU64(SnapReader* r) {
+    uint64_t lo = getU32(r);
+    return lo | ((uint64_t)getU32(r) << 32);
+}
+
+Snapshot* loadSnapshot(const char* filename) {
+    size_t len = 0;
+    char* bytes = readFileBytes(filename, &len);
+    if (!bytes) {
+        return NULL;
+    }
+    Snapshot* snap = calloc(1, sizeof(Snapshot));
+    SnapReader r = { (const uint8_t*)bytes, len, 0 };
+    const uint8_t* magic = take(&r, sizeof(snapshot_magic));
+    if (!snap || !magic || memcmp(magic, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+        free(snap);
+        free(bytes);
+        return NULL;
+    }
+
+    snap->pc = getU32(&r);
+    uint32_t status = getU32(&r);
+    snap->status = (SimStatus)status;
+    for (int i = 0; i < NUM_REGS; i++) {
+        snap->regs[i] = getU32(&r);
+    }
+    for (int i = 0; i < SIM_NUM_IO_REGS; i++) {
+        snap->io[i] = getU32(&r);
+    }
+    snap->instructions = getU64(&r);
+    snap->cycles = getU64(&r);
+    snap->skipped_cycles = getU64(&r);
+    snap->next_event = getU64(&r);
+    uint32_t events = getU32(&r);
+    int bad = r.bad || snap->pc >= MEM_SIZE || status > SIM_BAD_OPCODE || events > SIM_NUM_EVENT_KINDS;
+    for (uint32_t i = 0; i < events && !bad; i++) {
+        snap->heap[i].cycle = getU64(&r);
+        uint32_t kind = getU32(&r);
+        snap->heap[i].kind = (SimEventKind)kind;
+        bad = kind >= SIM_NUM_EVENT_KINDS;
+    }
+    snap->event_count = (int)events;
+    snap->in_handler = getU32(&r) != 0;
+    snap->timer_base = getU64(&r);
+    snap->timer_value = getU32(&r);
+    snap->irq2_next = (int)getU32(&r);
+    uint32_t stored = getU32(&r);
+    bad |= r.bad || snap->irq2_next < 0 || stored > SIM_PAGES;
+
+    for (uint32_t i = 0; i < stored && !bad; i++) {
+        uint32_t page = getU16(&r);
+        uint32_t page_len = getU16(&r);
+        const uint8_t* data = take(&r, page_len);
+        if (r.bad || page >= SIM_PAGES || page_len > SIM_PAGE_BYTES || snap->pages[page]) {
+            bad = 1;
+            break;
+        }
+        uint8_t in[SIM_PAGE_BYTES] = { 0 };
+        memcpy(in, data, page_len);
+        uint32_t host[SIM_PAGE_WORDS];                                  // page->data layout
+        if (isWordPage((int)page)) {
+            for (int w = 0; w < SIM_PAGE_WORDS; w++) {
+                const uint8_t* b = in + 4 * w;
+                host[w] = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+            }
+        }
+        else {
+            memcpy(host, in, SIM_PAGE_BYTES);
+        }
+        if (!isZeroPage((const uint8_t*)host) && !(snap->pages[page] = newPage((const uint8_t*)host))) {
+            bad = 1;
+        }
+    }
+    free(bytes);
+    if (bad || r.left != 0) {
+        freeSnapshot(snap);
+        return NULL;
+    }
+    return snap;
+}
@@ -0,0 +1,62 @@
+﻿#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "simulator.h"
+
+// -----------------------------------------------------------------------
+//  Machine snapshots: pc, registers, counters, IO registers and device
+//  state, plus memory, the disk and the monitor as SIM_PAGE_BYTES pages.
+//  Pages are reference-counted and shared: a snapshot taken on top of
+//  another copies only the pages the machine wrote since it last
+//  matched that one, and restoring copies back only the pages that
+//  differ - rerunning from the same checkpoint costs about as much as
+//  the pages the last run dirtied. All-zero pages aren't stored at all.
+//
+//  Not part of a snapshot: the irq2 input list (irq2_next indexes the
+//  caller's), the log files, the block cache, profile and trace.
+//
+//  File: the 8 bytes "SIMPSNP1", then (little-endian)
+//      u32 pc, status, regs[NUM_REGS], io[SIM_NUM_IO_REGS]
+//      u64 instructions, cycles, skipped_cycles, next_event
+//      u32 event_count, then per event u64 cycle, u32 kind
+//      u32 in_handler, u64 timer_base, u32 timer_value, irq2_next
+//      u32 stored pages, then per page
+//          u16 page number, u16 bytes, the page up to its last non-zero byte
+// -----------------------------------------------------------------------
+
+typedef struct SnapPage SnapPage;
+
+typedef struct {
+    SnapPage* pages[SIM_PAGES];                                         // NULL = all zeros
+    uint32_t pc;
+    SimStatus status;
+    uint32_t regs[NUM_REGS];
+    uint32_t io[SIM_NUM_IO_REGS];
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t skipped_cycles;
+    uint64_t next_event;
+    SimEvent heap[SIM_NUM_EVENT_KINDS];
+    int event_count;
+    int in_handler;
+    uint64_t timer_base;
+    uint32_t timer_value;
+    int irq2_next;
+} Snapshot;
+
+// Snapshot sim, sharing the pages it hasn't written since it matched base (NULL = copy them all) - NULL if out of memory
+Snapshot* takeSnapshot(SimState* sim, const Snapshot* base);
+
+// Put sim back into the state of snap, copying only the pages that differ
+void restoreSnapshot(SimState* sim, const Snapshot* snap);
+
+void freeSnapshot(Snapshot* snap);
+
+// Write snap to filename - return 0 on success
+int saveSnapshot(const char* filename, const Snapshot* snap);
+
+// Read a snapshot written by saveSnapshot - NULL on failure
+Snapshot* loadSnapshot(const char* filename);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,243 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+// -----------------------------------------------------------------------
+//    --- Watch session test ---
+// -----------------------------------------------------------------------
+//  Edits a program step by step and checks after every step that the
+//  incremental session agrees with a full assembly of the same source:
+//  same success or failure and, on success, the same image and size.
+//  Covers a program that stops fitting in memory and then fits again,
+//  then runs seeded random edit sequences (inserts, deletes, rewrites,
+//  and big blocks that overflow memory and are later taken out).
+//
+//  Build and run (from the repository root):
+//      make test
+//  or  build/watch_test [sequences] [seed]
+// -----------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../assembler.h"
+#include "../watch.h"
+
+#define MAX_LINES 12000
+#define LINE_LEN 64
+
+// The program as an array of lines, joined into a fresh buffer per step
+typedef struct {
+    char (*lines)[LINE_LEN];
+    int count;
+} Program;
+
+static unsigned int rng_state;
+
+static unsigned int nextRandom(void) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return rng_state >> 8;
+}
+
+static void insertLine(Program* prog, int at, const char* text) {
+    if (prog->count >= MAX_LINES) {
+        return;
+    }
+    memmove(prog->lines[at + 1], prog->lines[at], (size_t)(prog->count - at) * LINE_LEN);
+    snprintf(prog->lines[at], LINE_LEN, "%s", text);
+    prog->count++;
+}
+
+static void deleteLines(Program* prog, int at, int n) {
+    if (n > prog->count - at) {
+        n = prog->count - at;
+    }
+    memmove(prog->lines[at], prog->lines[at + n], (size_t)(prog->count - at - n) * LINE_LEN);
+    prog->count -= n;
+}
+
+static char* joinProgram(const Program* prog, size_t* len_out) {
+    size_t len = 0;
+    for (int i = 0; i < prog->count; i++) {
+        len += strlen(prog->lines[i]) + 1;
+    }
+    char* src = malloc(len + 1);
+    if (!src) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(1);
+    }
+    size_t p = 0;
+    for (int i = 0; i < prog->count; i++) {
+        size_t n = strlen(prog->lines[i]);
+        memcpy(src + p, prog->lines[i], n);
+        src[p + n] = '\n';
+        p += n + 1;
+    }
+    *len_out = len;
+    return src;
+}
+
+// Feed the current program to the session and to a full assembly - return 1 if they disagree
+static int checkStep(WatchSession* ws, const Program* prog, const char* what) {
+    size_t len = 0;
+    char* src = joinProgram(prog, &len);
+    AsmOptions opts = { 0 };
+    opts.threads = 1;
+    AsmResult result;
+    int full = assembleProgram(src, len, &opts, &result);
+    WatchStats stats;
+    int watch = updateWatchSession(ws, src, len, &stats);              // the session takes over src
+
+    int bad = 0;
+    if ((full != 0) != (watch != 0)) {
+        printf("%s: full assembly %s, watch session %s\n", what, full ? "failed" : "ok", watch ? "failed" : "ok");
+        bad = 1;
+    }
+    else if (full == 0 && ws->words_used != result.words_used) {
+        printf("%s: %d words used, watch session says %d\n", what, result.words_used, ws->words_used);
+        bad = 1;
+    }
+    for (int w = 0; full == 0 && !bad && w < MEM_SIZE; w++) {
+        if (ws->image[w] != imageWord(&result.image, w)) {
+            printf("%s: word %d is %08X, watch session has %08X\n", what, w, imageWord(&result.image, w), ws->image[w]);
+            bad = 1;
+        }
+    }
+    freeAsmResult(&result);
+    return bad;
+}
+
+static WatchSession* newSession(void) {
+    WatchSession* ws = malloc(sizeof(WatchSession));                    // three full images - too big for the stack
+    if (!ws || initWatchSession(ws)) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(1);
+    }
+    return ws;
+}
+
+static void freeSession(WatchSession* ws) {
+    freeWatchSession(ws);
+    free(ws);
+}
+
+// -----------------------------------------------------------------------
+//    --- Overflow, then fit again ---
+// -----------------------------------------------------------------------
+//  Kept label immediates must still be resolved while the program does
+//  not fit: the next update only looks again at labels that move from
+//  the failed layout.
+
+static int testOverflowRecovery(Program* prog) {
+    WatchSession* ws = newSession();
+    prog->count = 0;
+    insertLine(prog, 0, "jal $ra, $imm, $zero, L1");
+    for (int i = 0; i < 100; i++) {
+        insertLine(prog, prog->count, "add $t0, $t0, $zero, 0");
+    }
+    insertLine(prog, prog->count, "L1:");
+    insertLine(prog, prog->count, "halt $zero, $zero, $zero, 0");
+    for (int i = 0; i < 3000; i++) {
+        insertLine(prog, prog->count, "add $zero, $zero, $zero, 0");
+    }
+    int bad = checkStep(ws, prog, "overflow: initial program");
+
+    for (int i = 0; i < 600; i++) {                                     // two words each: no longer fits
+        insertLine(prog, 1, "add $t1, $t1, $imm, 1000");
+    }
+    bad |= checkStep(ws, prog, "overflow: grown past memory");
+
+    deleteLines(prog, prog->count - 1000, 1000);                        // L1 stays where the failed layout put it
+    bad |= checkStep(ws, prog, "overflow: trimmed to fit");
+
+    freeSession(ws);
+    return bad;
+}
+
+// -----------------------------------------------------------------------
+//    --- Random edit sequences ---
+// -----------------------------------------------------------------------
+
+static void randomLine(char* out) {
+    switch (nextRandom() % 10) {
+    case 0:
+    case 1:
+        snprintf(out, LINE_LEN, "L%u:", nextRandom() % 30);
+        break;
+    case 2:
+    case 3:
+    case 4:
+        snprintf(out, LINE_LEN, "add $t0, $t1, $imm, %d", (int)(nextRandom() % 300) - 150);
+        break;
+    case 5:
+    case 6:
+    case 7:
+        snprintf(out, LINE_LEN, "beq $imm, $t0, $zero, L%u", nextRandom() % 32);   // L30 and L31 are never defined
+        break;
+    case 8:
+        snprintf(out, LINE_LEN, ".word %u L%u", 3000 + nextRandom() % 1000, nextRandom() % 30);
+        break;
+    default:
+        snprintf(out, LINE_LEN, "# comment %u", nextRandom() % 100);
+        break;
+    }
+}
+
+static int testRandomEdits(Program* prog, int sequences, int steps) {
+    int bad = 0;
+    for (int s = 0; s < sequences && !bad; s++) {
+        WatchSession* ws = newSession();
+        char line[LINE_LEN];
+        prog->count = 0;
+        int n = 20 + (int)(nextRandom() % 200);
+        for (int i = 0; i < n; i++) {
+            randomLine(line);
+            insertLine(prog, prog->count, line);
+        }
+        for (int step = 0; step < steps && !bad; step++) {
+            int at = prog->count ? (int)(nextRandom() % (unsigned)prog->count) : 0;
+            unsigned int op = nextRandom() % 20;
+            if (step > 0 && op < 7) {
+                randomLine(line);
+                insertLine(prog, at, line);
+            }
+            else if (step > 0 && op < 12 && prog->count > 1) {
+                deleteLines(prog, at, 1);
+            }
+            else if (step > 0 && op < 18 && prog->count > 0) {
+                randomLine(prog->lines[at]);
+            }
+            else if (step > 0 && op == 18) {
+                for (int i = 0; i < 2100; i++) {                        // two words each: past the end of memory
+                    insertLine(prog, at, "add $t1, $t1, $imm, 1000");
+                }
+            }
+            else if (step > 0 && prog->count > 2100) {
+                deleteLines(prog, at, 1500 + (int)(nextRandom() % 1000));
+            }
+            char what[64];
+            snprintf(what, sizeof(what), "sequence %d step %d", s, step);
+            bad |= checkStep(ws, prog, what);
+        }
+        freeSession(ws);
+    }
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    int sequences = (argc > 1) ? atoi(argv[1]) : 100;
+    rng_state = (argc > 2) ? (unsigned int)strtoul(argv[2], NULL, 10) : 1;
+
+    Program prog;
+    prog.lines = malloc((size_t)(MAX_LINES + 1) * LINE_LEN);
+    prog.count = 0;
+    if (!prog.lines) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+
+    int bad = testOverflowRecovery(&prog);
+    bad |= testRandomEdits(&prog, sequences, 60);
+    free(prog.lines);
+
+    printf("watch_test: %s\n", bad ? "FAILED" : "ok");
+    return bad;
+}
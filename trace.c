@@ -0,0 +1,315 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "simulator.h"
+#include "platform.h"
+#include "trace.h"
+
+static const char trace_magic[8] = { 'S', 'I', 'M', 'P', 'T', 'R', 'C', '1' };
+
+// -----------------------------------------------------------------------
+//    --- Block writer ---
+// -----------------------------------------------------------------------
+
+static void putU32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Write one block with its header - return 0 on success
+static int writeBlock(FILE* file, const TraceBlock* b) {
+    uint8_t header[8];
+    putU32(header, b->len);
+    putU32(header + 4, b->records);
+    return fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+           fwrite(b->data, 1, b->len, file) != b->len;
+}
+
+static void writerMain(void* arg) {
+    TraceWriter* tw = arg;
+    lockMutex(&tw->lock);
+    for (;;) {
+        while (tw->queued == 0 && !tw->closing) {
+            waitCondVar(&tw->ready, &tw->lock);
+        }
+        if (tw->queued == 0) {
+            break;                                                      // closing and drained
+        }
+        const TraceBlock* b = &tw->blocks[tw->head];
+        unlockMutex(&tw->lock);
+        int bad = writeBlock(tw->file, b);                              // the block is ours until queued drops
+        lockMutex(&tw->lock);
+        tw->failed |= bad;
+        tw->head = (tw->head + 1) % TRACE_BLOCKS;
+        tw->queued--;
+        signalCondVar(&tw->freed);
+    }
+    unlockMutex(&tw->lock);
+}
+
+// Hand the block being filled to the writer and move to the next free one
+static void flushBlock(TraceWriter* tw) {
+    TraceBlock* b = &tw->blocks[tw->fill];
+    if (b->len == 0) {
+        return;
+    }
+    tw->bytes += 8 + b->len;
+    if (!tw->threaded) {
+        tw->failed |= writeBlock(tw->file, b);
+        b->len = 0;
+        b->records = 0;
+        return;
+    }
+    lockMutex(&tw->lock);
+    tw->queued++;
+    signalCondVar(&tw->ready);
+    while (tw->queued == TRACE_BLOCKS) {                                // the next block is still being written
+        waitCondVar(&tw->freed, &tw->lock);
+    }
+    unlockMutex(&tw->lock);
+    tw->fill = (tw->fill + 1) % TRACE_BLOCKS;
+    tw->blocks[tw->fill].len = 0;
+    tw->blocks[tw->fill].records = 0;
+}
+
+TraceWriter* openTrace(const char* filename) {
+    TraceWriter* tw = calloc(1, sizeof(TraceWriter));
+    if (!tw) {
+        return NULL;
+    }
+    tw->blocks = malloc(TRACE_BLOCKS * sizeof(TraceBlock));
+    tw->file = fopen(filename, "wb");
+    if (!tw->blocks || !tw->file || fwrite(trace_magic, 1, sizeof(trace_magic), tw->file) != sizeof(trace_magic)) {
+        if (tw->file) {
+            fclose(tw->file);
+        }
+        free(tw->blocks);
+        free(tw);
+        return NULL;
+    }
+    tw->bytes = sizeof(trace_magic);
+    tw->written = UINT32_MAX;
+    tw->blocks[0].len = 0;
+    tw->blocks[0].records = 0;
+
+    initMutex(&tw->lock);
+    initCondVar(&tw->ready);
+    initCondVar(&tw->freed);
+    tw->threaded = (startThread(&tw->thread, writerMain, tw) == 0);
+    return tw;
+}
+
+int closeTrace(TraceWriter* tw, uint64_t* bytes) {
+    flushBlock(tw);
+    if (bytes) {
+        *bytes = tw->bytes;
+    }
+    if (tw->threaded) {
+        lockMutex(&tw->lock);
+        tw->closing = 1;
+        signalCondVar(&tw->ready);
+        unlockMutex(&tw->lock);
+        joinThread(tw->thread);
+    }
+    int failed = tw->failed || ferror(tw->file);
+    failed |= (fclose(tw->file) != 0);
+    destroyCondVar(&tw->freed);
+    destroyCondVar(&tw->ready);
+    destroyMutex(&tw->lock);
+    free(tw->blocks);
+    free(tw);
+    return failed;
+}
+
+// -----------------------------------------------------------------------
+//    --- Records ---
+// -----------------------------------------------------------------------
+
+static uint8_t* putVarint(uint8_t* p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static int lowestBit(uint32_t mask) {                                   // mask != 0
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static uint32_t instWords(uint32_t inst) {
+    return (inst & (1u << 8)) ? 2 : 1;                                  // big_imm takes the next word
+}
+
+void traceStep(TraceWriter* tw, uint32_t pc, uint32_t inst, const uint32_t* regs, uint32_t wd) {
+    TraceBlock* b = &tw->blocks[tw->fill];
+    if (b->len > TRACE_BLOCK_BYTES - TRACE_MAX_RECORD) {
+        flushBlock(tw);
+        b = &tw->blocks[tw->fill];
+    }
+    uint8_t* rec = b->data + b->len;
+    uint8_t* p = rec + 1;
+    uint32_t flags = 0;
+
+    if (pc != tw->next_pc) {
+        int32_t delta = (int32_t)pc - (int32_t)tw->next_pc;
+        flags |= TRACE_PC_JUMP;
+        p = putVarint(p, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));   // zigzag: small either way
+    }
+    if (!tw->inst_known[pc] || tw->inst[pc] != inst) {
+        flags |= TRACE_INST;
+        tw->inst[pc] = inst;
+        tw->inst_known[pc] = 1;
+        putU32(p, inst);
+        p += 4;
+    }
+    uint32_t mask = (uint32_t)(regs[REG_IMM] != tw->regs[REG_IMM]) << REG_IMM;
+    if (tw->written < NUM_REGS) {                                       // the only other register that can differ
+        mask |= (uint32_t)(regs[tw->written] != tw->regs[tw->written]) << tw->written;
+    }
+    else if (tw->written > SIM_REG_SINK) {                              // first record: anything may differ
+        for (int r = 1; r < NUM_REGS; r++) {                            // ($zero is always 0)
+            mask |= (uint32_t)(regs[r] != tw->regs[r]) << r;
+        }
+    }
+    uint32_t changed = 0;
+    while (mask) {
+        int r = lowestBit(mask);
+        mask &= mask - 1;
+        *p++ = (uint8_t)r;
+        p = putVarint(p, regs[r] ^ tw->regs[r]);
+        tw->regs[r] = regs[r];
+        changed++;
+    }
+    rec[0] = (uint8_t)(flags | (changed << 4));
+    b->len = (uint32_t)(p - b->data);
+    b->records++;
+    tw->records++;
+    tw->next_pc = (pc + instWords(inst)) & SIM_ADDR_MASK;
+    tw->written = wd;
+}
+
+// -----------------------------------------------------------------------
+//    --- Text conversion ---
+// -----------------------------------------------------------------------
+
+static const uint8_t* getVarint(const uint8_t* p, const uint8_t* end, uint32_t* v) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *v = value;
+            return p;
+        }
+    }
+    return NULL;                                                        // truncated or overlong
+}
+
+static char* putHex(char* s, uint32_t v, int digits) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (int i = digits - 1; i >= 0; i--) {
+        s[i] = hex[v & 0xF];
+        v >>= 4;
+    }
+    return s + digits;
+}
+
+int convertTrace(const char* filename, FILE* out) {
+    FILE* in = fopen(filename, "rb");
+    if (!in) {
+        return 1;
+    }
+    uint8_t* payload = malloc(TRACE_BLOCK_BYTES);
+    uint32_t* inst = calloc(MEM_SIZE, sizeof(uint32_t));
+    uint8_t header[8];
+    int status = (!payload || !inst || fread(header, 1, sizeof(header), in) != sizeof(header) ||
+                  memcmp(header, trace_magic, sizeof(trace_magic)) != 0);
+
+    uint32_t regs[NUM_REGS] = { 0 };
+    uint32_t next_pc = 0;
+    char line[4 + 9 + NUM_REGS * 9 + 1];
+    while (status == 0 && fread(header, 1, sizeof(header), in) == sizeof(header)) {
+        uint32_t len = getU32(header);
+        uint32_t records = getU32(header + 4);
+        if (len > TRACE_BLOCK_BYTES || fread(payload, 1, len, in) != len) {
+            status = 1;
+            break;
+        }
+        const uint8_t* p = payload;
+        const uint8_t* end = payload + len;
+        for (uint32_t n = 0; n < records && status == 0; n++) {
+            if (p >= end) {
+                status = 1;
+                break;
+            }
+            uint32_t flags = *p++;
+            uint32_t pc = next_pc;
+            if (flags & TRACE_PC_JUMP) {
+                uint32_t zz = 0;
+                p = getVarint(p, end, &zz);
+                pc = (pc + ((zz >> 1) ^ (0u - (zz & 1)))) & SIM_ADDR_MASK;
+            }
+            if (p && (flags & TRACE_INST)) {
+                if (end - p < 4) {
+                    p = NULL;
+                }
+                else {
+                    inst[pc] = getU32(p);
+                    p += 4;
+                }
+            }
+            for (uint32_t c = flags >> 4; c > 0 && p; c--) {
+                uint32_t diff = 0;
+                uint32_t r = (p < end) ? *p++ : NUM_REGS;
+                p = (r < NUM_REGS) ? getVarint(p, end, &diff) : NULL;
+                if (p) {
+                    regs[r] ^= diff;
+                }
+            }
+            if (!p) {
+                status = 1;
+                break;
+            }
+            next_pc = (pc + instWords(inst[pc])) & SIM_ADDR_MASK;
+
+            char* s = putHex(line, pc, 3);
+            *s++ = ' ';
+            s = putHex(s, inst[pc], 8);
+            for (int r = 0; r < NUM_REGS; r++) {
+                *s++ = ' ';
+                s = putHex(s, regs[r], 8);
+            }
+            *s++ = '\n';
+            if (fwrite(line, 1, (size_t)(s - line), out) != (size_t)(s - line)) {
+                status = 2;
+            }
+        }
+    }
+    if (status == 0 && ferror(in)) {
+        status = 1;
+    }
+    fclose(in);
+    free(payload);
+    free(inst);
+    return status;
+}
@@ -0,0 +1,81 @@
+﻿#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "simulator.h"
+#include "platform.h"
+
+// -----------------------------------------------------------------------
+//  Compact execution trace. The simulator hands every instruction to
+//  traceStep, which appends a delta record to a block in memory; full
+//  blocks go to a background thread that writes them out, so the run
+//  loop never waits on the disk unless it gets TRACE_BLOCKS ahead.
+//
+//  File: the 8 bytes "SIMPTRC1", then blocks of
+//      u32 payload bytes, u32 records, payload          (little-endian)
+//  Each record describes the state just before one instruction runs:
+//      flags byte      bit 0: pc is not the previous pc + its words
+//                      bit 1: instruction word follows (not seen at this pc,
+//                             or changed since)
+//                      bits 4-7: number of registers that changed
+//      [pc delta]      zigzag varint, pc - expected pc
+//      [instruction]   4 bytes
+//      per change:     register number, varint of new ^ old value
+//  $zero never changes and $imm is one of the registers, so a record
+//  is usually 3-8 bytes against ~160 for a line of the text trace.
+// -----------------------------------------------------------------------
+
+#define TRACE_BLOCK_BYTES (64 * 1024)
+#define TRACE_BLOCKS 8                                                  // blocks in flight before traceStep waits
+#define TRACE_MAX_RECORD (1 + 5 + 4 + (NUM_REGS - 1) * 6)
+
+#define TRACE_PC_JUMP 0x01
+#define TRACE_INST 0x02
+
+typedef struct {
+    uint8_t data[TRACE_BLOCK_BYTES];
+    uint32_t len;
+    uint32_t records;
+} TraceBlock;
+
+struct TraceWriter {
+    FILE* file;
+    TraceBlock* blocks;                                                 // ring of TRACE_BLOCKS
+    int fill;                                                           // block traceStep appends to
+    int head;                                                           // oldest block waiting to be written
+    int queued;                                                         // full blocks not yet written
+    int closing;
+    int failed;                                                         // a write failed
+    int threaded;                                                       // 0 = the writer thread didn't start, write inline
+    Thread thread;
+    Mutex lock;
+    CondVar ready;                                                      // a block was queued, or closing
+    CondVar freed;                                                      // a block was written
+
+    uint32_t regs[NUM_REGS];                                            // registers as of the last record
+    uint32_t written;                                                   // register the last instruction writes (SimInst.wd), above SIM_REG_SINK before the first
+    uint32_t next_pc;                                                   // pc expected if the next record doesn't jump
+    uint32_t inst[MEM_SIZE];                                            // last instruction word recorded at each pc
+    uint8_t inst_known[MEM_SIZE];
+    uint64_t records;
+    uint64_t bytes;                                                     // file size so far, header included
+};
+
+// Create filename and start its writer thread - NULL on failure
+TraceWriter* openTrace(const char* filename);
+
+// Record one instruction: pc, the word there, the registers ($imm loaded) before it runs
+// and the register it will write (SimInst.wd) - only that one and $imm are compared next time
+void traceStep(TraceWriter* tw, uint32_t pc, uint32_t inst, const uint32_t* regs, uint32_t wd);
+
+// Flush, stop the writer thread and free tw - return 0 if everything was written.
+// The final file size goes to *bytes unless it is NULL.
+int closeTrace(TraceWriter* tw, uint64_t* bytes);
+
+// Expand a binary trace into text, one line per instruction:
+//      PC INST R0 R1 ... R15           (hex; PC 3 digits, the rest 8)
+// Return 0 on success, 1 if the file can't be read or is malformed, 2 on a write error
+int convertTrace(const char* filename, FILE* out);
+
+#endif // TRACE_H
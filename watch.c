@@ -0,0 +1,336 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "watch.h"
+
+// -----------------------------------------------------------------------
+//    --- Session setup ---
+// -----------------------------------------------------------------------
+
+int initWatchSession(WatchSession* ws) {
+    memset(ws, 0, sizeof(*ws));
+    return initAsmContext(&ws->ctx, NULL, 0, NULL);                     // only its label table and diagnostics are used
+}
+
+void freeWatchSession(WatchSession* ws) {
+    freeAsmContext(&ws->ctx);
+    free(ws->lines);
+    free(ws->src);
+    ws->src = NULL;
+    ws->lines = NULL;
+}
+
+// View of a line token in the current source
+static Token lineToken(const WatchSession* ws, const WatchLine* wl, int t) {
+    Token tok;
+    tok.ptr = ws->src + wl->start + wl->tokens[t].offset;
+    tok.len = wl->tokens[t].len;
+    return tok;
+}
+
+static WatchToken watchToken(const char* line_start, Token tok) {
+    WatchToken wt;
+    wt.offset = (uint32_t)(tok.ptr - line_start);
+    wt.len = (uint32_t)tok.len;
+    return wt;
+}
+
+// -----------------------------------------------------------------------
+//    --- Diff - find the lines that changed ---
+// -----------------------------------------------------------------------
+//  Lines fully inside the common byte prefix (up to and including their
+//  '\n') or fully inside the common byte suffix (with the '\n' before
+//  them) read exactly the same in both versions and are kept.
+
+// Length of the common prefix of a[0..len) and b[0..len)
+static size_t commonPrefix(const char* a, const char* b, size_t len) {
+    size_t n = 0;
+    while (n + 4096 <= len && memcmp(a + n, b + n, 4096) == 0) {        // skip equal blocks with memcmp
+        n += 4096;
+    }
+    while (n < len && a[n] == b[n]) {
+        n++;
+    }
+    return n;
+}
+
+// Length of the common suffix of a[0..len) and b[0..len)
+static size_t commonSuffix(const char* a_end, const char* b_end, size_t len) {
+    size_t n = 0;
+    while (n + 4096 <= len && memcmp(a_end - n - 4096, b_end - n - 4096, 4096) == 0) {
+        n += 4096;
+    }
+    while (n < len && a_end[-1 - (ptrdiff_t)n] == b_end[-1 - (ptrdiff_t)n]) {
+        n++;
+    }
+    return n;
+}
+
+// -----------------------------------------------------------------------
+//    --- Reparse the lines in between ---
+// -----------------------------------------------------------------------
+
+// Lex and encode the line at src[start..) into wl - return where the next line starts
+static size_t parseWatchLine(WatchSession* ws, size_t start, size_t end, int line_num, WatchLine* wl) {
+    const char* line_start = ws->src + start;
+    const char* cursor = line_start;
+    AsmLine line;
+    lexLine(&cursor, ws->src + end, &line);
+
+    memset(wl, 0, sizeof(*wl));
+    wl->start = start;
+    wl->len = (size_t)(cursor - line_start);
+    wl->kind = line.kind;
+
+    switch (line.kind) {
+    case LINE_BLANK:
+        break;
+
+    case LINE_LABEL:
+        wl->tokens[0] = watchToken(line_start, line.label);
+        wl->label_hash = hashLabel(line.label.ptr, line.label.len);
+        break;
+
+    case LINE_WORD:
+        if (line.ntok < 3) {
+            addDiagnostic(&ws->ctx, 1, line_num, "`.word` needs an address and a value");
+            wl->has_error = 1;
+            break;
+        }
+        for (int t = 0; t < 3; t++) {
+            wl->tokens[t] = watchToken(line_start, line.tokens[t]);
+        }
+        break;
+
+    case LINE_GLOBAL:                                                   // nothing to export from a whole program
+        if (line.ntok != 2) {
+            addDiagnostic(&ws->ctx, 1, line_num, "`.global` needs exactly one label name");
+            wl->has_error = 1;
+        }
+        break;
+
+    case LINE_INST: {
+        AsmInst inst;
+        if (parseInstruction(&ws->ctx, &line, line_num, &inst)) {
+            wl->has_error = 1;
+            break;
+        }
+        wl->words = encodeInstructionWords(&inst, wl->encoded);
+        if (inst.label.ptr) {
+            wl->tokens[0] = watchToken(line_start, inst.label);         // resolved during layout
+            wl->label_hash = hashLabel(inst.label.ptr, inst.label.len);
+        }
+        break;
+    }
+    }
+    return start + wl->len;
+}
+
+// Replace old lines [first, last) with the lines of src[start..end) - return how many were parsed, -1 if out of memory
+static int replaceLines(WatchSession* ws, int first, int last, size_t start, size_t end, ptrdiff_t delta) {
+    int count = 0;                                                      // new lines in the middle
+    for (size_t p = start; p < end; count++) {
+        const char* nl = memchr(ws->src + p, '\n', end - p);
+        p = nl ? (size_t)(nl - ws->src) + 1 : end;
+    }
+
+    int tail = ws->line_count - last;
+    int new_count = first + count + tail;
+    if (new_count > ws->line_cap) {
+        int new_cap = ws->line_cap ? ws->line_cap : 256;
+        while (new_cap < new_count) {
+            new_cap *= 2;
+        }
+        WatchLine* grown = realloc(ws->lines, (size_t)new_cap * sizeof(WatchLine));
+        if (!grown) {
+            return -1;
+        }
+        ws->lines = grown;
+        ws->line_cap = new_cap;
+    }
+
+    memmove(&ws->lines[first + count], &ws->lines[last], (size_t)tail * sizeof(WatchLine));
+    for (int i = first + count; i < new_count; i++) {                   // the unchanged tail only moved in the buffer
+        ws->lines[i].start = (size_t)((ptrdiff_t)ws->lines[i].start + delta);
+    }
+    ws->line_count = new_count;
+
+    size_t p = start;
+    for (int i = 0; i < count; i++) {
+        p = parseWatchLine(ws, p, end, first + i + 1, &ws->lines[first + i]);
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------
+//    --- Update ---
+// -----------------------------------------------------------------------
+//  Labels that are added, removed or laid out at a new address set a bit
+//  for their name's hash; a kept label immediate is looked up again only
+//  when its bit is set (a collision just costs one extra lookup).
+
+#define WATCH_MOVED_BITS 4096
+
+static void markMoved(uint64_t* moved, uint32_t hash) {
+    moved[hash % WATCH_MOVED_BITS / 64] |= 1ull << (hash % 64);
+}
+
+static int hasMoved(const uint64_t* moved, uint32_t hash) {
+    return (moved[hash % WATCH_MOVED_BITS / 64] >> (hash % 64)) & 1;
+}
+
+int updateWatchSession(WatchSession* ws, char* src, size_t len, WatchStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    AsmContext* ctx = &ws->ctx;
+    ctx->diag_count = 0;
+    ctx->error_count = 0;
+
+    // --- Diff against the old source -----------------------------------
+    size_t old_len = ws->src_len;
+    size_t shorter = (len < old_len) ? len : old_len;
+    size_t prefix = ws->src ? commonPrefix(ws->src, src, shorter) : 0;
+    size_t suffix = ws->src ? commonSuffix(ws->src + old_len, src + len, shorter - prefix) : 0;
+
+    int first = 0;                                                      // old lines [first, last) changed
+    while (first < ws->line_count) {
+        const WatchLine* wl = &ws->lines[first];
+        if (wl->start + wl->len > prefix || ws->src[wl->start + wl->len - 1] != '\n') {
+            break;
+        }
+        first++;
+    }
+    int last = ws->line_count;
+    while (last > first && ws->lines[last - 1].start > old_len - suffix) {
+        last--;
+    }
+
+    // Labels defined on the lines that go away change the label table
+    uint64_t moved[WATCH_MOVED_BITS / 64] = { 0 };
+    for (int i = first; i < last; i++) {
+        if (ws->lines[i].kind == LINE_LABEL) {
+            stats->labels_moved++;
+            markMoved(moved, ws->lines[i].label_hash);
+        }
+    }
+
+    ptrdiff_t delta = (ptrdiff_t)len - (ptrdiff_t)old_len;
+    size_t start = first ? ws->lines[first - 1].start + ws->lines[first - 1].len : 0;
+    size_t end = (last < ws->line_count) ? (size_t)((ptrdiff_t)ws->lines[last].start + delta) : len;
+
+    free(ws->src);                                                      // the kept lines only hold offsets
+    ws->src = src;
+    ws->src_len = len;
+    int parsed = replaceLines(ws, first, last, start, end, delta);
+    if (parsed < 0) {
+        addDiagnostic(ctx, 1, 0, "out of memory");
+        ws->line_count = 0;                                             // start over on the next update
+        return 1;
+    }
+    stats->lines_reparsed = parsed;
+    int mid_end = first + parsed;                                       // lines [first, mid_end) are new
+
+    // --- Lay out addresses and rebuild the label table -----------------
+    // Done even when the update fails: line addresses, the label table and
+    // the resolved immediates always describe the same, latest layout
+    ctx->label_count = 0;
+    if (ctx->label_slots) {
+        memset(ctx->label_slots, 0, (size_t)ctx->slot_count * sizeof(int));
+    }
+    int addr = 0;
+    int fits = 1;
+    for (int i = 0; i < ws->line_count; i++) {
+        WatchLine* wl = &ws->lines[i];
+        int is_new = (i >= first && i < mid_end);
+        if (wl->kind == LINE_LABEL) {
+            if (is_new || wl->address != addr) {
+                stats->labels_moved++;
+                markMoved(moved, wl->label_hash);
+            }
+            Token name = lineToken(ws, wl, 0);
+            defineLabel(ctx, name.ptr, name.len, addr, i + 1);
+        }
+        wl->address = addr;
+        stats->error_lines += wl->has_error;
+        if (wl->kind == LINE_INST && fits) {
+            if (addr + wl->words > MEM_SIZE) {
+                addDiagnostic(ctx, 1, i + 1, "program does not fit in %d words", MEM_SIZE);
+                fits = 0;
+            }
+            addr += wl->words;
+        }
+    }
+    int words_used = addr;
+
+    // --- Resolve label immediates --------------------------------------
+    // New lines always, kept lines only when a label of their name moved -
+    // also when the program doesn't fit, or the next update would compare
+    // against labels that were never resolved
+    int from = stats->labels_moved ? 0 : first;
+    int to = stats->labels_moved ? ws->line_count : mid_end;
+    for (int i = from; i < to; i++) {
+        WatchLine* wl = &ws->lines[i];
+        int is_new = (i >= first && i < mid_end);
+        if (wl->kind != LINE_INST || wl->tokens[0].len == 0 || wl->has_error || (!is_new && !hasMoved(moved, wl->label_hash))) {
+            continue;
+        }
+        Token label = lineToken(ws, wl, 0);
+        int target = lookupLabel(ctx, label.ptr, label.len);            // −1 if the label was never defined
+        if (target < 0) {
+            addDiagnostic(ctx, 0, i + 1, "unknown label `%.*s`", (int)label.len, label.ptr);
+        }
+        wl->encoded[1] = (uint32_t)target;
+        stats->fixups_resolved++;
+    }
+
+    if (!fits || ctx->error_count > 0 || stats->error_lines > 0 || ctx->out_of_memory) {
+        return 1;                                                       // keep the last good image
+    }
+
+    // --- Build the image and compare it with the last one --------------
+    memset(ws->next, 0, sizeof(ws->next));
+    for (int i = 0; i < ws->line_count; i++) {
+        const WatchLine* wl = &ws->lines[i];
+        if (wl->kind == LINE_INST) {
+            memcpy(&ws->next[wl->address], wl->encoded, (size_t)wl->words * sizeof(uint32_t));
+        }
+    }
+    for (int i = 0; i < ws->line_count; i++) {                          // `.word` directives, in source order
+        const WatchLine* wl = &ws->lines[i];
+        if (wl->kind != LINE_WORD) {
+            continue;
+        }
+        Token tokens[3];
+        for (int t = 0; t < 3; t++) {
+            tokens[t] = lineToken(ws, wl, t);
+        }
+        int word_addr;
+        uint32_t word_data;
+        if (processWordDirective(ctx, tokens, 3, i + 1, &word_addr, &word_data)) {
+            continue;
+        }
+        if (word_addr >= wl->address && word_addr < words_used) {
+            continue;                                                   // an instruction further down the file overwrote this word
+        }
+        ws->next[word_addr] = word_data;
+    }
+    if (ctx->error_count > 0) {
+        return 1;
+    }
+
+    ws->changed_count = 0;
+    for (int w = 0; w < MEM_SIZE; w++) {
+        if (!ws->has_image || ws->next[w] != ws->image[w]) {
+            ws->changed[ws->changed_count++] = w;
+        }
+    }
+    memcpy(ws->image, ws->next, sizeof(ws->image));
+    ws->words_used = words_used;
+    ws->has_image = 1;
+    stats->words_changed = ws->changed_count;
+    return 0;
+}
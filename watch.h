@@ -0,0 +1,69 @@
+﻿#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+#include "assembler.h"
+
+// -----------------------------------------------------------------------
+//  Incremental reassembly for --watch. A session keeps every source line
+//  with its kind, address and encoded words, the label table and the last
+//  image. An update diffs the new source against the old one byte-wise,
+//  lexes and encodes only the lines in between the common prefix and
+//  suffix, lays the lines out again, re-resolves only the label
+//  immediates that name a label which moved, and lists the image words
+//  that changed so the caller can rewrite just those lines of the image
+//  file.
+//  Watch mode encodes like a plain assembly (no --relax, no -O).
+// -----------------------------------------------------------------------
+
+typedef struct {
+    uint32_t offset;                                                    // from the start of the line
+    uint32_t len;
+} WatchToken;
+
+// One source line as the session remembers it
+typedef struct {
+    size_t start;                                                       // offset of the line in the source
+    size_t len;                                                         // including its '\n'
+    LineKind kind;
+    int has_error;                                                      // did not parse - takes no words
+    int address;                                                        // first word of the line (latest layout)
+    int words;                                                          // words an instruction takes (0-2)
+    uint32_t encoded[2];                                                // machine words, encoded[1] holds a resolved label
+    WatchToken tokens[3];                                               // label name / label immediate / `.word` tokens
+    uint32_t label_hash;                                                // hashLabel of the label name or label immediate
+} WatchLine;
+
+typedef struct {
+    int lines_reparsed;                                                 // lines lexed and encoded again
+    int labels_moved;                                                   // labels added, removed or at a new address
+    int fixups_resolved;                                                // label immediates looked up again
+    int words_changed;                                                  // image words that differ from the last good image
+    int error_lines;                                                    // lines that still do not parse
+} WatchStats;
+
+typedef struct {
+    char* src;                                                          // current source (owned)
+    size_t src_len;
+    WatchLine* lines;
+    int line_count, line_cap;
+    int words_used;                                                     // words taken by instructions in image
+
+    AsmContext ctx;                                                     // label table and diagnostics of the last update
+    uint32_t image[MEM_SIZE];                                           // last good image
+    uint32_t next[MEM_SIZE];                                            // image being built
+    int changed[MEM_SIZE];                                              // addresses that differ after the last update
+    int changed_count;
+    int has_image;                                                      // image holds a good build
+} WatchSession;
+
+// Set up an empty session - return 0 on success
+int initWatchSession(WatchSession* ws);
+void freeWatchSession(WatchSession* ws);
+
+// Take over src[0..len) (malloc'd) as the new source and bring the session
+// up to date. Returns 0 if the image was rebuilt (ws->changed lists the
+// words that differ), 1 on errors - the last good image is kept.
+int updateWatchSession(WatchSession* ws, char* src, size_t len, WatchStats* stats);
+
+#endif // WATCH_H